@@ -5,15 +5,15 @@
 #include <unordered_map>
 #include <unordered_set>
 
-#include <raylib.h>
-
-#include "TextUtils.hpp"
-
 // see https://schema.org/MusicRecording for some info
 // also look up the multimedia section of "awesome-falsehood"
+// What the library says a song is. The decoder goes by what's actually
+// in the file, see Decoder.hpp.
 enum class AudioFormat {
     MP3,
-    OPUS
+    OPUS,
+    VORBIS,
+    WAV
 };
 
 using EntityId = long int;
@@ -25,17 +25,19 @@ struct SongEntry {
     AudioFormat fileFormat;
     std::string name;
     std::string byArtist;
+    EntityId entryId;  // rowid in collections_contents, NO_ENTITY if not from a collection
 };
 
 struct CollectionEntry {
     EntityId id;
     std::string name;
+    bool smart;  // contents are maintained by rules, see SmartCollections.hpp
 };
 
 struct PlaybackState {
-    Music audioBuffer;
     const SongEntry* metadata;
     float duration;
     float currTime;
+    bool finished;  // reached the end by itself, as opposed to being skipped
 };
 
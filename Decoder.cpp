@@ -0,0 +1,281 @@
+#include "Decoder.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// raylib compiles the implementations of these into raudio.c,
+// so we only need the declarations.
+#include <external/dr_mp3.h>
+#include <external/dr_wav.h>
+#define STB_VORBIS_HEADER_ONLY
+#include <external/stb_vorbis.c>
+
+#include "OggOpus.hpp"
+
+static_assert(sizeof(SeekPoint) == sizeof(drmp3_seek_point) &&
+              offsetof(SeekPoint, byteOffset) == offsetof(drmp3_seek_point, seekPosInBytes) &&
+              offsetof(SeekPoint, frame) == offsetof(drmp3_seek_point, pcmFrameIndex) &&
+              offsetof(SeekPoint, mp3FramesToDiscard) == offsetof(drmp3_seek_point, mp3FramesToDiscard) &&
+              offsetof(SeekPoint, pcmFramesToDiscard) == offsetof(drmp3_seek_point, pcmFramesToDiscard),
+              "SeekPoint has to match drmp3_seek_point.");
+
+static bool EndsWith(std::string_view str, std::string_view suffix) {
+    if (str.size() < suffix.size())
+        return false;
+
+    for (size_t i = 0; i < suffix.size(); i++) {
+        char ch = str[str.size() - suffix.size() + i];
+        if (ch >= 'A' && ch <= 'Z')
+            ch += 'a' - 'A';
+        if (ch != suffix[i])
+            return false;
+    }
+    return true;
+}
+
+static DecoderKind GuessKind(std::string_view filename) {
+    if (EndsWith(filename, ".mp3")) return DecoderKind::MP3;
+    if (EndsWith(filename, ".ogg")) return DecoderKind::VORBIS;
+    if (EndsWith(filename, ".wav")) return DecoderKind::WAV;
+    if (EndsWith(filename, ".opus")) return DecoderKind::OPUS;
+    return DecoderKind::NONE;
+}
+
+static DecoderKind SniffKind(const MappedFile& file, std::string_view filename) {
+    const uint8_t* d = file.data;
+    const size_t n = file.size;
+
+    if (IsOggOpus(d, n))
+        return DecoderKind::OPUS;
+    // anything else in an Ogg is stb_vorbis' problem
+    if (n >= 4 && std::memcmp(d, "OggS", 4) == 0)
+        return DecoderKind::VORBIS;
+    if (n >= 12 && std::memcmp(d, "RIFF", 4) == 0 && std::memcmp(d + 8, "WAVE", 4) == 0)
+        return DecoderKind::WAV;
+    // an ID3v2 tag or a frame sync
+    if ((n >= 3 && std::memcmp(d, "ID3", 3) == 0) || (n >= 2 && d[0] == 0xff && (d[1] & 0xe0) == 0xe0))
+        return DecoderKind::MP3;
+    return GuessKind(filename);
+}
+
+bool OpenDecoder(Decoder& dec, const char* filename) {
+    dec = Decoder{};
+    if (!MapFile(dec.file, filename))
+        return false;
+
+    const uint8_t* data = dec.file.data;
+    const size_t size = dec.file.size;
+    const DecoderKind kind = SniffKind(dec.file, filename);
+    bool ok = false;
+
+    switch (kind) {
+    case DecoderKind::MP3: {
+        auto* mp3 = new drmp3;
+        if (!drmp3_init_memory(mp3, data, size, nullptr)) {
+            delete mp3;
+            break;
+        }
+        dec.handle = mp3;
+        dec.sampleRate = mp3->sampleRate;
+        dec.channels = mp3->channels;
+        ok = true;
+    } break;
+
+    case DecoderKind::VORBIS: {
+        int err = 0;
+        stb_vorbis* vorbis = stb_vorbis_open_memory(data, static_cast<int>(size), &err, nullptr);
+        if (!vorbis)
+            break;
+        const stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+        dec.handle = vorbis;
+        dec.sampleRate = info.sample_rate;
+        dec.channels = info.channels;
+        ok = true;
+    } break;
+
+    case DecoderKind::WAV: {
+        auto* wav = new drwav;
+        if (!drwav_init_memory(wav, data, size, nullptr)) {
+            delete wav;
+            break;
+        }
+        dec.handle = wav;
+        dec.sampleRate = wav->sampleRate;
+        dec.channels = wav->channels;
+        ok = true;
+    } break;
+
+    case DecoderKind::OPUS: {
+        auto* opus = new OggOpus;
+        if (!OpenOggOpus(*opus, data, size)) {
+            CloseOggOpus(*opus);
+            delete opus;
+            break;
+        }
+        dec.handle = opus;
+        dec.sampleRate = OPUS_RATE;
+        dec.channels = opus->channels;
+        ok = true;
+    } break;
+
+    case DecoderKind::NONE:
+        break;
+    }
+
+    if (!ok) {
+        UnmapFile(dec.file);
+        return false;
+    }
+
+    dec.kind = kind;
+    return true;
+}
+
+void CloseDecoder(Decoder& dec) {
+    switch (dec.kind) {
+    case DecoderKind::MP3: {
+        auto* mp3 = static_cast<drmp3*>(dec.handle);
+        drmp3_uninit(mp3);
+        delete mp3;
+    } break;
+    case DecoderKind::VORBIS: {
+        stb_vorbis_close(static_cast<stb_vorbis*>(dec.handle));
+    } break;
+    case DecoderKind::WAV: {
+        auto* wav = static_cast<drwav*>(dec.handle);
+        drwav_uninit(wav);
+        delete wav;
+    } break;
+    case DecoderKind::OPUS: {
+        auto* opus = static_cast<OggOpus*>(dec.handle);
+        CloseOggOpus(*opus);
+        delete opus;
+    } break;
+    case DecoderKind::NONE:
+        break;
+    }
+
+    UnmapFile(dec.file);
+    dec = Decoder{};
+}
+
+size_t ReadFrames(Decoder& dec, float* out, size_t frames) {
+    switch (dec.kind) {
+    case DecoderKind::MP3:
+        return drmp3_read_pcm_frames_f32(static_cast<drmp3*>(dec.handle), frames, out);
+    case DecoderKind::VORBIS: {
+        const int nFloats = static_cast<int>(frames * dec.channels);
+        return stb_vorbis_get_samples_float_interleaved(static_cast<stb_vorbis*>(dec.handle),
+                                                        dec.channels, out, nFloats);
+    }
+    case DecoderKind::WAV:
+        return drwav_read_pcm_frames_f32(static_cast<drwav*>(dec.handle), frames, out);
+    case DecoderKind::OPUS:
+        return ReadOggOpus(*static_cast<OggOpus*>(dec.handle), out, frames);
+    case DecoderKind::NONE:
+        break;
+    }
+    return 0;
+}
+
+bool SeekDecoder(Decoder& dec, uint64_t frame) {
+    switch (dec.kind) {
+    case DecoderKind::MP3:
+        return drmp3_seek_to_pcm_frame(static_cast<drmp3*>(dec.handle), frame);
+    case DecoderKind::VORBIS:
+        return stb_vorbis_seek(static_cast<stb_vorbis*>(dec.handle), static_cast<unsigned int>(frame));
+    case DecoderKind::WAV:
+        return drwav_seek_to_pcm_frame(static_cast<drwav*>(dec.handle), frame);
+    case DecoderKind::OPUS:
+        return SeekOggOpus(*static_cast<OggOpus*>(dec.handle), frame);
+    case DecoderKind::NONE:
+        break;
+    }
+    return false;
+}
+
+uint64_t TotalFrames(Decoder& dec) {
+    if (dec.knownTotalFrames > 0)
+        return dec.knownTotalFrames;
+
+    switch (dec.kind) {
+    case DecoderKind::MP3:
+        return drmp3_get_pcm_frame_count(static_cast<drmp3*>(dec.handle));
+    case DecoderKind::VORBIS:
+        return stb_vorbis_stream_length_in_samples(static_cast<stb_vorbis*>(dec.handle));
+    case DecoderKind::WAV:
+        return static_cast<drwav*>(dec.handle)->totalPCMFrameCount;
+    case DecoderKind::OPUS:
+        return OggOpusTotalFrames(*static_cast<OggOpus*>(dec.handle));
+    case DecoderKind::NONE:
+        break;
+    }
+    return 0;
+}
+
+bool BuildSeekIndex(Decoder& dec, float interval, std::vector<SeekPoint>& points, uint64_t& totalFrames) {
+    if (dec.kind != DecoderKind::MP3)
+        return false;
+
+    auto* mp3 = static_cast<drmp3*>(dec.handle);
+    drmp3_uint64 mp3Frames = 0;
+    drmp3_uint64 pcmFrames = 0;
+    if (!drmp3_get_mp3_and_pcm_frame_count(mp3, &mp3Frames, &pcmFrames) || pcmFrames == 0)
+        return false;
+
+    const uint64_t wanted = pcmFrames / static_cast<uint64_t>(interval * dec.sampleRate) + 1;
+    drmp3_uint32 count = static_cast<drmp3_uint32>(std::min<uint64_t>(wanted, mp3Frames));
+    points.resize(count);
+    if (!drmp3_calculate_seek_points(mp3, &count, reinterpret_cast<drmp3_seek_point*>(points.data())))
+        return false;
+
+    points.resize(count);
+    totalFrames = pcmFrames;
+    return drmp3_seek_to_pcm_frame(mp3, 0);
+}
+
+void UseSeekIndex(Decoder& dec, std::vector<SeekPoint> points, uint64_t totalFrames) {
+    dec.knownTotalFrames = totalFrames;
+    dec.seekPoints = std::move(points);
+
+    if (dec.kind == DecoderKind::MP3 && !dec.seekPoints.empty()) {
+        // dr_mp3 binary searches this on every seek
+        drmp3_bind_seek_table(static_cast<drmp3*>(dec.handle), static_cast<drmp3_uint32>(dec.seekPoints.size()),
+                              reinterpret_cast<drmp3_seek_point*>(dec.seekPoints.data()));
+    }
+}
+
+bool DecodeMono(const char* filename, float seconds,
+                std::vector<float>& out, unsigned int& sampleRate) {
+    Decoder dec;
+    if (!OpenDecoder(dec, filename))
+        return false;
+
+    sampleRate = dec.sampleRate;
+    const size_t limit = seconds > 0.0f ? static_cast<size_t>(seconds * dec.sampleRate) : SIZE_MAX;
+
+    constexpr size_t chunkFrames = 4096;
+    std::vector<float> chunk(chunkFrames * dec.channels);
+    out.clear();
+
+    while (out.size() < limit) {
+        const size_t want = std::min(chunkFrames, limit - out.size());
+        const size_t got = ReadFrames(dec, chunk.data(), want);
+        if (got == 0)
+            break;
+
+        const float scale = 1.0f / dec.channels;
+        for (size_t i = 0; i < got; i++) {
+            float sum = 0.0f;
+            for (unsigned int c = 0; c < dec.channels; c++)
+                sum += chunk[i * dec.channels + c];
+            out.push_back(sum * scale);
+        }
+    }
+
+    CloseDecoder(dec);
+    return !out.empty();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "MappedFile.hpp"
+
+// Streaming PCM decoding for the formats raylib already bundles decoders for,
+// plus Opus (see OggOpus.hpp). raylib's Music can only be played, not read
+// from, so anything that needs the actual samples (analysis, our own
+// playback path) goes through here.
+//
+// Which decoder gets used is decided by sniffing the first few bytes,
+// the extension is only a fallback.
+//
+// Output is always interleaved float in the file's native rate/channels.
+// The file itself is mmap'd and decoded in place, see MappedFile.hpp.
+
+enum class DecoderKind {
+    NONE,
+    MP3,
+    VORBIS,
+    WAV,
+    OPUS
+};
+
+// Where decoding has to restart to reach `frame`, see SeekIndex.hpp.
+// Same layout as drmp3_seek_point.
+struct SeekPoint {
+    uint64_t byteOffset;
+    uint64_t frame;
+    uint16_t mp3FramesToDiscard;
+    uint16_t pcmFramesToDiscard;
+};
+
+struct Decoder {
+    DecoderKind kind = DecoderKind::NONE;
+    void* handle = nullptr;
+    unsigned int sampleRate = 0;
+    unsigned int channels = 0;
+    MappedFile file;
+
+    // Filled in by UseSeekIndex. The MP3 decoder keeps pointing into
+    // seekPoints, so leave it alone while the decoder is open.
+    std::vector<SeekPoint> seekPoints;
+    uint64_t knownTotalFrames = 0;
+};
+
+bool OpenDecoder(Decoder& dec, const char* filename);
+void CloseDecoder(Decoder& dec);
+
+// Returns the number of frames written to `out`, 0 once the stream is done.
+size_t ReadFrames(Decoder& dec, float* out, size_t frames);
+
+bool SeekDecoder(Decoder& dec, uint64_t frame);
+
+// Beware: for MP3 this has to scan the whole file, unless there's a seek index.
+uint64_t TotalFrames(Decoder& dec);
+
+// Walks the whole file once and notes where to restart decoding for every
+// `interval` seconds. Only does anything for MP3, the other formats can
+// already seek without help. Leaves the decoder at the start.
+bool BuildSeekIndex(Decoder& dec, float interval, std::vector<SeekPoint>& points, uint64_t& totalFrames);
+// From here on, seeking and TotalFrames are lookups.
+void UseSeekIndex(Decoder& dec, std::vector<SeekPoint> points, uint64_t totalFrames);
+
+// Decodes at most `seconds` from the start of the file (all of it if
+// seconds <= 0), downmixed to mono. Convenience for the analysis jobs.
+bool DecodeMono(const char* filename, float seconds,
+                std::vector<float>& out, unsigned int& sampleRate);
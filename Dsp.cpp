@@ -0,0 +1,204 @@
+#include "Dsp.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+#include "Simd.hpp"
+
+constexpr float LIMITER_RELEASE_SECONDS = 0.1f;
+
+DspSettings DefaultDspSettings() {
+    DspSettings settings{
+        .enabled = true,
+        .preampDb = 0.0f,
+        .bands = {},
+        .limiter = true,
+        .limiterCeilingDb = -0.3f
+    };
+    for (int b = 0; b < EQ_BANDS; b++)
+        settings.bands[b] = { EqBandType::PEAK, 31.25f * static_cast<float>(1 << b), 0.0f, 1.41f };
+    return settings;
+}
+
+// RBJ's Audio EQ Cookbook, normalized so a0 = 1
+static DspCoefficients::Biquad MakeBiquad(const EqBand& band, unsigned int sampleRate) {
+    const double freq = std::clamp<double>(band.freq, 10.0, 0.45 * sampleRate);
+    const double q = std::max(0.1f, band.q);
+    const double a = std::pow(10.0, band.gainDb / 40.0);
+    const double w0 = 2.0 * std::numbers::pi * freq / sampleRate;
+    const double cosw = std::cos(w0);
+    const double alpha = std::sin(w0) / (2.0 * q);
+    const double shelf = 2.0 * std::sqrt(a) * alpha;
+
+    double b0, b1, b2, a0, a1, a2;
+    switch (band.type) {
+    case EqBandType::LOW_SHELF:
+        b0 = a * ((a + 1.0) - (a - 1.0) * cosw + shelf);
+        b1 = 2.0 * a * ((a - 1.0) - (a + 1.0) * cosw);
+        b2 = a * ((a + 1.0) - (a - 1.0) * cosw - shelf);
+        a0 = (a + 1.0) + (a - 1.0) * cosw + shelf;
+        a1 = -2.0 * ((a - 1.0) + (a + 1.0) * cosw);
+        a2 = (a + 1.0) + (a - 1.0) * cosw - shelf;
+        break;
+    case EqBandType::HIGH_SHELF:
+        b0 = a * ((a + 1.0) + (a - 1.0) * cosw + shelf);
+        b1 = -2.0 * a * ((a - 1.0) + (a + 1.0) * cosw);
+        b2 = a * ((a + 1.0) + (a - 1.0) * cosw - shelf);
+        a0 = (a + 1.0) - (a - 1.0) * cosw + shelf;
+        a1 = 2.0 * ((a - 1.0) - (a + 1.0) * cosw);
+        a2 = (a + 1.0) - (a - 1.0) * cosw - shelf;
+        break;
+    case EqBandType::PEAK:
+    default:
+        b0 = 1.0 + alpha * a;
+        b1 = -2.0 * cosw;
+        b2 = 1.0 - alpha * a;
+        a0 = 1.0 + alpha / a;
+        a1 = -2.0 * cosw;
+        a2 = 1.0 - alpha / a;
+        break;
+    }
+
+    return { b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0 };
+}
+
+DspCoefficients MakeDspCoefficients(const DspSettings& settings, unsigned int sampleRate) {
+    DspCoefficients c{};
+    c.preamp = settings.enabled ? std::pow(10.0f, settings.preampDb / 20.0f) : 1.0f;
+    c.limiter = settings.enabled && settings.limiter;
+    c.ceiling = std::pow(10.0f, std::min(0.0f, settings.limiterCeilingDb) / 20.0f);
+    // within ~60 dB of where it's going by the time the peak comes out of the delay
+    c.attack = 1.0f - std::exp(-6.9f / LIMITER_LOOKAHEAD);
+    c.release = 1.0f - std::exp(-1.0f / (LIMITER_RELEASE_SECONDS * sampleRate));
+
+    c.activeCount = 0;
+    for (int b = 0; b < EQ_BANDS; b++) {
+        c.bands[b] = MakeBiquad(settings.bands[b], sampleRate);
+        // a flat band is a no-op, whatever its type
+        if (settings.enabled && std::fabs(settings.bands[b].gainDb) >= 0.05f)
+            c.active[c.activeCount++] = static_cast<uint8_t>(b);
+    }
+    return c;
+}
+
+DspChain::DspChain() {
+    DspSettings flat = DefaultDspSettings();
+    flat.enabled = false;
+    m_current = MakeDspCoefficients(flat, 48000);
+    m_previous = m_current;
+}
+
+void DspChain::Set(const DspCoefficients& coefficients) {
+    // Set twice before a Process, the first one was never heard
+    if (!m_fading) {
+        m_previous = m_current;
+        m_fading = true;
+    }
+    m_current = coefficients;
+
+    // Bands that weren't running have stale state, they start from silence instead
+    for (int b = 0; b < EQ_BANDS; b++) {
+        const auto end = m_previous.active.begin() + m_previous.activeCount;
+        if (std::find(m_previous.active.begin(), end, b) == end)
+            std::fill(m_state.begin() + b * 4, m_state.begin() + b * 4 + 4, 0.0);
+    }
+}
+
+// Preamp and bands, in place. Goes through doubles once per block rather
+// than once per band.
+void DspChain::Filter(const DspCoefficients& c, double* state, float* frames, size_t count) {
+    if (c.activeCount == 0) {
+        if (c.preamp != 1.0f)
+            for (size_t i = 0; i < count * 2; i++)
+                frames[i] *= c.preamp;
+        return;
+    }
+
+    double* work = m_work.data();
+    for (size_t i = 0; i < count * 2; i++)
+        work[i] = static_cast<double>(frames[i]) * c.preamp;
+
+    for (int k = 0; k < c.activeCount; k++) {
+        const int b = c.active[k];
+        const DspCoefficients::Biquad& f = c.bands[b];
+        f64x2 z[2];
+        std::memcpy(z, state + b * 4, sizeof(z));
+
+        for (size_t i = 0; i < count; i++) {
+            f64x2 x;
+            std::memcpy(&x, work + 2 * i, sizeof(x));
+            const f64x2 y = f.b0 * x + z[0];
+            z[0] = f.b1 * x - f.a1 * y + z[1];
+            z[1] = f.b2 * x - f.a2 * y;
+            std::memcpy(work + 2 * i, &y, sizeof(y));
+        }
+
+        std::memcpy(state + b * 4, z, sizeof(z));
+    }
+
+    for (size_t i = 0; i < count * 2; i++)
+        frames[i] = static_cast<float>(work[i]);
+}
+
+void DspChain::Limit(float* frames, size_t count) {
+    const DspCoefficients& c = m_current;
+    for (size_t i = 0; i < count; i++) {
+        const float l = frames[2 * i];
+        const float r = frames[2 * i + 1];
+        const float peak = std::max(std::fabs(l), std::fabs(r));
+        const float target = c.limiter && peak > c.ceiling ? c.ceiling / peak : 1.0f;
+
+        if (target < m_gain) {
+            m_gain += (target - m_gain) * c.attack;
+            m_hold = LIMITER_LOOKAHEAD;
+        } else if (m_hold > 0) {
+            m_hold--;
+        } else {
+            m_gain += (target - m_gain) * c.release;
+        }
+
+        float outL = m_delay[2 * m_delayPos] * m_gain;
+        float outR = m_delay[2 * m_delayPos + 1] * m_gain;
+        m_delay[2 * m_delayPos] = l;
+        m_delay[2 * m_delayPos + 1] = r;
+        m_delayPos = (m_delayPos + 1) % LIMITER_LOOKAHEAD;
+
+        // whatever the envelope didn't quite catch
+        if (c.limiter) {
+            outL = std::clamp(outL, -c.ceiling, c.ceiling);
+            outR = std::clamp(outR, -c.ceiling, c.ceiling);
+        }
+        frames[2 * i] = outL;
+        frames[2 * i + 1] = outR;
+    }
+}
+
+void DspChain::Process(float* frames, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        const size_t n = std::min(count - done, DSP_BLOCK_FRAMES);
+        float* block = frames + done * 2;
+
+        if (m_fading) {
+            // the old coefficients get a copy of the state, the new ones carry on with it
+            std::array<double, EQ_BANDS * 4> oldState = m_state;
+            std::copy(block, block + n * 2, m_old.begin());
+            Filter(m_previous, oldState.data(), m_old.data(), n);
+            Filter(m_current, m_state.data(), block, n);
+
+            for (size_t i = 0; i < n; i++) {
+                const float t = (static_cast<float>(i) + 0.5f) / static_cast<float>(n);
+                block[2 * i] = m_old[2 * i] + (block[2 * i] - m_old[2 * i]) * t;
+                block[2 * i + 1] = m_old[2 * i + 1] + (block[2 * i + 1] - m_old[2 * i + 1]) * t;
+            }
+            m_fading = false;
+        } else {
+            Filter(m_current, m_state.data(), block, n);
+        }
+
+        Limit(block, n);
+        done += n;
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// The last stage before the device: preamp, a 10-band parametric EQ and a
+// peak limiter, on interleaved stereo.
+//
+// Settings are turned into coefficients wherever they're changed (the main
+// thread), so the audio thread only ever does arithmetic. Each band is a
+// biquad run on both channels at once, one f64x2 lane each, in transposed
+// direct form II like the K-weighting filters in Loudness.cpp. Bands left
+// at 0 dB are skipped.
+//
+// A change is crossfaded over one block: the block is run through the old
+// coefficients and the new ones, both starting from the same filter state,
+// and faded from one to the other. The state carries on with the new ones,
+// so nothing jumps.
+//
+// The limiter looks LIMITER_LOOKAHEAD frames ahead, so it always delays the
+// signal by that much (whether it's on or not, so turning it on or off
+// doesn't jump either).
+
+constexpr int EQ_BANDS = 10;
+constexpr size_t LIMITER_LOOKAHEAD = 48;  // 1 ms at 48k
+constexpr size_t DSP_BLOCK_FRAMES = 256;
+
+enum class EqBandType : uint8_t {
+    PEAK,
+    LOW_SHELF,
+    HIGH_SHELF
+};
+
+struct EqBand {
+    EqBandType type;
+    float freq;    // Hz
+    float gainDb;
+    float q;
+};
+
+struct DspSettings {
+    bool enabled;
+    float preampDb;
+    std::array<EqBand, EQ_BANDS> bands;
+    bool limiter;
+    float limiterCeilingDb;
+};
+
+// Flat, bands on the ISO octave centres from 31 Hz to 16 kHz
+DspSettings DefaultDspSettings();
+
+struct DspCoefficients {
+    struct Biquad {
+        double b0, b1, b2, a1, a2;
+    };
+
+    std::array<Biquad, EQ_BANDS> bands;
+    std::array<uint8_t, EQ_BANDS> active;  // which bands to run, in order
+    int activeCount;
+    float preamp;
+    bool limiter;
+    float ceiling;
+    float attack;   // per frame, towards a lower gain
+    float release;  // per frame, back up to 1
+};
+
+DspCoefficients MakeDspCoefficients(const DspSettings& settings, unsigned int sampleRate);
+
+class DspChain {
+ public:
+    DspChain();
+
+    // Takes effect at the next Process, faded in over its first block.
+    void Set(const DspCoefficients& coefficients);
+    // In place. No locks, no allocation, safe on the audio thread.
+    void Process(float* frames, size_t count);
+
+ private:
+    void Filter(const DspCoefficients& c, double* state, float* frames, size_t count);
+    void Limit(float* frames, size_t count);
+
+    DspCoefficients m_current;
+    DspCoefficients m_previous;
+    bool m_fading = false;
+
+    std::array<double, EQ_BANDS * 4> m_state{};  // TDF-II, 2 per band per channel
+    std::array<double, DSP_BLOCK_FRAMES * 2> m_work{};
+    std::array<float, DSP_BLOCK_FRAMES * 2> m_old{};
+
+    std::array<float, LIMITER_LOOKAHEAD * 2> m_delay{};
+    size_t m_delayPos = 0;
+    float m_gain = 1.0f;
+    size_t m_hold = 0;  // frames before the gain can come back up
+};
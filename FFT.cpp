@@ -0,0 +1,118 @@
+#include "FFT.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <numbers>
+#include <utility>
+
+#include "Simd.hpp"
+
+FFTPlan MakeFFTPlan(int size) {
+    assert(size >= 4 && (size & (size - 1)) == 0 && "FFT size must be a power of two.");
+
+    FFTPlan plan;
+    plan.size = size;
+
+    int bits = 0;
+    while ((1 << bits) < size)
+        bits++;
+
+    plan.bitReverse.resize(size);
+    for (int i = 0; i < size; i++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        plan.bitReverse[i] = r;
+    }
+
+    plan.twiddleRe.resize(size);
+    plan.twiddleIm.resize(size);
+    for (int h = 1; h < size; h *= 2) {
+        for (int j = 0; j < h; j++) {
+            const double angle = -std::numbers::pi * j / h;
+            plan.twiddleRe[h + j] = static_cast<float>(std::cos(angle));
+            plan.twiddleIm[h + j] = static_cast<float>(std::sin(angle));
+        }
+    }
+
+    return plan;
+}
+
+void FFT(const FFTPlan& plan, float* re, float* im) {
+    const int n = plan.size;
+
+    for (int i = 0; i < n; i++) {
+        const int r = plan.bitReverse[i];
+        if (r > i) {
+            std::swap(re[i], re[r]);
+            std::swap(im[i], im[r]);
+        }
+    }
+
+    // The first two stages have trivial twiddles (1 and -i) and are too
+    // narrow for four lanes, so they're done together as one radix-4 pass.
+    for (int s = 0; s < n; s += 4) {
+        const float ar = re[s + 0] + re[s + 1], ai = im[s + 0] + im[s + 1];
+        const float br = re[s + 0] - re[s + 1], bi = im[s + 0] - im[s + 1];
+        const float cr = re[s + 2] + re[s + 3], ci = im[s + 2] + im[s + 3];
+        const float dr = re[s + 2] - re[s + 3], di = im[s + 2] - im[s + 3];
+
+        re[s + 0] = ar + cr;  im[s + 0] = ai + ci;
+        re[s + 2] = ar - cr;  im[s + 2] = ai - ci;
+        // d * -i = (di, -dr)
+        re[s + 1] = br + di;  im[s + 1] = bi - dr;
+        re[s + 3] = br - di;  im[s + 3] = bi + dr;
+    }
+
+    for (int h = 4; h < n; h *= 2) {
+        const float* twRe = &plan.twiddleRe[h];
+        const float* twIm = &plan.twiddleIm[h];
+
+        for (int s = 0; s < n; s += 2 * h) {
+            float* aRe = re + s;
+            float* aIm = im + s;
+            float* bRe = re + s + h;
+            float* bIm = im + s + h;
+
+            for (int j = 0; j < h; j += 4) {
+                const f32x4 wr = Load4(twRe + j);
+                const f32x4 wi = Load4(twIm + j);
+                const f32x4 xr = Load4(bRe + j);
+                const f32x4 xi = Load4(bIm + j);
+                const f32x4 tr = xr * wr - xi * wi;
+                const f32x4 ti = xr * wi + xi * wr;
+
+                const f32x4 ar = Load4(aRe + j);
+                const f32x4 ai = Load4(aIm + j);
+                Store4(aRe + j, ar + tr);
+                Store4(aIm + j, ai + ti);
+                Store4(bRe + j, ar - tr);
+                Store4(bIm + j, ai - ti);
+            }
+        }
+    }
+}
+
+std::vector<float> MakeHannWindow(int size) {
+    std::vector<float> window(size);
+    for (int i = 0; i < size; i++)
+        window[i] = 0.5f - 0.5f * std::cos(2.0f * std::numbers::pi_v<float> * i / size);
+    return window;
+}
+
+void PowerSpectrum(const FFTPlan& plan, const float* in, const float* window,
+                   float* power, float* scratch) {
+    const int n = plan.size;
+    float* re = scratch;
+    float* im = scratch + n;
+
+    for (int i = 0; i < n; i += 4) {
+        Store4(re + i, Load4(in + i) * Load4(window + i));
+        Store4(im + i, Splat4(0.0f));
+    }
+
+    FFT(plan, re, im);
+
+    for (int k = 0; k <= n / 2; k++)
+        power[k] = re[k] * re[k] + im[k] * im[k];
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+// Radix-2 complex FFT on split real/imaginary arrays.
+// Split arrays let every butterfly stage past the first two run four
+// lanes at a time (see Simd.hpp).
+struct FFTPlan {
+    int size = 0;
+    std::vector<int> bitReverse;
+    // twiddles for the stage with half-size h live in [h, 2h)
+    std::vector<float> twiddleRe;
+    std::vector<float> twiddleIm;
+};
+
+// size must be a power of two, at least 4
+FFTPlan MakeFFTPlan(int size);
+
+// In place, unnormalized, forward transform.
+void FFT(const FFTPlan& plan, float* re, float* im);
+
+// Hann window of the given length, so callers don't each roll their own.
+std::vector<float> MakeHannWindow(int size);
+
+// |X[k]|^2 for k in [0, size/2] of a windowed real signal.
+// `scratch` must hold at least 2 * size floats.
+void PowerSpectrum(const FFTPlan& plan, const float* in, const float* window,
+                   float* power, float* scratch);
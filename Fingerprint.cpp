@@ -0,0 +1,454 @@
+#include "Fingerprint.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include <sqlite3.h>
+
+#include "Data.hpp"
+#include "Decoder.hpp"
+#include "FFT.hpp"
+#include "Library.hpp"
+#include "WorkerPool.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// Fingerprints
+////////////////////////////////////////////////////////////////////////////////
+
+constexpr float CHROMA_MIN_HZ = 55.0f;
+constexpr float CHROMA_MAX_HZ = 4000.0f;
+constexpr int MIN_FRAMES = 16;
+constexpr int SUMMARY_SEGMENTS = 8;
+
+// FFT plans and bin -> pitch class tables are per sample rate.
+// There are only ever a handful of rates, so each worker keeps its own.
+struct ChromaPlan {
+    FFTPlan fft;
+    std::vector<float> window;
+    std::vector<int8_t> pitchClass;  // -1 for bins outside the chroma range
+    int hop;
+};
+
+static const ChromaPlan& GetChromaPlan(unsigned int sampleRate) {
+    thread_local std::unordered_map<unsigned int, ChromaPlan> plans;
+
+    auto it = plans.find(sampleRate);
+    if (it != plans.end())
+        return it->second;
+
+    // ~170 ms windows, hopping every 125 ms regardless of sample rate,
+    // so a 44.1k and a 48k rip of the same song line up frame for frame
+    int size = 4;
+    while (size < static_cast<int>(sampleRate * 0.17f))
+        size *= 2;
+
+    ChromaPlan plan;
+    plan.fft = MakeFFTPlan(size);
+    plan.window = MakeHannWindow(size);
+    plan.hop = sampleRate / 8;
+    plan.pitchClass.resize(size / 2 + 1, -1);
+    for (int k = 1; k <= size / 2; k++) {
+        const float freq = static_cast<float>(k) * sampleRate / size;
+        if (freq < CHROMA_MIN_HZ || freq > CHROMA_MAX_HZ)
+            continue;
+        const int semitone = static_cast<int>(std::lround(12.0f * std::log2(freq / 440.0f)));
+        plan.pitchClass[k] = static_cast<int8_t>(((semitone % 12) + 12) % 12);
+    }
+
+    return plans.emplace(sampleRate, std::move(plan)).first->second;
+}
+
+bool ComputeFingerprint(const float* mono, size_t count, unsigned int sampleRate, Fingerprint& out) {
+    const ChromaPlan& plan = GetChromaPlan(sampleRate);
+    const size_t size = plan.fft.size;
+    if (count < size)
+        return false;
+
+    std::vector<float> power(size / 2 + 1);
+    std::vector<float> scratch(2 * size);
+
+    out.frames.clear();
+    for (size_t start = 0; start + size <= count; start += plan.hop) {
+        PowerSpectrum(plan.fft, mono + start, plan.window.data(), power.data(), scratch.data());
+
+        float chroma[12] = {};
+        float total = 1e-12f;
+        for (size_t k = 0; k < power.size(); k++) {
+            if (plan.pitchClass[k] < 0) continue;
+            chroma[plan.pitchClass[k]] += power[k];
+            total += power[k];
+        }
+        for (float& c : chroma)
+            c /= total;
+
+        // 12 bits: each pitch class vs. the next one up
+        // 12 bits: each pitch class vs. an even share of the energy
+        //  8 bits: pitch class vs. a minor third up
+        uint32_t bits = 0;
+        for (int i = 0; i < 12; i++) {
+            bits |= uint32_t(chroma[i] > chroma[(i + 1) % 12]) << i;
+            bits |= uint32_t(chroma[i] > 1.0f / 12.0f) << (12 + i);
+        }
+        for (int i = 0; i < 8; i++)
+            bits |= uint32_t(chroma[i] > chroma[(i + 3) % 12]) << (24 + i);
+
+        out.frames.push_back(bits);
+    }
+
+    if (out.frames.size() < MIN_FRAMES)
+        return false;
+
+    std::memset(out.summary, 0, sizeof(out.summary));
+    const size_t nFrames = out.frames.size();
+    for (int seg = 0; seg < SUMMARY_SEGMENTS; seg++) {
+        const size_t lo = seg * nFrames / SUMMARY_SEGMENTS;
+        const size_t hi = (seg + 1) * nFrames / SUMMARY_SEGMENTS;
+
+        for (int bit = 0; bit < 32; bit++) {
+            size_t ones = 0;
+            for (size_t f = lo; f < hi; f++)
+                ones += (out.frames[f] >> bit) & 1;
+
+            if (2 * ones > hi - lo) {
+                const int pos = seg * 32 + bit;
+                out.summary[pos / 64] |= uint64_t(1) << (pos % 64);
+            }
+        }
+    }
+
+    return true;
+}
+
+float CompareFingerprints(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+    // one rip may have a bit more lead-in silence than the other
+    constexpr int maxOffset = 16;
+
+    float best = 0.0f;
+    for (int offset = -maxOffset; offset <= maxOffset; offset++) {
+        const size_t aStart = offset > 0 ? offset : 0;
+        const size_t bStart = offset < 0 ? -offset : 0;
+        if (aStart >= a.size() || bStart >= b.size())
+            continue;
+
+        const size_t overlap = std::min(a.size() - aStart, b.size() - bStart);
+        if (overlap < MIN_FRAMES)
+            continue;
+
+        size_t differing = 0;
+        for (size_t i = 0; i < overlap; i++)
+            differing += std::popcount(a[aStart + i] ^ b[bStart + i]);
+
+        best = std::max(best, 1.0f - static_cast<float>(differing) / (32.0f * overlap));
+    }
+    return best;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Duplicate search
+////////////////////////////////////////////////////////////////////////////////
+
+// Bit-sampling LSH: each table hashes SAMPLED_BITS random positions of the
+// summary. Two rips whose summaries differ in ~15% of bits share a bucket in
+// at least one table ~85% of the time, unrelated songs (~50% apart) in about
+// 1 of 2000 pairs.
+constexpr int LSH_TABLES = 32;
+constexpr int SAMPLED_BITS = 16;
+constexpr float DUPLICATE_SIMILARITY = 0.85f;
+
+struct SummaryEntry {
+    EntityId song;
+    uint64_t summary[4];
+};
+
+static bool SummaryBit(const uint64_t* summary, int pos) {
+    return (summary[pos / 64] >> (pos % 64)) & 1;
+}
+
+static int LoadFrames(sqlite3_stmt* stmt, EntityId song, std::vector<uint32_t>& out) {
+    sqlite3_bind_int64(stmt, 1, song);
+    int err = sqlite3_step(stmt);
+    if (err == SQLITE_ROW) {
+        const auto* blob = static_cast<const uint32_t*>(sqlite3_column_blob(stmt, 0));
+        const int bytes = sqlite3_column_bytes(stmt, 0);
+        out.assign(blob, blob + bytes / sizeof(uint32_t));
+        err = SQLITE_OK;
+    }
+    sqlite3_reset(stmt);
+    return err;
+}
+
+// The duplicates table records which fingerprints it was built from, so a
+// job that was stopped before or during the search picks it up next launch.
+// Fingerprints are only ever added, so the count and the newest song are
+// enough to tell.
+struct DuplicatesStamp {
+    int64_t fingerprints = 0;
+    int64_t lastSong = 0;
+
+    bool operator==(const DuplicatesStamp&) const = default;
+};
+
+static int QueryStamp(sqlite3* db, const char* query, DuplicatesStamp& out) {
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt, query);
+    if (err != SQLITE_OK) return err;
+
+    err = sqlite3_step(stmt);
+    if (err == SQLITE_ROW) {
+        out = { sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1) };
+        err = SQLITE_OK;
+    } else if (err == SQLITE_DONE) {
+        err = SQLITE_NOTFOUND;
+    }
+    sqlite3_finalize(stmt);
+    return err;
+}
+
+static int FindDuplicates(sqlite3* db, const DuplicatesStamp& stamp, const std::atomic<bool>& stop) {
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<SummaryEntry> entries;
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt, "SELECT songId, summary FROM fingerprints WHERE frames IS NOT NULL;");
+    if (err != SQLITE_OK) return err;
+
+    while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (sqlite3_column_bytes(stmt, 1) != sizeof(SummaryEntry::summary))
+            continue;
+        SummaryEntry& entry = entries.emplace_back();
+        entry.song = sqlite3_column_int64(stmt, 0);
+        std::memcpy(entry.summary, sqlite3_column_blob(stmt, 1), sizeof(entry.summary));
+    }
+    sqlite3_finalize(stmt);
+    if (err != SQLITE_DONE) return err;
+
+    // fixed seed, so the same library always produces the same candidates
+    std::mt19937 rng(0x5EED);
+    std::uniform_int_distribution<int> pickBit(0, 255);
+
+    std::unordered_set<uint64_t> candidates;
+    for (int table = 0; table < LSH_TABLES && !stop; table++) {
+        int positions[SAMPLED_BITS];
+        for (int& pos : positions)
+            pos = pickBit(rng);
+
+        std::unordered_map<uint32_t, std::vector<uint32_t>> buckets;
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            uint32_t key = 0;
+            for (int b = 0; b < SAMPLED_BITS; b++)
+                key |= uint32_t(SummaryBit(entries[i].summary, positions[b])) << b;
+            buckets[key].push_back(i);
+        }
+
+        for (const auto& [key, members] : buckets) {
+            for (size_t x = 0; x < members.size(); x++)
+                for (size_t y = x + 1; y < members.size(); y++)
+                    candidates.insert((uint64_t(members[x]) << 32) | members[y]);
+        }
+    }
+
+    if (stop)
+        return SQLITE_INTERRUPT;
+
+    err = PrepareQuery(db, &stmt, "SELECT frames FROM fingerprints WHERE songId = ?;");
+    if (err != SQLITE_OK) return err;
+
+    std::vector<std::tuple<EntityId, EntityId, float>> duplicates;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> frameCache;
+    const auto Frames = [&](uint32_t index) -> const std::vector<uint32_t>& {
+        auto it = frameCache.find(index);
+        if (it == frameCache.end()) {
+            it = frameCache.emplace(index, std::vector<uint32_t>()).first;
+            LoadFrames(stmt, entries[index].song, it->second);
+        }
+        return it->second;
+    };
+
+    for (uint64_t pair : candidates) {
+        if (stop)
+            break;
+        const uint32_t a = pair >> 32;
+        const uint32_t b = pair & 0xFFFFFFFF;
+        const float similarity = CompareFingerprints(Frames(a), Frames(b));
+        if (similarity >= DUPLICATE_SIMILARITY)
+            duplicates.emplace_back(entries[a].song, entries[b].song, similarity);
+    }
+    sqlite3_finalize(stmt);
+
+    if (stop)
+        return SQLITE_INTERRUPT;
+
+    const auto Fail = [db](int code) {
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return code;
+    };
+
+    err = sqlite3_exec(db, "BEGIN; DELETE FROM duplicates;", nullptr, nullptr, nullptr);
+    if (err != SQLITE_OK) return Fail(err);
+
+    err = PrepareQuery(db, &stmt, "INSERT INTO duplicates(songA, songB, similarity) VALUES (?, ?, ?);");
+    if (err != SQLITE_OK) return Fail(err);
+
+    for (const auto& [a, b, similarity] : duplicates) {
+        sqlite3_bind_int64(stmt, 1, std::min(a, b));
+        sqlite3_bind_int64(stmt, 2, std::max(a, b));
+        sqlite3_bind_double(stmt, 3, similarity);
+        err = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (err != SQLITE_DONE) {
+            sqlite3_finalize(stmt);
+            return Fail(err);
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    // same transaction, so the stamp only moves if the table really got rebuilt
+    err = PrepareQuery(db, &stmt, "UPDATE duplicates_state SET fingerprints = ?, lastSong = ?;");
+    if (err != SQLITE_OK) return Fail(err);
+    sqlite3_bind_int64(stmt, 1, stamp.fingerprints);
+    sqlite3_bind_int64(stmt, 2, stamp.lastSong);
+    err = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (err != SQLITE_DONE) return Fail(err);
+
+    err = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    if (err != SQLITE_OK) return Fail(err);
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("[FINGERPRINT] %zu songs, %zu candidate pairs, %zu duplicates in %.2f s\n",
+                entries.size(), candidates.size(), duplicates.size(), elapsed.count());
+    return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Job
+////////////////////////////////////////////////////////////////////////////////
+
+constexpr size_t JOB_BATCH = 64;
+
+struct FingerprintJob {
+    std::thread thread;
+    std::atomic<bool> stop{false};
+};
+
+FingerprintJob g_fingerprintJob;
+
+struct PendingSong {
+    EntityId id;
+    std::string filename;
+};
+
+static void FingerprintMain(std::string dbPath) {
+    const std::atomic<bool>& stop = g_fingerprintJob.stop;
+
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(dbPath.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return;
+    }
+    sqlite3_busy_timeout(db, 1000);
+
+    std::vector<PendingSong> pending;
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt,
+        "SELECT rowid, filename FROM songs WHERE rowid NOT IN (SELECT songId FROM fingerprints);");
+    if (err == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+            pending.push_back({ sqlite3_column_int64(stmt, 0), ColumnString(stmt, 1) });
+        sqlite3_finalize(stmt);
+    }
+
+    err = PrepareQuery(db, &stmt, "INSERT INTO fingerprints(songId, frames, summary) VALUES (?, ?, ?);");
+    if (err != SQLITE_OK) {
+        sqlite3_close(db);
+        return;
+    }
+
+    WorkerPool& workers = SharedWorkers();
+    const auto start = std::chrono::steady_clock::now();
+    size_t done = 0;
+
+    for (size_t first = 0; first < pending.size() && !stop; first += JOB_BATCH) {
+        const size_t n = std::min(JOB_BATCH, pending.size() - first);
+        std::vector<Fingerprint> results(n);
+        std::vector<char> ok(n, 0);
+
+        workers.ParallelFor(n, [&](size_t i) {
+            std::vector<float> mono;
+            unsigned int sampleRate;
+            if (DecodeMono(pending[first + i].filename.c_str(), FINGERPRINT_SECONDS, mono, sampleRate))
+                ok[i] = ComputeFingerprint(mono.data(), mono.size(), sampleRate, results[i]);
+        });
+
+        // Songs that fail still get a row (with NULL frames),
+        // otherwise we'd try to decode them again on every launch.
+        // A batch that doesn't make it in just gets redone next launch.
+        err = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+        for (size_t i = 0; err == SQLITE_OK && i < n; i++) {
+            sqlite3_bind_int64(stmt, 1, pending[first + i].id);
+            if (ok[i]) {
+                const auto& frames = results[i].frames;
+                sqlite3_bind_blob(stmt, 2, frames.data(), frames.size() * sizeof(uint32_t), SQLITE_STATIC);
+                sqlite3_bind_blob(stmt, 3, results[i].summary, sizeof(results[i].summary), SQLITE_STATIC);
+            } else {
+                sqlite3_bind_null(stmt, 2);
+                sqlite3_bind_null(stmt, 3);
+            }
+            err = sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+            err = err == SQLITE_DONE ? SQLITE_OK : err;
+        }
+        if (err == SQLITE_OK)
+            err = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+        if (err != SQLITE_OK) {
+            sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+            std::printf("[FINGERPRINT] Could not save a batch of %zu: %s\n", n, sqlite3_errstr(err));
+            continue;
+        }
+        done += n;
+    }
+    sqlite3_finalize(stmt);
+
+    if (done > 0) {
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::printf("[FINGERPRINT] %zu files in %.2f s (%.1f files/s on %u workers)\n",
+                    done, elapsed.count(), done / elapsed.count(), workers.Size());
+    }
+
+    // Rebuilt whenever there are fingerprints it hasn't seen, not just when
+    // this launch made some. The last launch may have been stopped between
+    // its last batch and the search, or in the middle of the search.
+    DuplicatesStamp current, built;
+    err = QueryStamp(db, "SELECT COUNT(*), IFNULL(MAX(songId), 0) FROM fingerprints;", current);
+    if (err == SQLITE_OK)
+        err = QueryStamp(db, "SELECT fingerprints, lastSong FROM duplicates_state;", built);
+    if (err == SQLITE_OK && !stop && current != built)
+        err = FindDuplicates(db, current, stop);
+    if (err != SQLITE_OK && err != SQLITE_INTERRUPT)
+        std::printf("[FINGERPRINT] Duplicate search failed: %s\n", sqlite3_errstr(err));
+
+    sqlite3_close(db);
+}
+
+void StartFingerprintJob(const char* dbPath) {
+    g_fingerprintJob.stop = false;
+    g_fingerprintJob.thread = std::thread(FingerprintMain, std::string(dbPath));
+}
+
+void StopFingerprintJob() {
+    g_fingerprintJob.stop = true;
+    if (g_fingerprintJob.thread.joinable())
+        g_fingerprintJob.thread.join();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Acoustic fingerprints for finding the same recording ripped more than once.
+//
+// The first FINGERPRINT_SECONDS of a track are cut into overlapping frames,
+// each frame is folded into a 12-bin chroma vector (energy per pitch class),
+// and the relations between the bins become one 32-bit
+// sub-fingerprint per frame. Chroma doesn't care about bitrate, codec or
+// sample rate, which is exactly what differs between two rips.
+//
+// Comparing every pair of songs would be quadratic, so each fingerprint also
+// gets a 256-bit summary (majority vote of each bit over 8 time segments).
+// Summaries go through bit-sampling LSH, and only songs that share a bucket
+// get the full comparison.
+
+constexpr float FINGERPRINT_SECONDS = 30.0f;
+
+struct Fingerprint {
+    std::vector<uint32_t> frames;
+    uint64_t summary[4];
+};
+
+bool ComputeFingerprint(const float* mono, size_t count, unsigned int sampleRate, Fingerprint& out);
+
+// Fraction of matching bits at the best alignment. ~0.5 for unrelated songs.
+float CompareFingerprints(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+
+// Fingerprints every song that doesn't have one yet on the shared worker pool,
+// then rebuilds the `duplicates` table if it's behind the fingerprints.
+// Runs on its own thread with its own database connection. Stopping it at
+// any point loses at most the batch in flight.
+void StartFingerprintJob(const char* dbPath);
+void StopFingerprintJob();
@@ -0,0 +1,259 @@
+#include "HeadCache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Defer.hpp"
+#include "MappedFile.hpp"
+
+constexpr char HEAD_MAGIC[4] = { 'R', 'M', 'H', 'D' };
+constexpr uint32_t HEAD_VERSION = 1;
+
+struct HeadHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t sampleRate;
+    uint32_t frames;
+    uint64_t totalFrames;
+    // the song's file, when this was stored
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+};
+
+struct HeadEntry {
+    uint64_t bytes = 0;
+    uint64_t lastUse = 0;
+};
+
+struct HeadCacheState {
+    std::mutex mutex;  // guards everything below, but not the files
+    std::string dir;   // empty while closed
+    uint64_t maxBytes = 0;
+    uint64_t totalBytes = 0;
+    uint64_t clock = 0;  // bumped on every use, orders lastUse
+    std::unordered_map<EntityId, HeadEntry> entries;
+};
+
+HeadCacheState g_heads;
+
+static std::string HeadPath(const std::string& dir, EntityId song) {
+    return dir + "/" + std::to_string(song) + ".head";
+}
+
+// Needs the lock. Never evicts `keep`, one head over the limit beats none.
+static void Evict(EntityId keep) {
+    HeadCacheState& h = g_heads;
+    while (h.totalBytes > h.maxBytes && h.entries.size() > 1) {
+        auto oldest = h.entries.end();
+        for (auto it = h.entries.begin(); it != h.entries.end(); ++it) {
+            if (it->first != keep && (oldest == h.entries.end() || it->second.lastUse < oldest->second.lastUse))
+                oldest = it;
+        }
+        if (oldest == h.entries.end())
+            break;
+
+        unlink(HeadPath(h.dir, oldest->first).c_str());
+        h.totalBytes -= oldest->second.bytes;
+        h.entries.erase(oldest);
+    }
+}
+
+bool OpenHeadCache(const char* dir, uint64_t maxBytes) {
+    HeadCacheState& h = g_heads;
+    std::lock_guard lock(h.mutex);
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+        return false;
+    DIR* listing = opendir(dir);
+    if (!listing)
+        return false;
+    const auto listingReleaser = Defer([listing](){ closedir(listing); });
+
+    h.dir = dir;
+    h.maxBytes = maxBytes;
+    h.totalBytes = 0;
+    h.entries.clear();
+
+    // Files get their mtime bumped whenever they're used,
+    // so that's the LRU order from the last run.
+    struct Found {
+        EntityId song;
+        uint64_t bytes;
+        int64_t mtimeNs;
+    };
+    std::vector<Found> found;
+    while (const dirent* entry = readdir(listing)) {
+        const std::string path = h.dir + "/" + entry->d_name;
+        const size_t length = std::strlen(entry->d_name);
+        if (length > 4 && std::strcmp(entry->d_name + length - 4, ".tmp") == 0) {
+            unlink(path.c_str());  // a store that didn't finish
+            continue;
+        }
+
+        char* end = nullptr;
+        const EntityId song = std::strtol(entry->d_name, &end, 10);
+        struct stat st;
+        if (end == entry->d_name || std::strcmp(end, ".head") != 0 || stat(path.c_str(), &st) != 0)
+            continue;
+        found.push_back({ song, static_cast<uint64_t>(st.st_size),
+                          static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec });
+    }
+
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.mtimeNs < b.mtimeNs; });
+    for (const Found& f : found) {
+        h.entries[f.song] = { f.bytes, ++h.clock };
+        h.totalBytes += f.bytes;
+    }
+    Evict(NO_ENTITY);
+
+    std::printf("[HEAD CACHE] %zu heads, %.1f of %.1f MiB\n", h.entries.size(),
+                h.totalBytes / (1024.0 * 1024.0), h.maxBytes / (1024.0 * 1024.0));
+    return true;
+}
+
+void CloseHeadCache() {
+    HeadCacheState& h = g_heads;
+    std::lock_guard lock(h.mutex);
+    h.dir.clear();
+    h.entries.clear();
+    h.totalBytes = 0;
+}
+
+// Forgets a head that turned out to be stale or broken.
+static void Drop(EntityId song) {
+    HeadCacheState& h = g_heads;
+    std::lock_guard lock(h.mutex);
+    auto it = h.entries.find(song);
+    if (it == h.entries.end())
+        return;
+
+    unlink(HeadPath(h.dir, song).c_str());
+    h.totalBytes -= it->second.bytes;
+    h.entries.erase(it);
+}
+
+bool HasHead(const SongEntry& song) {
+    HeadCacheState& h = g_heads;
+    std::lock_guard lock(h.mutex);
+    return h.entries.contains(song.id);
+}
+
+bool LoadHead(const SongEntry& song, unsigned int sampleRate, float gain, CachedHead& out) {
+    HeadCacheState& h = g_heads;
+    std::string path;
+    {
+        std::lock_guard lock(h.mutex);
+        auto it = h.entries.find(song.id);
+        if (h.dir.empty() || it == h.entries.end())
+            return false;
+        it->second.lastUse = ++h.clock;
+        path = HeadPath(h.dir, song.id);
+    }
+
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        Drop(song.id);
+        return false;
+    }
+    const auto fdReleaser = Defer([fd](){ close(fd); });
+
+    uint64_t sourceSize = 0;
+    int64_t sourceMtimeNs = 0;
+    HeadHeader header;
+    struct stat st;
+    const bool valid =
+        StatFile(song.filename.c_str(), sourceSize, sourceMtimeNs) &&
+        fstat(fd, &st) == 0 &&
+        pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        std::memcmp(header.magic, HEAD_MAGIC, sizeof(HEAD_MAGIC)) == 0 &&
+        header.version == HEAD_VERSION &&
+        header.sampleRate == sampleRate &&
+        header.sourceSize == sourceSize &&
+        header.sourceMtimeNs == sourceMtimeNs &&
+        static_cast<uint64_t>(st.st_size) == sizeof(header) + header.frames * 2 * sizeof(int16_t);
+    if (!valid) {
+        Drop(song.id);
+        return false;
+    }
+
+    std::vector<int16_t> samples(header.frames * 2);
+    const ssize_t bytes = samples.size() * sizeof(int16_t);
+    if (pread(fd, samples.data(), bytes, sizeof(header)) != bytes) {
+        Drop(song.id);
+        return false;
+    }
+
+    const float scale = gain / 32767.0f;
+    out.totalFrames = header.totalFrames;
+    out.pcm.resize(samples.size());
+    for (size_t i = 0; i < samples.size(); i++)
+        out.pcm[i] = samples[i] * scale;
+
+    // keeps the LRU order for next time
+    futimens(fd, nullptr);
+    return true;
+}
+
+void StoreHead(const SongEntry& song, unsigned int sampleRate, uint64_t totalFrames,
+               const float* pcm, size_t frames) {
+    HeadCacheState& h = g_heads;
+    std::string path;
+    {
+        std::lock_guard lock(h.mutex);
+        if (h.dir.empty())
+            return;
+        path = HeadPath(h.dir, song.id);
+    }
+
+    HeadHeader header{
+        .magic = { HEAD_MAGIC[0], HEAD_MAGIC[1], HEAD_MAGIC[2], HEAD_MAGIC[3] },
+        .version = HEAD_VERSION,
+        .sampleRate = sampleRate,
+        .frames = static_cast<uint32_t>(frames),
+        .totalFrames = totalFrames,
+        .sourceSize = 0,
+        .sourceMtimeNs = 0
+    };
+    if (!StatFile(song.filename.c_str(), header.sourceSize, header.sourceMtimeNs))
+        return;
+
+    std::vector<int16_t> samples(frames * 2);
+    for (size_t i = 0; i < samples.size(); i++)
+        samples[i] = static_cast<int16_t>(std::lround(std::clamp(pcm[i], -1.0f, 1.0f) * 32767.0f));
+
+    const std::string tmpPath = path + ".tmp";
+    std::FILE* file = std::fopen(tmpPath.c_str(), "wb");
+    if (!file)
+        return;
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && std::fwrite(samples.data(), sizeof(int16_t), samples.size(), file) == samples.size();
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        std::printf("[HEAD CACHE] Failed to write %s\n", path.c_str());
+        return;
+    }
+
+    std::lock_guard lock(h.mutex);
+    if (h.dir.empty())
+        return;
+    HeadEntry& entry = h.entries[song.id];
+    h.totalBytes -= entry.bytes;
+    entry.bytes = sizeof(header) + samples.size() * sizeof(int16_t);
+    entry.lastUse = ++h.clock;
+    h.totalBytes += entry.bytes;
+    Evict(song.id);
+}
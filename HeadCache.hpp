@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Data.hpp"
+
+// Decoded heads of recently played and queued songs, so a click can start
+// playing before the song's file has even been opened.
+//
+// A head is the first couple of seconds the player predecodes anyway,
+// stereo at the player's rate and before loudness gain, kept as 16-bit
+// samples (~375 KiB per song at 2 s). Each one is its own file in the cache
+// directory. Once they add up to more than the limit given to
+// OpenHeadCache, the least recently used ones get deleted. A head is only
+// used while the song's file has the size and mtime it had when the head
+// was stored, so a retagged or replaced file just misses.
+
+struct CachedHead {
+    uint64_t totalFrames = 0;  // of the whole song, at the rate it was stored at
+    std::vector<float> pcm;    // interleaved stereo, with `gain` applied
+};
+
+bool OpenHeadCache(const char* dir, uint64_t maxBytes);
+void CloseHeadCache();
+
+// All safe to call from any thread. HasHead doesn't check it's still
+// current, LoadHead does (and forgets it if it isn't).
+bool HasHead(const SongEntry& song);
+bool LoadHead(const SongEntry& song, unsigned int sampleRate, float gain, CachedHead& out);
+void StoreHead(const SongEntry& song, unsigned int sampleRate, uint64_t totalFrames,
+               const float* pcm, size_t frames);
@@ -0,0 +1,109 @@
+#include "Latency.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+
+#include <raylib.h>
+
+constexpr int STAGE_COUNT = static_cast<int>(LatencyStage::COUNT);
+constexpr int OVERLAY_FONT_SIZE = 10;
+constexpr int OVERLAY_LINE = 12;
+constexpr int OVERLAY_NAME_WIDTH = 100;
+constexpr int OVERLAY_COLUMN_WIDTH = 44;
+
+struct LatencyWindow {
+    std::array<float, LATENCY_WINDOW> samples{};
+    size_t count = 0;  // total ever recorded, the ring wraps
+};
+
+std::array<LatencyWindow, STAGE_COUNT> g_latency;
+
+void RecordLatency(LatencyStage stage, float ms) {
+    LatencyWindow& window = g_latency[static_cast<int>(stage)];
+    window.samples[window.count % LATENCY_WINDOW] = ms;
+    window.count++;
+}
+
+// Nearest rank, `sorted` has to be non-empty
+static float Percentile(const std::array<float, LATENCY_WINDOW>& sorted, size_t count, float p) {
+    const size_t rank = static_cast<size_t>(std::ceil(p * count));
+    return sorted[std::clamp<size_t>(rank, 1, count) - 1];
+}
+
+LatencyStats GetLatencyStats(LatencyStage stage) {
+    const LatencyWindow& window = g_latency[static_cast<int>(stage)];
+    const size_t count = std::min(window.count, LATENCY_WINDOW);
+    if (count == 0)
+        return { 0, 0.0f, 0.0f, 0.0f, 0.0f };
+
+    std::array<float, LATENCY_WINDOW> sorted = window.samples;
+    std::sort(sorted.begin(), sorted.begin() + count);
+    return {
+        .samples = count,
+        .p50 = Percentile(sorted, count, 0.50f),
+        .p95 = Percentile(sorted, count, 0.95f),
+        .p99 = Percentile(sorted, count, 0.99f),
+        .max = sorted[count - 1]
+    };
+}
+
+const char* LatencyStageName(LatencyStage stage) {
+    switch (stage) {
+    case LatencyStage::UPDATE:          return "update";
+    case LatencyStage::LAYOUT:          return "layout";
+    case LatencyStage::SUBMIT:          return "submit";
+    case LatencyStage::SWAP:            return "swap";
+    case LatencyStage::CLICK_TO_PHOTON: return "click_to_photon";
+    case LatencyStage::CLICK_TO_AUDIO:  return "click_to_audio";
+    case LatencyStage::COUNT:           break;
+    }
+    return "?";
+}
+
+bool DumpLatency(const char* path) {
+    std::FILE* file = std::fopen(path, "w");
+    if (!file)
+        return false;
+
+    std::fprintf(file, "{\n");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const LatencyStage stage = static_cast<LatencyStage>(i);
+        const LatencyStats stats = GetLatencyStats(stage);
+        std::fprintf(file, "  \"%s\": {\"samples\": %zu, \"p50_ms\": %.3f, \"p95_ms\": %.3f, "
+                           "\"p99_ms\": %.3f, \"max_ms\": %.3f}%s\n",
+                     LatencyStageName(stage), stats.samples, stats.p50, stats.p95, stats.p99, stats.max,
+                     i + 1 < STAGE_COUNT ? "," : "");
+    }
+    std::fprintf(file, "}\n");
+    return std::fclose(file) == 0;
+}
+
+// raylib's default font isn't monospaced, so every column gets its own x
+void DrawLatencyOverlay(int x, int y) {
+    constexpr const char* headers[] = { "p50", "p95", "p99", "max" };
+    const int width = OVERLAY_NAME_WIDTH + OVERLAY_COLUMN_WIDTH * 4 + 8;
+    const int height = OVERLAY_LINE * (STAGE_COUNT + 1) + 8;
+    DrawRectangle(x, y, width, height, Color{ 0, 0, 0, 200 });
+
+    DrawText("ms since input", x + 4, y + 4, OVERLAY_FONT_SIZE, LIGHTGRAY);
+    for (int c = 0; c < 4; c++)
+        DrawText(headers[c], x + 4 + OVERLAY_NAME_WIDTH + OVERLAY_COLUMN_WIDTH * c, y + 4, OVERLAY_FONT_SIZE, LIGHTGRAY);
+
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const LatencyStage stage = static_cast<LatencyStage>(i);
+        const LatencyStats stats = GetLatencyStats(stage);
+        const int lineY = y + 4 + OVERLAY_LINE * (i + 1);
+        DrawText(LatencyStageName(stage), x + 4, lineY, OVERLAY_FONT_SIZE, WHITE);
+        if (stats.samples == 0)
+            continue;
+
+        const float values[] = { stats.p50, stats.p95, stats.p99, stats.max };
+        for (int c = 0; c < 4; c++) {
+            char text[16];
+            std::snprintf(text, sizeof(text), "%.1f", values[c]);
+            DrawText(text, x + 4 + OVERLAY_NAME_WIDTH + OVERLAY_COLUMN_WIDTH * c, lineY, OVERLAY_FONT_SIZE, WHITE);
+        }
+    }
+}
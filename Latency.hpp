@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+
+// How long input takes to show up, on screen and in the speakers.
+//
+// Every frame is timed from when its input was sampled (raylib polls at the
+// end of EndDrawing) through the state update, layout, draw submission and
+// buffer swap. Since layout is a frame ahead of rendering (see Layout.hpp),
+// SUBMIT and SWAP land in the frame after. Frames that had a click in them
+// also go into CLICK_TO_PHOTON, and anything that started a song gets timed
+// until its first sample comes out of the audio callback.
+//
+// Each stage keeps its last LATENCY_WINDOW samples for rolling percentiles.
+// Main thread only.
+
+constexpr size_t LATENCY_WINDOW = 512;
+
+enum class LatencyStage {
+    UPDATE,           // input -> state updated
+    LAYOUT,           // input -> layout done
+    SUBMIT,           // input -> draw calls submitted
+    SWAP,             // input -> buffers swapped
+    CLICK_TO_PHOTON,  // SWAP, for frames with a click
+    CLICK_TO_AUDIO,   // input -> the song it started is audible
+    COUNT
+};
+
+struct LatencyStats {
+    size_t samples;
+    float p50;  // all in ms
+    float p95;
+    float p99;
+    float max;
+};
+
+void RecordLatency(LatencyStage stage, float ms);
+LatencyStats GetLatencyStats(LatencyStage stage);
+const char* LatencyStageName(LatencyStage stage);
+
+// One JSON object, stage names to their stats
+bool DumpLatency(const char* path);
+// A small table of the stats with its top-left corner at (x, y), raylib's font
+void DrawLatencyOverlay(int x, int y);
@@ -1,14 +1,20 @@
 #include "Layout.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <format>
+#include <mutex>
 #include <ranges>
+#include <thread>
 #include <unordered_map>
 
 #include "Allocators.hpp"
 #include "Casts.hpp"
 #include "LayoutElements.hpp"
 #include "TextUtils.hpp"
+#include "Trace.hpp"
 
 // This works a lot differently than my other allocators
 // I'm making a lot of strong assumptions in the other
@@ -121,7 +127,9 @@ constexpr Clay_ElementDeclaration progressBar{
 };
 
 
-void MakeProgressBar(float currTime, float duration) {
+// Returns if the bar is hovered or not. It's ProgressBar either way,
+// so MakeLayout can find out where it ended up.
+bool MakeProgressBar(float currTime, float duration, std::span<const WaveformBucket> waveform) {
     constexpr Clay_Sizing fullBar{
         .width = CLAY_SIZING_PERCENT(0.95f),
         .height = CLAY_SIZING_FIXED(25)
@@ -129,16 +137,60 @@ void MakeProgressBar(float currTime, float duration) {
 
     currTime = currTime > duration ? duration : currTime;
     const float progress = duration > 0.0f ? currTime / duration : 0.0f;
+
+    bool hovered = false;
+
+    // the renderer draws the whole thing, played part included
+    if (!waveform.empty()) {
+        int i = g_customArena.Allocate();
+        CustomElement& element = g_customArena.arr[i];
+        element.type = CustomElement::Type::WAVEFORM;
+        element.waveform = {
+            .buckets = waveform.data(),
+            .count = static_cast<int>(waveform.size()),
+            .progress = progress
+        };
+
+        CLAY({
+            .id = CLAY_ID("ProgressBar"),
+            .layout = { .sizing = { .width = CLAY_SIZING_PERCENT(0.95f), .height = CLAY_SIZING_FIXED(48) } },
+            .backgroundColor = colors::black,
+            .custom = { .customData = &element }
+        }) {
+            hovered = Clay_Hovered();
+        }
+        return hovered;
+    }
+
     const Clay_Sizing partialBar{
         .width = CLAY_SIZING_PERCENT(progress),
         .height = CLAY_SIZING_GROW()
     };
 
-    CLAY({ .layout = { .sizing = fullBar }, .backgroundColor = colors::black }) {
+    CLAY({ .id = CLAY_ID("ProgressBar"), .layout = { .sizing = fullBar }, .backgroundColor = colors::black }) {
         CLAY({ .layout = { .sizing = partialBar }, .backgroundColor = colors::white }) {}
+        hovered = Clay_Hovered();
     }
+    return hovered;
 };
 
+// Bars only, the renderer does the rest
+void MakeSpectrum(std::span<const float> bars) {
+    int i = g_customArena.Allocate();
+    CustomElement& element = g_customArena.arr[i];
+    element.type = CustomElement::Type::SPECTRUM;
+    element.spectrum = {
+        .bars = bars.data(),
+        .count = static_cast<int>(bars.size())
+    };
+
+    CLAY({
+        .layout = { .sizing = { .width = CLAY_SIZING_FIXED(192), .height = CLAY_SIZING_GROW() } },
+        .backgroundColor = colors::black,
+        .custom = { .customData = &element }
+    }) {}
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wnarrowing"
 Clay_ElementDeclaration MakeImageConfig(const Texture& tex) {
@@ -208,22 +260,24 @@ Clay_ElementDeclaration AppendUTF8Scissor(const Clay_ElementDeclaration& decl) {
     return ret;
 }
 
-LayoutResult MakeLayout(const PlaybackState& state,
-                        std::span<const SongEntry> songs,
-                        std::span<const CollectionEntry> collections) {
+LayoutResult MakeLayout(const LayoutRequest& request) {
+    TRACE_ZONE("MakeLayout");
+    const PlaybackState& state = request.state;
     g_stringArena.Reset();
     g_customArena.Reset();
 
     LayoutResult ret;
     ret.input.songIndex = -1;
     ret.input.collectionIndex = -1;
+    ret.input.seekFraction = -1.0f;
+    bool barHovered = false;
 
     Clay_BeginLayout();
 
     CLAY(root) {
         CLAY(navigation) {
             CLAY(AppendUTF8Scissor(collectionView)) {
-                for (const auto& [i, coll] : std::views::enumerate(collections)) {
+                for (const auto& [i, coll] : std::views::enumerate(request.collections)) {
                     CLAY({}) {
                         bool hovered = MakeButton(coll.name);
                         if (hovered)
@@ -232,7 +286,7 @@ LayoutResult MakeLayout(const PlaybackState& state,
                 }
             }
             CLAY(AppendUTF8Scissor(songView)) {
-                for (const auto& [i, song] : std::views::enumerate(songs)) {
+                for (const auto& [i, song] : std::views::enumerate(request.songs)) {
                     CLAY({}) {
                         bool hovered = MakeButton(song.name);
                         if (hovered)
@@ -253,15 +307,161 @@ LayoutResult MakeLayout(const PlaybackState& state,
                 CLAY_TEXT(MakeTimeString(state.currTime), CLAY_TEXT_CONFIG({}));
             }
             CLAY(progressBar) {
-                MakeProgressBar(state.currTime, state.duration);
+                barHovered = MakeProgressBar(state.currTime, state.duration, request.waveform);
             }
             CLAY(timeContainer) {
                 CLAY_TEXT(MakeTimeString(state.duration), CLAY_TEXT_CONFIG({}));
             }
+            if (!request.spectrum.empty())
+                MakeSpectrum(request.spectrum);
         }
     }
 
     ret.renderCommands = Clay_EndLayout();
+
+    if (barHovered) {
+        const Clay_ElementData bar = Clay_GetElementData(CLAY_ID("ProgressBar"));
+        if (bar.found && bar.boundingBox.width > 0.0f) {
+            const float x = request.pointer.x - bar.boundingBox.x;
+            ret.input.seekFraction = std::clamp(x / bar.boundingBox.width, 0.0f, 1.0f);
+        }
+    }
     return ret;
 }
 
+
+////////////////////////////////////////////////////////////////////////////////
+// Layout thread
+////////////////////////////////////////////////////////////////////////////////
+
+Clay_RenderCommandArray LayoutFrame::RenderCommands() {
+    return {
+        .capacity = static_cast<int32_t>(commands.size()),
+        .length = static_cast<int32_t>(commands.size()),
+        .internalArray = commands.data()
+    };
+}
+
+// Copies the commands out of clay's arena, along with everything they point
+// at. Sized up front, since the commands get pointed into the copies.
+static void KeepLayout(const LayoutResult& result, LayoutFrame& frame) {
+    const Clay_RenderCommandArray& cmds = result.renderCommands;
+    frame.commands.assign(cmds.internalArray, cmds.internalArray + cmds.length);
+    frame.input = result.input;
+
+    size_t textBytes = 0;
+    size_t customCount = 0;
+    size_t bucketCount = 0;
+    size_t barCount = 0;
+    for (const Clay_RenderCommand& cmd : frame.commands) {
+        if (cmd.commandType == CLAY_RENDER_COMMAND_TYPE_TEXT) {
+            textBytes += cmd.renderData.text.stringContents.length;
+        } else if (cmd.commandType == CLAY_RENDER_COMMAND_TYPE_CUSTOM) {
+            const auto& element = *static_cast<const CustomElement*>(cmd.renderData.custom.customData);
+            customCount++;
+            if (element.type == CustomElement::Type::WAVEFORM)
+                bucketCount += element.waveform.count;
+            else if (element.type == CustomElement::Type::SPECTRUM)
+                barCount += element.spectrum.count;
+        }
+    }
+    frame.text.resize(textBytes);
+    frame.custom.resize(customCount);
+    frame.waveform.resize(bucketCount);
+    frame.spectrum.resize(barCount);
+
+    char* text = frame.text.data();
+    CustomElement* custom = frame.custom.data();
+    WaveformBucket* buckets = frame.waveform.data();
+    float* bars = frame.spectrum.data();
+    for (Clay_RenderCommand& cmd : frame.commands) {
+        if (cmd.commandType == CLAY_RENDER_COMMAND_TYPE_TEXT) {
+            Clay_StringSlice& str = cmd.renderData.text.stringContents;
+            std::copy_n(str.chars, str.length, text);
+            str.chars = text;
+            str.baseChars = text;
+            text += str.length;
+        } else if (cmd.commandType == CLAY_RENDER_COMMAND_TYPE_CUSTOM) {
+            CustomElement& element = *custom++;
+            element = *static_cast<const CustomElement*>(cmd.renderData.custom.customData);
+            cmd.renderData.custom.customData = &element;
+
+            if (element.type == CustomElement::Type::WAVEFORM) {
+                buckets = std::copy_n(element.waveform.buckets, element.waveform.count, buckets);
+                element.waveform.buckets = buckets - element.waveform.count;
+            } else if (element.type == CustomElement::Type::SPECTRUM) {
+                bars = std::copy_n(element.spectrum.bars, element.spectrum.count, bars);
+                element.spectrum.bars = bars - element.spectrum.count;
+            }
+        }
+    }
+}
+
+struct LayoutThreadState {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stop = false;
+    // set by StartLayout, cleared once it's laid out
+    LayoutRequest request;
+    LayoutFrame* out = nullptr;
+};
+
+LayoutThreadState g_layoutThread;
+
+static void LayoutMain() {
+    TRACE_THREAD("layout");
+    LayoutThreadState& t = g_layoutThread;
+    std::unique_lock lock(t.mutex);
+
+    while (true) {
+        t.wake.wait(lock, [&t]() { return t.stop || t.out; });
+        if (!t.out)
+            return;
+        lock.unlock();
+
+        const auto start = std::chrono::steady_clock::now();
+        KeepLayout(MakeLayout(t.request), *t.out);
+        t.out->doneAt = std::chrono::steady_clock::now();
+        t.out->layoutMs = std::chrono::duration<float, std::milli>(t.out->doneAt - start).count();
+
+        lock.lock();
+        t.out = nullptr;
+        t.done.notify_all();
+    }
+}
+
+void StartLayoutThread() {
+    LayoutThreadState& t = g_layoutThread;
+    t.stop = false;
+    t.thread = std::thread(LayoutMain);
+}
+
+void StopLayoutThread() {
+    LayoutThreadState& t = g_layoutThread;
+    {
+        std::lock_guard lock(t.mutex);
+        t.stop = true;
+    }
+    t.wake.notify_all();
+    if (t.thread.joinable())
+        t.thread.join();
+}
+
+void StartLayout(const LayoutRequest& request, LayoutFrame& out) {
+    LayoutThreadState& t = g_layoutThread;
+    {
+        std::lock_guard lock(t.mutex);
+        assert(!t.out && "StartLayout while a layout is still running");
+        t.request = request;
+        t.out = &out;
+    }
+    t.wake.notify_one();
+}
+
+void FinishLayout() {
+    LayoutThreadState& t = g_layoutThread;
+    std::unique_lock lock(t.mutex);
+    t.done.wait(lock, [&t]() { return !t.out; });
+}
@@ -3,15 +3,19 @@
 #define CLAY_IMPLMENTATION
 #include <clay.h>
 
+#include <chrono>
 #include <span>
 #include <vector>
 
 #include "Allocators.hpp"
 #include "Data.hpp"
+#include "LayoutElements.hpp"
+#include "Waveform.hpp"
 
 struct LayoutInput {
     int songIndex;
     int collectionIndex;
+    float seekFraction;  // where the mouse is along the progress bar, -1 if it isn't on it
 };
 
 struct LayoutResult {
@@ -19,9 +23,43 @@ struct LayoutResult {
     LayoutInput input;
 };
 
+// Everything MakeLayout looks at
+struct LayoutRequest {
+    PlaybackState state;
+    std::span<const SongEntry> songs;
+    std::span<const CollectionEntry> collections;
+    std::span<const WaveformBucket> waveform;
+    std::span<const float> spectrum;
+    Clay_Vector2 pointer;
+};
+
+// A finished layout that owns everything its commands point at (text,
+// custom elements and what those point at), so it can still be drawn after
+// the state it was made from has changed and clay has moved on.
+// The buffers are reused from frame to frame.
+struct LayoutFrame {
+    std::vector<Clay_RenderCommand> commands;
+    std::vector<char> text;
+    std::vector<CustomElement> custom;
+    std::vector<WaveformBucket> waveform;
+    std::vector<float> spectrum;
+    LayoutInput input;
+    float layoutMs;  // MakeLayout plus the copy
+    std::chrono::steady_clock::time_point doneAt;
+
+    Clay_RenderCommandArray RenderCommands();
+};
+
 void InitLayoutArenas(int nChars, int nCustom);
 
-struct TextRenderContext;
-LayoutResult MakeLayout(const PlaybackState& state,
-                        std::span<const SongEntry> songs,
-                        std::span<const CollectionEntry> collections);
+LayoutResult MakeLayout(const LayoutRequest& request);
+
+// Layout gets a thread of its own, so the main loop can lay out frame N+1
+// while it's still drawing frame N. Text gets measured on that thread, so
+// clay's measure function can't share anything with the renderer.
+void StartLayoutThread();
+void StopLayoutThread();
+// Lays `request` out into `out` on the layout thread. Until FinishLayout
+// returns, leave clay, `out` and whatever the request points at alone.
+void StartLayout(const LayoutRequest& request, LayoutFrame& out);
+void FinishLayout();
@@ -2,14 +2,26 @@
 
 #include <string_view>
 
+#include "Waveform.hpp"
+
 struct CustomElement {
     enum class Type {
-        UTF8_TEXT_SCISSOR
+        UTF8_TEXT_SCISSOR,
+        WAVEFORM,
+        SPECTRUM
     };
 
     Type type;
-    // union {
-    //     // no data required for UTF8_TEXT_SCISSOR
-    // };
+    union {
+        // no data required for UTF8_TEXT_SCISSOR
+        struct {
+            const WaveformBucket* buckets;
+            int count;
+            float progress;  // 0 to 1, everything left of it is drawn as played
+        } waveform;
+        struct {
+            const float* bars;  // 0 to 1, low frequencies first
+            int count;
+        } spectrum;
+    };
 };
-
@@ -0,0 +1,434 @@
+#include "Library.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <format>
+#include <initializer_list>
+#include <iterator>
+#include <unordered_set>
+#include <utility>
+
+#include "Trace.hpp"
+
+void LogSQLiteCallback(void*, int errCode, const char* msg) {
+    std::printf("[SQLITE] %s: %s\n", sqlite3_errstr(errCode), msg);
+}
+
+std::string ColumnString(sqlite3_stmt* stmt, int col) {
+    return std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, col)));
+}
+
+static bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+            return false;
+    }
+    return true;
+}
+
+AudioFormat ColumnFormat(sqlite3_stmt* stmt, int formatCol, int filenameCol) {
+    constexpr std::pair<std::string_view, AudioFormat> names[] = {
+        { "mp3", AudioFormat::MP3 },
+        { "opus", AudioFormat::OPUS },
+        { "ogg", AudioFormat::VORBIS },
+        { "vorbis", AudioFormat::VORBIS },
+        { "wav", AudioFormat::WAV },
+    };
+
+    std::string_view format;
+    if (const auto* text = sqlite3_column_text(stmt, formatCol))
+        format = reinterpret_cast<const char*>(text);
+
+    if (format.empty()) {
+        std::string_view filename;
+        if (const auto* text = sqlite3_column_text(stmt, filenameCol))
+            filename = reinterpret_cast<const char*>(text);
+        const size_t dot = filename.rfind('.');
+        if (dot != std::string_view::npos)
+            format = filename.substr(dot + 1);
+    }
+
+    for (const auto& [name, value] : names) {
+        if (EqualsIgnoreCase(format, name))
+            return value;
+    }
+    return AudioFormat::MP3;
+}
+
+int PrepareQuery(sqlite3* db, sqlite3_stmt** stmt, std::string_view query) {
+    return sqlite3_prepare_v2(db, query.data(), query.size() + 1, stmt, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Schema
+////////////////////////////////////////////////////////////////////////////////
+
+// Each entry moves the database from user_version i to i + 1.
+// Never edit an entry once it has shipped, add a new one instead.
+constexpr const char* MIGRATIONS[] = {
+    // 1: the original tables
+    "CREATE TABLE IF NOT EXISTS songs(filename TEXT, fileFormat TEXT, name TEXT, byArtist TEXT);"
+    "CREATE TABLE IF NOT EXISTS collections(name TEXT);"
+    "CREATE TABLE IF NOT EXISTS collections_contents(collectionId INTEGER, songId INTEGER);",
+
+    // 2: playlist order
+    // existing playlists keep the order they were inserted in
+    "ALTER TABLE collections_contents ADD COLUMN position INTEGER NOT NULL DEFAULT 0;"
+    "UPDATE collections_contents SET position = rowid * 65536;"
+    "CREATE INDEX collections_contents_order ON collections_contents(collectionId, position);",
+
+    // 3: smart collections (see SmartCollections.hpp)
+    // songs that predate this get stamped with the migration time
+    "ALTER TABLE songs ADD COLUMN addedAt INTEGER NOT NULL DEFAULT 0;"
+    "ALTER TABLE songs ADD COLUMN playCount INTEGER NOT NULL DEFAULT 0;"
+    "UPDATE songs SET addedAt = CAST(strftime('%s', 'now') AS INTEGER);"
+    "CREATE INDEX songs_added ON songs(addedAt);"
+    "CREATE TRIGGER songs_stamp_added AFTER INSERT ON songs WHEN NEW.addedAt = 0 BEGIN "
+    "    UPDATE songs SET addedAt = CAST(strftime('%s', 'now') AS INTEGER) WHERE rowid = NEW.rowid; "
+    "END;"
+    "ALTER TABLE collections ADD COLUMN smart INTEGER NOT NULL DEFAULT 0;"
+    "ALTER TABLE collections ADD COLUMN sweptAt INTEGER NOT NULL DEFAULT 0;"
+    "CREATE TABLE smart_rules(collectionId INTEGER, field INTEGER, op INTEGER, value TEXT);"
+    "CREATE INDEX collections_contents_song ON collections_contents(collectionId, songId);",
+
+    // 4: play history (see WriteBehind.hpp)
+    // playCount already exists from 3, this makes it actually count
+    "CREATE TABLE play_events(songId INTEGER, type INTEGER, timeMs INTEGER, positionMs INTEGER);"
+    "CREATE INDEX play_events_song ON play_events(songId, timeMs);"
+    "ALTER TABLE songs ADD COLUMN lastPlayed INTEGER NOT NULL DEFAULT 0;"
+    "ALTER TABLE songs ADD COLUMN skipCount INTEGER NOT NULL DEFAULT 0;",
+
+    // 5: duplicate detection (see Fingerprint.hpp)
+    // NULL frames means the song couldn't be decoded, don't retry it
+    "CREATE TABLE fingerprints(songId INTEGER PRIMARY KEY, frames BLOB, summary BLOB);"
+    "CREATE TABLE duplicates(songA INTEGER, songB INTEGER, similarity REAL);",
+
+    // 6: play queue (see Queue.hpp)
+    "CREATE TABLE queue_items(position INTEGER NOT NULL, songId INTEGER);"
+    "CREATE INDEX queue_items_order ON queue_items(position);"
+    "CREATE TABLE queue_state(current INTEGER, repeat INTEGER NOT NULL DEFAULT 0);"
+    "INSERT INTO queue_state(current, repeat) VALUES (NULL, 0);",
+
+    // 7: loudness normalization (see Loudness.hpp)
+    // NULL seconds means not measured yet, 0 means there was nothing to measure
+    "ALTER TABLE songs ADD COLUMN loudnessLufs REAL;"
+    "ALTER TABLE songs ADD COLUMN truePeakDb REAL;"
+    "ALTER TABLE songs ADD COLUMN loudnessSeconds REAL;",
+
+    // 8: progress bar waveforms (see Waveform.hpp)
+    // NULL buckets means the song couldn't be decoded
+    "CREATE TABLE waveforms(songId INTEGER PRIMARY KEY, buckets BLOB);",
+
+    // 9: seek points for MP3s (see SeekIndex.hpp)
+    "CREATE TABLE seek_indexes(songId INTEGER PRIMARY KEY, totalFrames INTEGER, points BLOB);",
+
+    // 10: which fingerprints the duplicates table was built from
+    // (0, 0) never matches a library with fingerprints, so it gets built
+    "CREATE TABLE duplicates_state(fingerprints INTEGER NOT NULL, lastSong INTEGER NOT NULL);"
+    "INSERT INTO duplicates_state(fingerprints, lastSong) VALUES (0, 0);",
+
+    // 11: what file a seek index was built from, so a retagged or replaced
+    // one gets a new index. Old rows have NULLs, which never match.
+    "ALTER TABLE seek_indexes ADD COLUMN sourceSize INTEGER;"
+    "ALTER TABLE seek_indexes ADD COLUMN sourceMtimeNs INTEGER;",
+};
+
+static_assert(POSITION_GAP == 65536, "Migration 2 hardcodes the position gap.");
+
+int MigrateSchema(sqlite3* db) {
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt, "PRAGMA user_version;");
+    if (err != SQLITE_OK) return err;
+
+    int version = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        version = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    constexpr int latest = std::size(MIGRATIONS);
+    for (; version < latest; version++) {
+        const std::string sql = std::format("BEGIN; {} PRAGMA user_version = {}; COMMIT;",
+                                            MIGRATIONS[version], version + 1);
+        err = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr);
+        if (err != SQLITE_OK) {
+            sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+            std::printf("[LIBRARY] Migration to schema version %d failed.\n", version + 1);
+            return err;
+        }
+    }
+
+    return SQLITE_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Loading
+////////////////////////////////////////////////////////////////////////////////
+
+int LoadCollections(sqlite3* db, Arena<CollectionEntry>& out) {
+    TRACE_ZONE("LoadCollections");
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt, "SELECT rowid, name, smart FROM collections;");
+    if (err != SQLITE_OK) return err;
+
+    while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+        int i = out.Allocate();
+        out.arr[i].id = sqlite3_column_int64(stmt, 0);
+        out.arr[i].name = ColumnString(stmt, 1);
+        out.arr[i].smart = sqlite3_column_int(stmt, 2) != 0;
+    }
+
+    sqlite3_finalize(stmt);
+    return err == SQLITE_DONE ? SQLITE_OK : err;
+}
+
+int LoadCollectionSongs(sqlite3* db, EntityId collectionId, Arena<SongEntry>& out) {
+    TRACE_ZONE("LoadCollectionSongs");
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt,
+        "SELECT songs.rowid, songs.filename, songs.name, songs.byArtist, collections_contents.rowid, songs.fileFormat "
+        "FROM collections_contents INNER JOIN songs ON collections_contents.songId = songs.rowid "
+        "WHERE collections_contents.collectionId = ? "
+        "ORDER BY collections_contents.position;");
+    if (err != SQLITE_OK) return err;
+
+    err = sqlite3_bind_int64(stmt, 1, collectionId);
+    if (err != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return err;
+    }
+
+    while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+        int i = out.Allocate();
+        // note that SQLite tables are 1-indexed
+        out.arr[i].id = sqlite3_column_int64(stmt, 0);
+        out.arr[i].filename = ColumnString(stmt, 1);
+        out.arr[i].fileFormat = ColumnFormat(stmt, 5, 1);
+        out.arr[i].name = ColumnString(stmt, 2);
+        out.arr[i].byArtist = ColumnString(stmt, 3);
+        out.arr[i].entryId = sqlite3_column_int64(stmt, 4);
+    }
+
+    sqlite3_finalize(stmt);
+    return err == SQLITE_DONE ? SQLITE_OK : err;
+}
+
+int LoadSong(sqlite3* db, EntityId id, SongEntry& out) {
+    TRACE_ZONE("LoadSong");
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt, "SELECT filename, name, byArtist, fileFormat FROM songs WHERE rowid = ?;");
+    if (err != SQLITE_OK) return err;
+
+    sqlite3_bind_int64(stmt, 1, id);
+    err = sqlite3_step(stmt);
+    if (err == SQLITE_ROW) {
+        out.id = id;
+        out.filename = ColumnString(stmt, 0);
+        out.fileFormat = ColumnFormat(stmt, 3, 0);
+        out.name = ColumnString(stmt, 1);
+        out.byArtist = ColumnString(stmt, 2);
+        out.entryId = NO_ENTITY;
+        err = SQLITE_OK;
+    } else if (err == SQLITE_DONE) {
+        err = SQLITE_NOTFOUND;
+    }
+
+    sqlite3_finalize(stmt);
+    return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Playlist ordering
+////////////////////////////////////////////////////////////////////////////////
+
+// Once a gap gets this small we schedule a renumber before it actually runs out.
+constexpr long int POSITION_LOW_WATER = 16;
+
+std::unordered_set<EntityId> g_pendingRebalance;
+
+// Runs a query that returns at most one integer.
+// `found` is false if the query returned no rows or a NULL.
+static int QueryInt64(sqlite3* db, std::string_view query,
+                      std::initializer_list<long int> binds,
+                      long int& out, bool& found) {
+    TRACE_ZONE("QueryInt64");
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt, query);
+    if (err != SQLITE_OK) return err;
+
+    int col = 1;
+    for (long int value : binds) {
+        err = sqlite3_bind_int64(stmt, col++, value);
+        if (err != SQLITE_OK) {
+            sqlite3_finalize(stmt);
+            return err;
+        }
+    }
+
+    found = false;
+    err = sqlite3_step(stmt);
+    if (err == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+        out = sqlite3_column_int64(stmt, 0);
+        found = true;
+    }
+
+    sqlite3_finalize(stmt);
+    return (err == SQLITE_ROW || err == SQLITE_DONE) ? SQLITE_OK : err;
+}
+
+static int Exec(sqlite3* db, std::string_view query, std::initializer_list<long int> binds) {
+    TRACE_ZONE("Exec");
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt, query);
+    if (err != SQLITE_OK) return err;
+
+    int col = 1;
+    for (long int value : binds) {
+        err = sqlite3_bind_int64(stmt, col++, value);
+        if (err != SQLITE_OK) {
+            sqlite3_finalize(stmt);
+            return err;
+        }
+    }
+
+    err = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return err == SQLITE_DONE ? SQLITE_OK : err;
+}
+
+// Picks a free position in front of beforeEntry (or after the last entry).
+// Returns SQLITE_FULL if the two neighbours are adjacent integers.
+static int FindPosition(sqlite3* db, EntityId collectionId, EntityId beforeEntry, long int& out) {
+    long int hi = 0;
+    bool found = false;
+    int err;
+
+    if (beforeEntry == NO_ENTITY) {
+        // MAX() over an index prefix is a single seek
+        err = QueryInt64(db, "SELECT MAX(position) FROM collections_contents WHERE collectionId = ?;",
+                         { collectionId }, hi, found);
+        if (err != SQLITE_OK) return err;
+
+        out = found ? hi + POSITION_GAP : POSITION_GAP;
+        return SQLITE_OK;
+    }
+
+    err = QueryInt64(db, "SELECT position FROM collections_contents WHERE rowid = ?;",
+                     { beforeEntry }, hi, found);
+    if (err != SQLITE_OK) return err;
+    if (!found) return SQLITE_NOTFOUND;
+
+    long int lo = 0;
+    err = QueryInt64(db,
+        "SELECT position FROM collections_contents "
+        "WHERE collectionId = ? AND position < ? ORDER BY position DESC LIMIT 1;",
+        { collectionId, hi }, lo, found);
+    if (err != SQLITE_OK) return err;
+
+    // inserting at the front: positions are allowed to go negative
+    if (!found)
+        lo = hi - 2 * POSITION_GAP;
+
+    if (hi - lo < 2)
+        return SQLITE_FULL;
+    if (hi - lo < POSITION_LOW_WATER)
+        g_pendingRebalance.insert(collectionId);
+
+    out = lo + (hi - lo) / 2;
+    return SQLITE_OK;
+}
+
+// FindPosition, but renumbers the collection on the spot if the gap is gone.
+// The pending rebalance should make this path very uncommon.
+static int FindPositionOrRebalance(sqlite3* db, EntityId collectionId,
+                                   EntityId beforeEntry, long int& out) {
+    int err = FindPosition(db, collectionId, beforeEntry, out);
+    if (err != SQLITE_FULL) return err;
+
+    g_pendingRebalance.erase(collectionId);
+    err = RebalanceCollection(db, collectionId);
+    if (err != SQLITE_OK) return err;
+    return FindPosition(db, collectionId, beforeEntry, out);
+}
+
+// The neighbours have to be read in the same transaction the row is
+// written in. Otherwise a renumber on the write-behind thread's connection
+// can commit in between, and the row lands between the wrong neighbours.
+// IMMEDIATE takes the write lock up front, so a reader can't get stuck
+// halfway waiting to upgrade it.
+template <typename Body>
+static int InWriteTransaction(sqlite3* db, const Body& body) {
+    int err = sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr);
+    if (err != SQLITE_OK) return err;
+
+    err = body();
+    if (err == SQLITE_OK)
+        err = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    if (err != SQLITE_OK)
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    return err;
+}
+
+int InsertIntoCollection(sqlite3* db, EntityId collectionId, EntityId songId,
+                         EntityId beforeEntry, EntityId* newEntry) {
+    return InWriteTransaction(db, [&]() {
+        long int position;
+        int err = FindPositionOrRebalance(db, collectionId, beforeEntry, position);
+        if (err != SQLITE_OK) return err;
+
+        err = Exec(db, "INSERT INTO collections_contents(collectionId, songId, position) VALUES (?, ?, ?);",
+                   { collectionId, songId, position });
+        if (err != SQLITE_OK) return err;
+
+        if (newEntry)
+            *newEntry = sqlite3_last_insert_rowid(db);
+        return SQLITE_OK;
+    });
+}
+
+int MoveInCollection(sqlite3* db, EntityId entry, EntityId beforeEntry) {
+    if (entry == beforeEntry)
+        return SQLITE_OK;
+
+    return InWriteTransaction(db, [&]() {
+        long int collectionId;
+        bool found;
+        int err = QueryInt64(db, "SELECT collectionId FROM collections_contents WHERE rowid = ?;",
+                             { entry }, collectionId, found);
+        if (err != SQLITE_OK) return err;
+        if (!found) return SQLITE_NOTFOUND;
+
+        long int position;
+        err = FindPositionOrRebalance(db, collectionId, beforeEntry, position);
+        if (err != SQLITE_OK) return err;
+
+        return Exec(db, "UPDATE collections_contents SET position = ? WHERE rowid = ?;",
+                    { position, entry });
+    });
+}
+
+int RemoveFromCollection(sqlite3* db, EntityId entry) {
+    // removing never needs a renumber, it only makes gaps bigger
+    return Exec(db, "DELETE FROM collections_contents WHERE rowid = ?;", { entry });
+}
+
+// Doesn't touch g_pendingRebalance, that one belongs to the main thread
+int RebalanceCollection(sqlite3* db, EntityId collectionId) {
+    // one statement, so it's atomic without an explicit transaction
+    return Exec(db,
+        "UPDATE collections_contents SET position = ranked.n * ? "
+        "FROM (SELECT rowid AS r, ROW_NUMBER() OVER (ORDER BY position, rowid) AS n "
+        "      FROM collections_contents WHERE collectionId = ?) AS ranked "
+        "WHERE collections_contents.rowid = ranked.r;",
+        { POSITION_GAP, collectionId });
+}
+
+bool TakePendingRebalance(EntityId& collectionId) {
+    if (g_pendingRebalance.empty())
+        return false;
+
+    collectionId = *g_pendingRebalance.begin();
+    g_pendingRebalance.erase(g_pendingRebalance.begin());
+    return true;
+}
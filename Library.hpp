@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <sqlite3.h>
+
+#include "Allocators.hpp"
+#include "Data.hpp"
+
+void LogSQLiteCallback(void*, int errCode, const char* msg);
+std::string ColumnString(sqlite3_stmt* stmt, int col);
+// songs.fileFormat is free text ("mp3", "opus", ...), and is NULL for
+// older imports. Those go by the file extension.
+AudioFormat ColumnFormat(sqlite3_stmt* stmt, int formatCol, int filenameCol);
+int PrepareQuery(sqlite3* db, sqlite3_stmt** stmt, std::string_view query);
+
+// Creates the tables if they don't exist and walks older databases forward
+// using PRAGMA user_version. Returns an sqlite error code.
+int MigrateSchema(sqlite3* db);
+
+int LoadCollections(sqlite3* db, Arena<CollectionEntry>& out);
+int LoadCollectionSongs(sqlite3* db, EntityId collectionId, Arena<SongEntry>& out);
+// SQLITE_NOTFOUND if there is no such song
+int LoadSong(sqlite3* db, EntityId id, SongEntry& out);
+
+// Playlist ordering
+//
+// Entries in collections_contents are ordered by a sparse integer position.
+// New entries are numbered POSITION_GAP apart, so inserting or moving one
+// entry only has to find a free integer between its two neighbours:
+// that is one indexed lookup and one written row.
+// When a gap is used up the collection gets renumbered. That is rare
+// (each insert halves a gap, so it takes ~16 inserts into the same spot),
+// and it is deferred to the write-behind thread when we see it coming
+// (see TakePendingRebalance).
+constexpr long int POSITION_GAP = 1 << 16;
+
+// All of these take/return rowids of collections_contents (SongEntry::entryId).
+// beforeEntry == NO_ENTITY means "at the end".
+int InsertIntoCollection(sqlite3* db, EntityId collectionId, EntityId songId,
+                         EntityId beforeEntry, EntityId* newEntry = nullptr);
+int MoveInCollection(sqlite3* db, EntityId entry, EntityId beforeEntry);
+int RemoveFromCollection(sqlite3* db, EntityId entry);
+
+// Renumbers the whole collection POSITION_GAP apart, in one statement.
+// Safe to call from any thread with its own connection.
+int RebalanceCollection(sqlite3* db, EntityId collectionId);
+// Hands out a collection that ran low on gaps, at most one per call.
+// Meant to be called once per frame, the renumber itself goes to the
+// write-behind thread (RecordRebalance) since it rewrites every row.
+bool TakePendingRebalance(EntityId& collectionId);
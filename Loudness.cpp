@@ -0,0 +1,499 @@
+#include "Loudness.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <numbers>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "Decoder.hpp"
+#include "Library.hpp"
+#include "Simd.hpp"
+#include "WorkerPool.hpp"
+
+constexpr double BLOCK_SECONDS = 0.1;
+constexpr size_t BLOCKS_PER_WINDOW = 4;  // gating windows are 400 ms, 75% overlap
+constexpr double ABSOLUTE_GATE = -70.0;
+constexpr double RELATIVE_GATE = -10.0;
+
+// True peak oversampler: 4 phases of 12 taps
+constexpr size_t OVERSAMPLE = 4;
+constexpr size_t PHASE_TAPS = 12;
+
+////////////////////////////////////////////////////////////////////////////////
+// Measurement
+////////////////////////////////////////////////////////////////////////////////
+
+static double ToLufs(double meanSquare) {
+    return -0.691 + 10.0 * std::log10(meanSquare);
+}
+
+static double FromLufs(double lufs) {
+    return std::pow(10.0, (lufs + 0.691) / 10.0);
+}
+
+// Interpolation filter taps, grouped so Coef[k] holds tap k of all four phases.
+// Windowed sinc with its cutoff at the original Nyquist, each phase
+// normalized to unity gain at DC.
+struct OversamplerTaps {
+    f32x4 coef[PHASE_TAPS];
+
+    OversamplerTaps() {
+        constexpr size_t taps = OVERSAMPLE * PHASE_TAPS;
+        constexpr double center = (taps - 1) / 2.0;
+        double h[taps];
+        for (size_t n = 0; n < taps; n++) {
+            const double x = (n - center) / OVERSAMPLE;
+            const double sinc = x == 0.0 ? 1.0 : std::sin(std::numbers::pi * x) / (std::numbers::pi * x);
+            const double window = 0.5 - 0.5 * std::cos(2.0 * std::numbers::pi * (n + 0.5) / taps);
+            h[n] = sinc * window;
+        }
+
+        for (size_t phase = 0; phase < OVERSAMPLE; phase++) {
+            double sum = 0.0;
+            for (size_t k = 0; k < PHASE_TAPS; k++)
+                sum += h[k * OVERSAMPLE + phase];
+            for (size_t k = 0; k < PHASE_TAPS; k++)
+                coef[k][phase] = static_cast<float>(h[k * OVERSAMPLE + phase] / sum);
+        }
+    }
+};
+
+static const OversamplerTaps g_oversampler;
+
+LoudnessMeter::LoudnessMeter(unsigned int channels, unsigned int sampleRate)
+    : m_channels(channels) {
+    // K-weighting as specified in ITU-R BS.1770, redone for whatever
+    // the sample rate is (the spec only lists coefficients for 48k).
+    const double rate = sampleRate;
+    {
+        const double f0 = 1681.974450955533;
+        const double gain = 3.999843853973347;
+        const double q = 0.7071752369554196;
+        const double k = std::tan(std::numbers::pi * f0 / rate);
+        const double vh = std::pow(10.0, gain / 20.0);
+        const double vb = std::pow(vh, 0.4996667741545416);
+        const double a0 = 1.0 + k / q + k * k;
+        m_shelf = {
+            .b0 = (vh + vb * k / q + k * k) / a0,
+            .b1 = 2.0 * (k * k - vh) / a0,
+            .b2 = (vh - vb * k / q + k * k) / a0,
+            .a1 = 2.0 * (k * k - 1.0) / a0,
+            .a2 = (1.0 - k / q + k * k) / a0
+        };
+    }
+    {
+        const double f0 = 38.13547087602444;
+        const double q = 0.5003270373238773;
+        const double k = std::tan(std::numbers::pi * f0 / rate);
+        const double a0 = 1.0 + k / q + k * k;
+        m_highpass = {
+            .b0 = 1.0,
+            .b1 = -2.0,
+            .b2 = 1.0,
+            .a1 = 2.0 * (k * k - 1.0) / a0,
+            .a2 = (1.0 - k / q + k * k) / a0
+        };
+    }
+
+    // Channels go through the filters in pairs, one per vector lane.
+    const size_t pairs = (channels + 1) / 2;
+    m_state.assign(pairs * 8, 0.0);
+
+    // 5.1 order: surrounds count a bit more, LFE doesn't count at all
+    m_weights.assign(pairs * 2, 0.0);
+    for (unsigned int c = 0; c < channels; c++)
+        m_weights[c] = channels == 6 && c == 3 ? 0.0 : channels == 6 && c >= 4 ? 1.41 : 1.0;
+
+    m_blockFrames = std::max<size_t>(1, static_cast<size_t>(BLOCK_SECONDS * rate));
+    m_history.assign(channels * (PHASE_TAPS - 1), 0.0f);
+}
+
+void LoudnessMeter::Add(const float* frames, size_t count) {
+    AddPeak(frames, count);
+
+    const size_t pairs = (m_channels + 1) / 2;
+    const Biquad& s = m_shelf;
+    const Biquad& h = m_highpass;
+
+    size_t done = 0;
+    while (done < count) {
+        const size_t n = std::min(count - done, m_blockFrames - m_blockPos);
+        const float* in = frames + done * m_channels;
+
+        for (size_t pair = 0; pair < pairs; pair++) {
+            const size_t c0 = pair * 2;
+            // an odd channel out runs through both lanes, the second one weighted 0
+            const size_t c1 = std::min<size_t>(c0 + 1, m_channels - 1);
+
+            f64x2 z[4];
+            std::memcpy(z, m_state.data() + pair * 8, sizeof(z));
+            f64x2 energy = Splat2(0.0);
+
+            for (size_t i = 0; i < n; i++) {
+                const f64x2 x{ in[i * m_channels + c0], in[i * m_channels + c1] };
+
+                // transposed direct form II, shelf then high-pass
+                const f64x2 y = s.b0 * x + z[0];
+                z[0] = s.b1 * x - s.a1 * y + z[1];
+                z[1] = s.b2 * x - s.a2 * y;
+
+                const f64x2 w = h.b0 * y + z[2];
+                z[2] = h.b1 * y - h.a1 * w + z[3];
+                z[3] = h.b2 * y - h.a2 * w;
+
+                energy += w * w;
+            }
+
+            std::memcpy(m_state.data() + pair * 8, z, sizeof(z));
+            m_blockEnergy += m_weights[c0] * energy[0] + m_weights[c0 + 1] * energy[1];
+        }
+
+        m_blockPos += n;
+        done += n;
+        if (m_blockPos == m_blockFrames) {
+            m_blocks.push_back(m_blockEnergy / m_blockFrames);
+            m_blockEnergy = 0.0;
+            m_blockPos = 0;
+        }
+    }
+}
+
+void LoudnessMeter::AddPeak(const float* frames, size_t count) {
+    constexpr size_t keep = PHASE_TAPS - 1;
+    std::vector<float> line(keep + count);
+    f32x4 peak = Splat4(m_peak);
+
+    for (unsigned int c = 0; c < m_channels; c++) {
+        float* history = m_history.data() + c * keep;
+        std::copy(history, history + keep, line.begin());
+        for (size_t i = 0; i < count; i++)
+            line[keep + i] = frames[i * m_channels + c];
+
+        // all four interpolated samples between two input samples at once
+        for (size_t i = 0; i < count; i++) {
+            const float* x = line.data() + keep + i;
+            f32x4 y = Splat4(0.0f);
+            for (size_t k = 0; k < PHASE_TAPS; k++)
+                y += g_oversampler.coef[k] * Splat4(x[-static_cast<ptrdiff_t>(k)]);
+            peak = Max4(peak, Max4(y, -y));
+        }
+
+        std::copy(line.end() - keep, line.end(), history);
+    }
+
+    m_peak = std::max({ peak[0], peak[1], peak[2], peak[3] });
+}
+
+LoudnessResult LoudnessMeter::Finish() const {
+    LoudnessResult result{
+        .integratedLufs = -INFINITY,
+        .truePeakDb = m_peak > 0.0f ? 20.0f * std::log10(m_peak) : -INFINITY,
+        .gatedSeconds = 0.0f
+    };
+    if (m_blocks.size() < BLOCKS_PER_WINDOW)
+        return result;
+
+    std::vector<double> windows;
+    windows.reserve(m_blocks.size());
+    for (size_t i = 0; i + BLOCKS_PER_WINDOW <= m_blocks.size(); i++) {
+        double sum = 0.0;
+        for (size_t j = 0; j < BLOCKS_PER_WINDOW; j++)
+            sum += m_blocks[i + j];
+        windows.push_back(sum / BLOCKS_PER_WINDOW);
+    }
+
+    // Gate twice: first anything that's basically silence,
+    // then anything 10 LU below what's left.
+    const double absolute = FromLufs(ABSOLUTE_GATE);
+    double sum = 0.0;
+    size_t count = 0;
+    for (double w : windows) {
+        if (w > absolute) {
+            sum += w;
+            count++;
+        }
+    }
+    if (count == 0)
+        return result;
+
+    const double relative = std::max(absolute, FromLufs(ToLufs(sum / count) + RELATIVE_GATE));
+    sum = 0.0;
+    count = 0;
+    for (double w : windows) {
+        if (w > relative) {
+            sum += w;
+            count++;
+        }
+    }
+    if (count == 0)
+        return result;
+
+    result.integratedLufs = static_cast<float>(ToLufs(sum / count));
+    result.gatedSeconds = static_cast<float>(count * BLOCK_SECONDS);
+    return result;
+}
+
+// Decodes all of `filename`. Gives up (returning false) if told to stop.
+static bool MeasureLoudness(const char* filename, LoudnessResult& out, const std::atomic<bool>& stop) {
+    Decoder dec;
+    if (!OpenDecoder(dec, filename))
+        return false;
+
+    LoudnessMeter meter(dec.channels, dec.sampleRate);
+    constexpr size_t chunkFrames = 4096;
+    std::vector<float> chunk(chunkFrames * dec.channels);
+
+    bool stopped = false;
+    while (true) {
+        if (stop) {
+            stopped = true;
+            break;
+        }
+        const size_t got = ReadFrames(dec, chunk.data(), chunkFrames);
+        if (got == 0)
+            break;
+        meter.Add(chunk.data(), got);
+    }
+
+    CloseDecoder(dec);
+    out = meter.Finish();
+    return !stopped;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Playback gain
+////////////////////////////////////////////////////////////////////////////////
+
+struct SongGain {
+    float track;  // linear
+    float album;
+};
+
+struct GainTable {
+    std::mutex mutex;
+    std::unordered_map<EntityId, SongGain> gains;
+    std::atomic<GainMode> mode{GainMode::TRACK};
+};
+
+GainTable g_gains;
+
+static float GainFor(double lufs, double peakDb) {
+    const double db = std::min(LOUDNESS_TARGET - lufs, MAX_TRUE_PEAK - peakDb);
+    return static_cast<float>(std::pow(10.0, db / 20.0));
+}
+
+int LoadLoudness(sqlite3* db) {
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt,
+        "SELECT rowid, filename, loudnessLufs, truePeakDb, loudnessSeconds FROM songs "
+        "WHERE loudnessLufs IS NOT NULL;");
+    if (err != SQLITE_OK) return err;
+
+    struct Measured {
+        EntityId id;
+        std::string album;
+        double lufs;
+        double peakDb;
+        double seconds;
+    };
+    struct Album {
+        double energy = 0.0;  // loudness-weighted seconds
+        double seconds = 0.0;
+        double peakDb = -INFINITY;
+    };
+
+    std::vector<Measured> songs;
+    std::unordered_map<std::string, Album> albums;
+    while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+        std::string path = ColumnString(stmt, 1);
+        const size_t slash = path.find_last_of("/\\");
+        path.resize(slash == std::string::npos ? 0 : slash);
+
+        const Measured& song = songs.emplace_back(Measured{
+            .id = sqlite3_column_int64(stmt, 0),
+            .album = std::move(path),
+            .lufs = sqlite3_column_double(stmt, 2),
+            .peakDb = sqlite3_column_double(stmt, 3),
+            .seconds = sqlite3_column_double(stmt, 4)
+        });
+
+        // Album loudness is the power mean of its songs, weighted by how
+        // much of each survived gating. Close to measuring the whole album
+        // in one go, without keeping every song's blocks around.
+        Album& album = albums[song.album];
+        album.energy += song.seconds * FromLufs(song.lufs);
+        album.seconds += song.seconds;
+        album.peakDb = std::max(album.peakDb, song.peakDb);
+    }
+    sqlite3_finalize(stmt);
+    if (err != SQLITE_DONE) return err;
+
+    std::unordered_map<EntityId, SongGain> gains;
+    gains.reserve(songs.size());
+    for (const Measured& song : songs) {
+        const Album& album = albums[song.album];
+        gains[song.id] = {
+            .track = GainFor(song.lufs, song.peakDb),
+            .album = GainFor(ToLufs(album.energy / album.seconds), album.peakDb)
+        };
+    }
+
+    std::lock_guard lock(g_gains.mutex);
+    g_gains.gains.swap(gains);
+    return SQLITE_OK;
+}
+
+void SetGainMode(GainMode mode) {
+    g_gains.mode.store(mode, std::memory_order_relaxed);
+}
+
+GainMode CurrentGainMode() {
+    return g_gains.mode.load(std::memory_order_relaxed);
+}
+
+float PlaybackGain(EntityId song) {
+    const GainMode mode = CurrentGainMode();
+    if (mode == GainMode::OFF)
+        return 1.0f;
+
+    std::lock_guard lock(g_gains.mutex);
+    auto it = g_gains.gains.find(song);
+    if (it == g_gains.gains.end())
+        return 1.0f;
+    return mode == GainMode::ALBUM ? it->second.album : it->second.track;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Background job
+////////////////////////////////////////////////////////////////////////////////
+
+// Whole songs get decoded here, so batches are smaller than the fingerprint job's
+constexpr size_t JOB_BATCH = 16;
+constexpr std::chrono::seconds RELOAD_INTERVAL{10};
+
+struct LoudnessJob {
+    std::thread thread;
+    std::atomic<bool> stop{false};
+};
+
+LoudnessJob g_loudnessJob;
+
+struct PendingSong {
+    EntityId id;
+    std::string filename;
+};
+
+static void LoudnessMain(std::string dbPath) {
+    const std::atomic<bool>& stop = g_loudnessJob.stop;
+
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(dbPath.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return;
+    }
+    sqlite3_busy_timeout(db, 1000);
+
+    std::vector<PendingSong> pending;
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt, "SELECT rowid, filename FROM songs WHERE loudnessSeconds IS NULL;");
+    if (err == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+            pending.push_back({ sqlite3_column_int64(stmt, 0), ColumnString(stmt, 1) });
+        sqlite3_finalize(stmt);
+    }
+
+    err = PrepareQuery(db, &stmt,
+        "UPDATE songs SET loudnessLufs = ?, truePeakDb = ?, loudnessSeconds = ? WHERE rowid = ?;");
+    if (err != SQLITE_OK) {
+        sqlite3_close(db);
+        return;
+    }
+
+    WorkerPool& workers = SharedWorkers();
+    const auto start = std::chrono::steady_clock::now();
+    size_t done = 0;
+    size_t reloaded = 0;
+    auto lastReload = start;
+
+    for (size_t first = 0; first < pending.size() && !stop; first += JOB_BATCH) {
+        const size_t n = std::min(JOB_BATCH, pending.size() - first);
+        std::vector<LoudnessResult> results(n);
+        std::vector<char> ok(n, 0);
+
+        workers.ParallelFor(n, [&](size_t i) {
+            ok[i] = MeasureLoudness(pending[first + i].filename.c_str(), results[i], stop);
+        });
+
+        // Whatever got cut off by stopping is redone next launch. Songs that
+        // can't be decoded (or are silent) are stored with 0 seconds and
+        // NULL loudness, so they're not tried again. Same for a batch that
+        // doesn't make it in.
+        err = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+        for (size_t i = 0; err == SQLITE_OK && i < n; i++) {
+            if (stop && !ok[i])
+                continue;
+
+            const LoudnessResult& r = results[i];
+            if (ok[i] && std::isfinite(r.integratedLufs)) {
+                sqlite3_bind_double(stmt, 1, r.integratedLufs);
+                sqlite3_bind_double(stmt, 2, r.truePeakDb);
+                sqlite3_bind_double(stmt, 3, r.gatedSeconds);
+            } else {
+                sqlite3_bind_null(stmt, 1);
+                sqlite3_bind_null(stmt, 2);
+                sqlite3_bind_double(stmt, 3, 0.0);
+            }
+            sqlite3_bind_int64(stmt, 4, pending[first + i].id);
+            err = sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+            err = err == SQLITE_DONE ? SQLITE_OK : err;
+        }
+        if (err == SQLITE_OK)
+            err = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+        if (err != SQLITE_OK) {
+            sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+            std::printf("[LOUDNESS] Could not save a batch of %zu: %s\n", n, sqlite3_errstr(err));
+            continue;
+        }
+        done += n;
+
+        // Album gains can change with every song, so the lot gets reloaded,
+        // but that's a pass over the whole library. Every so often is
+        // plenty while the job runs, it's done once more at the end.
+        if (std::chrono::steady_clock::now() - lastReload >= RELOAD_INTERVAL) {
+            LoadLoudness(db);
+            lastReload = std::chrono::steady_clock::now();
+            reloaded = done;
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    if (done > reloaded)
+        LoadLoudness(db);
+
+    if (done > 0) {
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::printf("[LOUDNESS] %zu files in %.2f s (%.1f files/s on %u workers)\n",
+                    done, elapsed.count(), done / elapsed.count(), workers.Size());
+    }
+
+    sqlite3_close(db);
+}
+
+void StartLoudnessJob(const char* dbPath) {
+    g_loudnessJob.stop = false;
+    g_loudnessJob.thread = std::thread(LoudnessMain, std::string(dbPath));
+}
+
+void StopLoudnessJob() {
+    g_loudnessJob.stop = true;
+    if (g_loudnessJob.thread.joinable())
+        g_loudnessJob.thread.join();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "Data.hpp"
+
+// Loudness normalization, EBU R128 style.
+//
+// Every song is decoded once in the background and gets its integrated
+// loudness (K-weighted, gated, in LUFS) and its true peak (4x oversampled,
+// in dBTP) stored in `songs`. At playback each track is scaled towards
+// LOUDNESS_TARGET, but never so far up that the true peak would go over
+// -1 dBTP. The limiter in Dsp.hpp would catch it, but that one is there for
+// EQ and preamp boosts and can be turned off. Normalization alone shouldn't
+// have it pumping on every quiet, peaky song.
+//
+// "Album" gain treats every folder as an album, that being how ripped
+// albums are usually laid out. Songs in one folder all get the same gain,
+// so the quiet ones stay quiet relative to the rest.
+
+// Same reference ReplayGain 2 uses. -23 (the broadcast one)
+// is a lot quieter than most of what people listen to.
+constexpr float LOUDNESS_TARGET = -18.0f;
+constexpr float MAX_TRUE_PEAK = -1.0f;
+
+struct LoudnessResult {
+    float integratedLufs;  // -INFINITY if everything was gated out (silence)
+    float truePeakDb;
+    float gatedSeconds;    // how much of the song counted, weights album loudness
+};
+
+// Streaming measurement, feed it interleaved frames as they're decoded.
+// Only ever holds one loudness value per 100 ms of audio.
+class LoudnessMeter {
+ public:
+    LoudnessMeter(unsigned int channels, unsigned int sampleRate);
+
+    void Add(const float* frames, size_t count);
+    LoudnessResult Finish() const;
+
+ private:
+    struct Biquad {
+        double b0, b1, b2, a1, a2;
+    };
+
+    void AddPeak(const float* frames, size_t count);
+
+    unsigned int m_channels;
+    Biquad m_shelf;
+    Biquad m_highpass;
+    std::vector<double> m_state;     // 4 per filter per channel
+    std::vector<double> m_weights;   // per channel
+
+    size_t m_blockFrames;            // 100 ms
+    size_t m_blockPos = 0;
+    double m_blockEnergy = 0.0;
+    std::vector<double> m_blocks;    // mean square per 100 ms, weighted and summed over channels
+
+    std::vector<float> m_history;    // per channel, the last few samples for the oversampler
+    float m_peak = 0.0f;
+};
+
+enum class GainMode : uint8_t {
+    OFF,
+    TRACK,
+    ALBUM
+};
+
+// Reads what's been measured so far. The job keeps this up to date after that.
+int LoadLoudness(sqlite3* db);
+
+void SetGainMode(GainMode mode);
+GainMode CurrentGainMode();
+// Linear gain to play `song` at, 1 if it hasn't been measured.
+// Safe to call from any thread.
+float PlaybackGain(EntityId song);
+
+// Measures every song that hasn't been yet, on the shared worker pool.
+// Picks up where it left off on the next launch.
+void StartLoudnessJob(const char* dbPath);
+void StopLoudnessJob();
@@ -0,0 +1,97 @@
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Defer.hpp"
+
+bool MapFile(MappedFile& file, const char* filename) {
+    file = MappedFile{};
+
+    const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    const auto fdReleaser = Defer([fd](){ close(fd); });
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        return false;
+
+    const size_t size = st.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    file.data = static_cast<const uint8_t*>(mapping);
+    file.size = size;
+    return true;
+}
+
+void UnmapFile(MappedFile& file) {
+    if (file.data)
+        munmap(const_cast<uint8_t*>(file.data), file.size);
+    file = MappedFile{};
+}
+
+void ReadaheadFile(const MappedFile& file, size_t bytes) {
+    if (file.data)
+        madvise(const_cast<uint8_t*>(file.data), std::min(bytes, file.size), MADV_WILLNEED);
+}
+
+size_t ResidentBytes(const MappedFile& file) {
+    if (!file.data)
+        return 0;
+
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t pages = (file.size + page - 1) / page;
+    std::vector<unsigned char> resident(pages);
+    if (mincore(const_cast<uint8_t*>(file.data), file.size, resident.data()) != 0)
+        return 0;
+
+    const size_t count = std::count_if(resident.begin(), resident.end(), [](unsigned char r) { return r & 1; });
+    return std::min(count * page, file.size);
+}
+
+bool StatFile(const char* filename, uint64_t& size, int64_t& mtimeNs) {
+    struct stat st;
+    if (stat(filename, &st) != 0)
+        return false;
+    size = st.st_size;
+    mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+IoUsage& IoUsage::operator+=(const IoUsage& other) {
+    majorFaults += other.majorFaults;
+    minorFaults += other.minorFaults;
+    cpuMs += other.cpuMs;
+    return *this;
+}
+
+IoUsage ThreadUsage() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0)
+        return {};
+
+    const auto ms = [](const timeval& tv) { return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0; };
+    return {
+        .majorFaults = usage.ru_majflt,
+        .minorFaults = usage.ru_minflt,
+        .cpuMs = ms(usage.ru_utime) + ms(usage.ru_stime)
+    };
+}
+
+IoUsage operator-(const IoUsage& a, const IoUsage& b) {
+    return {
+        .majorFaults = a.majorFaults - b.majorFaults,
+        .minorFaults = a.minorFaults - b.minorFaults,
+        .cpuMs = a.cpuMs - b.cpuMs
+    };
+}
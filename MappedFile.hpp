@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Audio files get mmap'd and decoded straight out of the page cache.
+// No read() calls (and no copy into a stdio buffer) while a song plays,
+// the kernel's readahead does the I/O behind our back.
+
+struct MappedFile {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+// Maps the whole file read-only and tells the kernel it's going to be read
+// front to back, so it reads ahead further and drops pages behind us sooner.
+bool MapFile(MappedFile& file, const char* filename);
+void UnmapFile(MappedFile& file);
+
+// Asks for up to `bytes` from the start to be read in the background,
+// for files we know are coming up soon.
+void ReadaheadFile(const MappedFile& file, size_t bytes);
+
+// How much of the file is in the page cache right now.
+size_t ResidentBytes(const MappedFile& file);
+
+// Size and modification time, to tell whether a file changed since
+// something was made from it (cached heads, seek indexes).
+bool StatFile(const char* filename, uint64_t& size, int64_t& mtimeNs);
+
+// Resource usage of the calling thread, for before/after deltas.
+struct IoUsage {
+    long majorFaults = 0;  // had to wait on the disk
+    long minorFaults = 0;  // page was already cached, just not mapped yet
+    double cpuMs = 0.0;    // user + system
+
+    IoUsage& operator+=(const IoUsage& other);
+};
+
+IoUsage ThreadUsage();
+IoUsage operator-(const IoUsage& a, const IoUsage& b);
@@ -0,0 +1,96 @@
+#include "Mixer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#include "Simd.hpp"
+
+constexpr size_t CHANNELS = 2;
+// How long each linear piece of a fade curve is.
+// ~6 ms at 44.1k, short enough that nobody hears the corners.
+constexpr size_t RAMP_FRAMES = 256;
+
+// One input into `out`, either overwriting it or adding to it.
+// Two stereo frames per vector, so the gains go in pairs: {g0, g0, g1, g1}.
+template <bool Accumulate>
+static void MixOne(float* out, const MixInput& in, size_t frames) {
+    const float step = (in.gainTo - in.gainFrom) / static_cast<float>(frames);
+    const float* src = in.samples;
+
+    f32x4 gain{ in.gainFrom, in.gainFrom, in.gainFrom + step, in.gainFrom + step };
+    const f32x4 gainStep = Splat4(2.0f * step);
+
+    const size_t samples = frames * CHANNELS;
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        f32x4 v = Load4(src + i) * gain;
+        if constexpr (Accumulate)
+            v += Load4(out + i);
+        Store4(out + i, v);
+        gain += gainStep;
+    }
+
+    // odd frame count leaves one frame over
+    for (; i < samples; i++) {
+        const float g = in.gainFrom + step * static_cast<float>(i / CHANNELS);
+        out[i] = Accumulate ? out[i] + src[i] * g : src[i] * g;
+    }
+}
+
+void MixStreams(float* out, size_t frames, std::span<const MixInput> inputs) {
+    if (frames == 0)
+        return;
+
+    if (inputs.empty()) {
+        std::fill(out, out + frames * CHANNELS, 0.0f);
+        return;
+    }
+
+    // If `out` is one of the inputs it has to go first,
+    // otherwise it would get overwritten before it's read.
+    size_t first = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (inputs[i].samples == out)
+            first = i;
+    }
+
+    MixOne<false>(out, inputs[first], frames);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (i != first)
+            MixOne<true>(out, inputs[i], frames);
+    }
+}
+
+void ApplyGain(float* samples, size_t count, float gain) {
+    const f32x4 g = Splat4(gain);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        Store4(samples + i, Load4(samples + i) * g);
+    for (; i < count; i++)
+        samples[i] *= gain;
+}
+
+float FadeOutGain(float t) {
+    return std::cos(std::clamp(t, 0.0f, 1.0f) * std::numbers::pi_v<float> * 0.5f);
+}
+
+float FadeInGain(float t) {
+    return std::sin(std::clamp(t, 0.0f, 1.0f) * std::numbers::pi_v<float> * 0.5f);
+}
+
+void CrossfadeFrames(float* incoming, const float* outgoing, size_t frames, float t0, float t1) {
+    const float perFrame = frames > 0 ? (t1 - t0) / static_cast<float>(frames) : 0.0f;
+
+    for (size_t done = 0; done < frames; done += RAMP_FRAMES) {
+        const size_t n = std::min(RAMP_FRAMES, frames - done);
+        const float a = t0 + perFrame * static_cast<float>(done);
+        const float b = t0 + perFrame * static_cast<float>(done + n);
+
+        const MixInput inputs[] = {
+            { incoming + done * CHANNELS, FadeInGain(a), FadeInGain(b) },
+            { outgoing + done * CHANNELS, FadeOutGain(a), FadeOutGain(b) }
+        };
+        MixStreams(incoming + done * CHANNELS, n, inputs);
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+
+// Mixing stage for the playback path. Everything here works on
+// interleaved stereo float, which is what the player's ring holds.
+
+struct MixInput {
+    const float* samples;
+    // The gain moves linearly from `gainFrom` at the first frame
+    // to `gainTo` right after the last one.
+    float gainFrom;
+    float gainTo;
+};
+
+// out = sum of inputs * their gains, over `frames` stereo frames.
+// `out` may be one of the inputs.
+void MixStreams(float* out, size_t frames, std::span<const MixInput> inputs);
+
+// Scales `samples` samples in place.
+void ApplyGain(float* samples, size_t count, float gain);
+
+// Equal-power crossfade curves: the two gains squared always add up to 1,
+// so uncorrelated material stays at the same loudness all the way through.
+// `t` goes from 0 (start of the fade) to 1.
+float FadeOutGain(float t);
+float FadeInGain(float t);
+
+// Mixes `incoming` into `outgoing`'s place for a stretch of a crossfade,
+// `t0` and `t1` being where in the fade the first and last+1 frames are.
+// The curves are followed in short linear pieces, see MixStreams.
+// Result goes to `incoming`.
+void CrossfadeFrames(float* incoming, const float* outgoing, size_t frames, float t0, float t1);
@@ -0,0 +1,353 @@
+#include "OggOpus.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include <opus_multistream.h>
+
+// Longest packet Opus allows: 120 ms at 48 kHz
+constexpr int MAX_PACKET_FRAMES = 5760;
+// How far ahead of a seek target to start decoding, RFC 7845 says 80 ms is enough
+constexpr uint64_t SEEK_PREROLL = 3840;
+// Bisection stops here and walks the remaining pages in order
+constexpr size_t BISECT_STOP = 64 << 10;
+
+constexpr uint8_t PAGE_CONTINUED = 0x01;
+constexpr uint8_t PAGE_FIRST = 0x02;
+constexpr uint8_t PAGE_LAST = 0x04;
+
+constexpr auto CRC_TABLE = []() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t r = i << 24;
+        for (int bit = 0; bit < 8; bit++)
+            r = (r & 0x80000000u) ? (r << 1) ^ 0x04c11db7u : r << 1;
+        table[i] = r;
+    }
+    return table;
+}();
+
+static uint32_t LoadLE(const uint8_t* p, int bytes) {
+    uint32_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+// Checks the page at `offset` is whole and its CRC matches. Everything
+// found by scanning for "OggS" goes through here, so a capture pattern
+// that happens to show up inside compressed audio doesn't get far.
+static bool ParsePage(const uint8_t* data, size_t size, size_t offset, OggPage& page) {
+    if (offset > size || size - offset < 27)
+        return false;
+
+    const uint8_t* p = data + offset;
+    if (std::memcmp(p, "OggS", 4) != 0 || p[4] != 0)
+        return false;
+
+    const int segments = p[26];
+    if (size - offset < 27u + segments)
+        return false;
+
+    size_t bodySize = 0;
+    for (int i = 0; i < segments; i++)
+        bodySize += p[27 + i];
+    const size_t pageSize = 27 + segments + bodySize;
+    if (size - offset < pageSize)
+        return false;
+
+    uint32_t crc = 0;
+    for (size_t i = 0; i < pageSize; i++) {
+        const uint8_t byte = (i >= 22 && i < 26) ? 0 : p[i];
+        crc = (crc << 8) ^ CRC_TABLE[((crc >> 24) ^ byte) & 0xff];
+    }
+    if (crc != LoadLE(p + 22, 4))
+        return false;
+
+    page = {
+        .offset = offset,
+        .size = pageSize,
+        .granule = static_cast<int64_t>(LoadLE(p + 6, 4) | (uint64_t(LoadLE(p + 10, 4)) << 32)),
+        .serial = LoadLE(p + 14, 4),
+        .flags = p[5],
+        .segments = segments,
+        .lacing = p + 27,
+        .body = p + 27 + segments
+    };
+    return true;
+}
+
+// First page of our stream starting in [from, limit).
+static bool FindPage(const OggOpus& opus, size_t from, size_t limit, OggPage& page, bool needGranule) {
+    limit = std::min(limit, opus.size);
+    size_t offset = from;
+    while (offset + 4 <= limit) {
+        const uint8_t* hit = std::search(opus.data + offset, opus.data + limit, "OggS", "OggS" + 4);
+        if (hit == opus.data + limit)
+            return false;
+
+        offset = hit - opus.data;
+        if (!ParsePage(opus.data, opus.size, offset, page)) {
+            offset++;
+            continue;
+        }
+        if (page.serial == opus.serial && (!needGranule || page.granule != -1))
+            return true;
+        offset += page.size;
+    }
+    return false;
+}
+
+static bool LoadNextPage(OggOpus& opus) {
+    OggPage next;
+    if (!FindPage(opus, opus.page.offset + opus.page.size, opus.size, next, false))
+        return false;
+
+    opus.page = next;
+    opus.segment = 0;
+    opus.bodyPos = 0;
+
+    if (!(next.flags & PAGE_CONTINUED)) {
+        // the rest of a packet we were putting together never showed up
+        opus.packet.clear();
+    } else if (opus.packet.empty()) {
+        // the start of this one was before wherever we started reading
+        uint8_t lace = 255;
+        while (opus.segment < next.segments && lace == 255) {
+            lace = next.lacing[opus.segment++];
+            opus.bodyPos += lace;
+        }
+    }
+    return true;
+}
+
+// Zero-length packets are skipped, libopus would take them as a loss
+// and conceal a whole MAX_PACKET_FRAMES.
+static bool NextPacket(OggOpus& opus, const uint8_t*& packet, size_t& bytes) {
+    while (true) {
+        if (opus.segment >= opus.page.segments) {
+            if (opus.ended || (opus.page.flags & PAGE_LAST) || !LoadNextPage(opus)) {
+                opus.ended = true;
+                return false;
+            }
+            continue;
+        }
+
+        const size_t start = opus.bodyPos;
+        uint8_t lace = 255;
+        while (opus.segment < opus.page.segments && lace == 255) {
+            lace = opus.page.lacing[opus.segment++];
+            opus.bodyPos += lace;
+        }
+
+        const uint8_t* piece = opus.page.body + start;
+        const size_t pieceBytes = opus.bodyPos - start;
+        if (lace == 255) {
+            // carries on into the next page
+            opus.packet.insert(opus.packet.end(), piece, piece + pieceBytes);
+            continue;
+        }
+
+        if (opus.packet.empty()) {
+            if (pieceBytes == 0)
+                continue;
+            packet = piece;
+            bytes = pieceBytes;
+            return true;
+        }
+
+        opus.packet.insert(opus.packet.end(), piece, piece + pieceBytes);
+        opus.joined.swap(opus.packet);
+        opus.packet.clear();
+        packet = opus.joined.data();
+        bytes = opus.joined.size();
+        return true;
+    }
+}
+
+bool IsOggOpus(const uint8_t* data, size_t size) {
+    if (size < 27 || std::memcmp(data, "OggS", 4) != 0)
+        return false;
+
+    const size_t body = 27 + data[26];
+    return size >= body + 8 && std::memcmp(data + body, "OpusHead", 8) == 0;
+}
+
+bool OpenOggOpus(OggOpus& opus, const uint8_t* data, size_t size) {
+    opus = OggOpus{};
+    opus.data = data;
+    opus.size = size;
+
+    if (!IsOggOpus(data, size) || !ParsePage(data, size, 0, opus.page) || !(opus.page.flags & PAGE_FIRST))
+        return false;
+    opus.serial = opus.page.serial;
+
+    const uint8_t* head = nullptr;
+    size_t headBytes = 0;
+    if (!NextPacket(opus, head, headBytes) || headBytes < 19 || (head[8] >> 4) != 0)
+        return false;
+
+    opus.channels = head[9];
+    opus.preSkip = LoadLE(head + 10, 2);
+    const int16_t outputGain = static_cast<int16_t>(LoadLE(head + 16, 2));  // Q7.8 dB
+
+    int streams = 1;
+    int coupled = opus.channels == 2 ? 1 : 0;
+    unsigned char stereoMapping[2] = { 0, 1 };
+    const unsigned char* mapping = stereoMapping;
+    if (head[18] == 0) {
+        if (opus.channels < 1 || opus.channels > 2)
+            return false;
+    } else {
+        if (opus.channels < 1 || headBytes < 21u + opus.channels)
+            return false;
+        streams = head[19];
+        coupled = head[20];
+        mapping = head + 21;
+    }
+
+    // OpusTags, we get ours from the database
+    const uint8_t* tags = nullptr;
+    size_t tagsBytes = 0;
+    if (!NextPacket(opus, tags, tagsBytes))
+        return false;
+    opus.audioStart = opus.page.offset + opus.page.size;
+
+    // The last granule position is where the audio ends. Look for it in the
+    // last 64 KiB first, there's almost always a page in there.
+    for (size_t window = 64 << 10; ; window *= 2) {
+        const size_t from = size > window ? std::max(size - window, opus.audioStart) : opus.audioStart;
+        OggPage page;
+        for (size_t offset = from; FindPage(opus, offset, size, page, true); offset = page.offset + page.size)
+            opus.endGranule = page.granule;
+        if (opus.endGranule > 0 || from == opus.audioStart)
+            break;
+    }
+    if (opus.endGranule <= opus.preSkip)
+        return false;
+
+    int err = OPUS_OK;
+    opus.decoder = opus_multistream_decoder_create(OPUS_RATE, opus.channels, streams, coupled, mapping, &err);
+    if (err != OPUS_OK || !opus.decoder) {
+        opus.decoder = nullptr;
+        return false;
+    }
+    if (outputGain != 0)
+        opus_multistream_decoder_ctl(opus.decoder, OPUS_SET_GAIN(outputGain));
+
+    opus.pcm.resize(static_cast<size_t>(MAX_PACKET_FRAMES) * opus.channels);
+    opus.dropUntil = opus.preSkip;
+    return true;
+}
+
+void CloseOggOpus(OggOpus& opus) {
+    if (opus.decoder)
+        opus_multistream_decoder_destroy(opus.decoder);
+    opus = OggOpus{};
+}
+
+// Decodes packets until one has something left after trimming.
+static bool DecodeNext(OggOpus& opus) {
+    const uint8_t* packet = nullptr;
+    size_t bytes = 0;
+    while (opus.granule < opus.endGranule && NextPacket(opus, packet, bytes)) {
+        const int n = opus_multistream_decode_float(opus.decoder, packet, static_cast<opus_int32>(bytes),
+                                                    opus.pcm.data(), MAX_PACKET_FRAMES, 0);
+        if (n <= 0)
+            continue;  // corrupt, skip it rather than stop
+
+        const uint64_t start = opus.granule;
+        opus.granule += n;
+
+        // pre-skip or seek preroll in front, the end of the last page trimmed off the back
+        const uint64_t from = std::min<uint64_t>(n, opus.dropUntil > start ? opus.dropUntil - start : 0);
+        const uint64_t to = std::min<uint64_t>(n, opus.endGranule - start);
+        if (to > from) {
+            opus.pcmPos = from;
+            opus.pcmCount = to;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t ReadOggOpus(OggOpus& opus, float* out, size_t frames) {
+    size_t done = 0;
+    while (done < frames) {
+        if (opus.pcmPos == opus.pcmCount && !DecodeNext(opus))
+            break;
+
+        const size_t n = std::min(frames - done, opus.pcmCount - opus.pcmPos);
+        std::memcpy(out + done * opus.channels, opus.pcm.data() + opus.pcmPos * opus.channels,
+                    n * opus.channels * sizeof(float));
+        opus.pcmPos += n;
+        done += n;
+    }
+    return done;
+}
+
+bool SeekOggOpus(OggOpus& opus, uint64_t frame) {
+    const uint64_t target = frame + opus.preSkip;
+    if (target > opus.endGranule)
+        return false;
+    const uint64_t goal = target > SEEK_PREROLL ? target - SEEK_PREROLL : 0;
+
+    // Narrow it down to a stretch that starts at or before the last page
+    // ending at or before `goal`...
+    size_t lo = opus.audioStart;
+    size_t hi = opus.size;
+    while (hi - lo > BISECT_STOP) {
+        const size_t mid = lo + (hi - lo) / 2;
+        OggPage page;
+        if (FindPage(opus, mid, hi, page, true) && static_cast<uint64_t>(page.granule) <= goal)
+            lo = page.offset;
+        else
+            hi = mid;
+    }
+
+    // ...then walk it
+    OggPage best;
+    bool found = false;
+    OggPage page;
+    for (size_t offset = lo; FindPage(opus, offset, opus.size, page, true); offset = page.offset + page.size) {
+        if (static_cast<uint64_t>(page.granule) > goal)
+            break;
+        best = page;
+        found = true;
+    }
+
+    opus.packet.clear();
+    opus.ended = false;
+    opus.pcmPos = 0;
+    opus.pcmCount = 0;
+    opus.dropUntil = target;
+
+    if (found) {
+        // start right after the last packet that ends on `best`
+        opus.page = best;
+        opus.segment = 0;
+        opus.bodyPos = 0;
+        size_t pos = 0;
+        for (int i = 0; i < best.segments; i++) {
+            pos += best.lacing[i];
+            if (best.lacing[i] < 255) {
+                opus.segment = i + 1;
+                opus.bodyPos = pos;
+            }
+        }
+        opus.granule = best.granule;
+    } else {
+        // before the first granule, start from the top
+        opus.page = OggPage{ .offset = opus.audioStart, .size = 0 };
+        opus.segment = 0;
+        opus.granule = 0;
+    }
+
+    opus_multistream_decoder_ctl(opus.decoder, OPUS_RESET_STATE);
+    return true;
+}
+
+uint64_t OggOpusTotalFrames(const OggOpus& opus) {
+    return opus.endGranule - opus.preSkip;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Ogg Opus (RFC 7845), decoded in place out of a mapped file.
+//
+// The Ogg side is done here, libopus only ever sees packets. Packets that
+// fit in one page (nearly all of them) are handed over as slices of the
+// mapping, only the ones split across pages get copied together.
+//
+// Opus is always decoded at 48 kHz, whatever rate the file says it was
+// encoded from, so there's nothing to resample.
+
+constexpr unsigned int OPUS_RATE = 48000;
+
+struct OpusMSDecoder;
+
+struct OggPage {
+    size_t offset = 0;            // of the "OggS"
+    size_t size = 0;              // header + body
+    int64_t granule = -1;         // -1 if no packet ends on this page
+    uint32_t serial = 0;
+    uint8_t flags = 0;
+    int segments = 0;
+    const uint8_t* lacing = nullptr;
+    const uint8_t* body = nullptr;
+};
+
+struct OggOpus {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    uint32_t serial = 0;
+    unsigned int channels = 0;
+    uint64_t preSkip = 0;
+    size_t audioStart = 0;        // first page with audio on it
+    uint64_t endGranule = 0;      // granule of the last sample
+
+    OpusMSDecoder* decoder = nullptr;
+
+    // where we are in the stream
+    OggPage page;
+    int segment = 0;              // next one to read in `page`
+    size_t bodyPos = 0;
+    bool ended = false;
+    std::vector<uint8_t> packet;  // packets that span pages get put back together here...
+    std::vector<uint8_t> joined;  // ...and handed out from here
+
+    // decoded but not yet handed out
+    std::vector<float> pcm;
+    size_t pcmPos = 0;
+    size_t pcmCount = 0;
+    uint64_t granule = 0;         // where the next packet decoded starts
+    uint64_t dropUntil = 0;       // pre-skip, or seek preroll
+};
+
+// Is this the start of an Ogg stream whose first packet is an OpusHead?
+bool IsOggOpus(const uint8_t* data, size_t size);
+
+bool OpenOggOpus(OggOpus& opus, const uint8_t* data, size_t size);
+void CloseOggOpus(OggOpus& opus);
+
+// Interleaved frames, 0 at the end of the stream.
+size_t ReadOggOpus(OggOpus& opus, float* out, size_t frames);
+// Sample accurate. Bisects on page granule positions, then decodes
+// forward from a little before `frame` so the decoder has settled.
+bool SeekOggOpus(OggOpus& opus, uint64_t frame);
+uint64_t OggOpusTotalFrames(const OggOpus& opus);
@@ -0,0 +1,194 @@
+#include "Output.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <raylib.h>
+
+using Clock = std::chrono::steady_clock;
+
+// About what raylib asks for per callback
+constexpr unsigned int SINK_PERIOD_FRAMES = 1024;
+constexpr auto SINK_IDLE = std::chrono::milliseconds(1);
+
+struct OutputState {
+    OutputConfig config;
+    unsigned int sampleRate = 0;
+    unsigned int channels = 0;
+    OutputFillFn fill = nullptr;
+    OutputReadyFn ready = nullptr;
+    std::atomic<uint64_t> frames{0};
+
+    // DEVICE
+    AudioStream stream{};
+
+    // NULL_SINK and WAV
+    std::thread sink;
+    std::atomic<bool> stop{false};
+    std::FILE* wav = nullptr;
+};
+
+OutputState g_output;
+
+// raylib's callbacks don't get a user pointer
+static void DeviceFill(void* bufferData, unsigned int frames) {
+    OutputState& o = g_output;
+    o.fill(bufferData, frames);
+    o.frames.fetch_add(frames, std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// WAV
+////////////////////////////////////////////////////////////////////////////////
+
+// Canonical RIFF header for IEEE float samples, sizes patched in on close
+struct WavHeader {
+    char riff[4];
+    uint32_t riffSize;
+    char wave[4];
+    char fmt[4];
+    uint32_t fmtSize;
+    uint16_t format;
+    uint16_t channels;
+    uint32_t sampleRate;
+    uint32_t byteRate;
+    uint16_t blockAlign;
+    uint16_t bitsPerSample;
+    char data[4];
+    uint32_t dataSize;
+};
+static_assert(sizeof(WavHeader) == 44, "WavHeader has to be packed.");
+
+static WavHeader MakeWavHeader(unsigned int sampleRate, unsigned int channels, uint64_t frames) {
+    const uint32_t dataSize = static_cast<uint32_t>(frames * channels * sizeof(float));
+    return {
+        .riff = { 'R', 'I', 'F', 'F' },
+        .riffSize = 36 + dataSize,
+        .wave = { 'W', 'A', 'V', 'E' },
+        .fmt = { 'f', 'm', 't', ' ' },
+        .fmtSize = 16,
+        .format = 3,  // WAVE_FORMAT_IEEE_FLOAT
+        .channels = static_cast<uint16_t>(channels),
+        .sampleRate = sampleRate,
+        .byteRate = static_cast<uint32_t>(sampleRate * channels * sizeof(float)),
+        .blockAlign = static_cast<uint16_t>(channels * sizeof(float)),
+        .bitsPerSample = 32,
+        .data = { 'd', 'a', 't', 'a' },
+        .dataSize = dataSize
+    };
+}
+
+static bool OpenWav(const char* path) {
+    OutputState& o = g_output;
+    o.wav = std::fopen(path, "wb");
+    if (!o.wav)
+        return false;
+
+    const WavHeader header = MakeWavHeader(o.sampleRate, o.channels, 0);
+    if (std::fwrite(&header, sizeof(header), 1, o.wav) != 1) {
+        std::fclose(o.wav);
+        o.wav = nullptr;
+        return false;
+    }
+    return true;
+}
+
+static void CloseWav() {
+    OutputState& o = g_output;
+    if (!o.wav)
+        return;
+
+    const WavHeader header = MakeWavHeader(o.sampleRate, o.channels, o.frames.load());
+    const bool ok = std::fseek(o.wav, 0, SEEK_SET) == 0 &&
+                    std::fwrite(&header, sizeof(header), 1, o.wav) == 1;
+    if (std::fclose(o.wav) != 0 || !ok)
+        std::printf("[OUTPUT] Failed to finish %s\n", o.config.wavPath);
+    o.wav = nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Sink thread, stands in for the device
+////////////////////////////////////////////////////////////////////////////////
+
+static void SinkMain() {
+    OutputState& o = g_output;
+    std::vector<float> buffer(SINK_PERIOD_FRAMES * o.channels);
+    const auto period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(SINK_PERIOD_FRAMES) / o.sampleRate));
+    auto due = Clock::now();
+
+    while (!o.stop.load(std::memory_order_acquire)) {
+        if (o.config.realtime) {
+            std::this_thread::sleep_until(due);
+            due += period;
+        } else if (o.ready && !o.ready(SINK_PERIOD_FRAMES)) {
+            std::this_thread::sleep_for(SINK_IDLE);
+            continue;
+        }
+
+        o.fill(buffer.data(), SINK_PERIOD_FRAMES);
+        if (o.wav && std::fwrite(buffer.data(), sizeof(float), buffer.size(), o.wav) != buffer.size()) {
+            std::printf("[OUTPUT] Failed to write to %s, carrying on without it\n", o.config.wavPath);
+            std::fclose(o.wav);
+            o.wav = nullptr;
+        }
+        o.frames.fetch_add(SINK_PERIOD_FRAMES, std::memory_order_relaxed);
+    }
+}
+
+bool OpenOutput(const OutputConfig& config, unsigned int sampleRate, unsigned int channels,
+                OutputFillFn fill, OutputReadyFn ready) {
+    OutputState& o = g_output;
+    o.config = config;
+    o.sampleRate = sampleRate;
+    o.channels = channels;
+    o.fill = fill;
+    o.ready = ready;
+    o.frames.store(0);
+
+    switch (config.kind) {
+    case OutputKind::DEVICE:
+        // Opened once and left running, the fill plays silence when there's nothing to play
+        o.stream = LoadAudioStream(sampleRate, 32, channels);
+        if (!IsAudioStreamValid(o.stream))
+            return false;
+        SetAudioStreamCallback(o.stream, DeviceFill);
+        PlayAudioStream(o.stream);
+        return true;
+
+    case OutputKind::WAV:
+        if (!config.wavPath || !OpenWav(config.wavPath)) {
+            std::printf("[OUTPUT] Can't write to %s\n", config.wavPath ? config.wavPath : "(no path)");
+            return false;
+        }
+        [[fallthrough]];
+
+    case OutputKind::NULL_SINK:
+        o.stop.store(false);
+        o.sink = std::thread(SinkMain);
+        return true;
+    }
+    return false;
+}
+
+void CloseOutput() {
+    OutputState& o = g_output;
+    if (IsAudioStreamValid(o.stream)) {
+        StopAudioStream(o.stream);
+        UnloadAudioStream(o.stream);
+    }
+    o.stream = {};
+
+    o.stop.store(true, std::memory_order_release);
+    if (o.sink.joinable())
+        o.sink.join();
+    CloseWav();
+}
+
+uint64_t OutputFrames() {
+    return g_output.frames.load(std::memory_order_relaxed);
+}
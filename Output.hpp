@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+// Where the player's audio ends up. Normally that's a raylib AudioStream,
+// but the rest of the chain (decode, resample, mix, DSP) doesn't care, so
+// it can also run without a device at all:
+//  - NULL_SINK throws everything away,
+//  - WAV writes it to a 32-bit float .wav file.
+// Both run the fill callback on a thread of their own, either at the same
+// pace a device would or, with `realtime` off, as fast as the player can
+// keep up. The latter is what the benchmarks use: it doesn't play the
+// silence a device would while waiting on the decoder, so the same songs
+// render to the same samples every run.
+
+enum class OutputKind {
+    DEVICE,
+    NULL_SINK,
+    WAV
+};
+
+struct OutputConfig {
+    OutputKind kind = OutputKind::DEVICE;
+    bool realtime = true;            // ignored for DEVICE, which is always
+    const char* wavPath = nullptr;   // WAV only
+};
+
+// Same as raylib's AudioCallback: fill `frames` frames of interleaved float.
+using OutputFillFn = void (*)(void* bufferData, unsigned int frames);
+// Without `realtime`, asked before every fill whether it's worth doing one
+// yet. The output idles for a bit whenever it says no.
+using OutputReadyFn = bool (*)(unsigned int frames);
+
+// DEVICE needs InitAudioDevice() to have been called, the others don't.
+bool OpenOutput(const OutputConfig& config, unsigned int sampleRate, unsigned int channels,
+                OutputFillFn fill, OutputReadyFn ready);
+void CloseOutput();
+// How much has gone out since OpenOutput, silence included.
+uint64_t OutputFrames();
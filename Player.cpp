@@ -0,0 +1,1157 @@
+#include "Player.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Decoder.hpp"
+#include "Dsp.hpp"
+#include "HeadCache.hpp"
+#include "Loudness.hpp"
+#include "MappedFile.hpp"
+#include "Mixer.hpp"
+#include "Output.hpp"
+#include "Resampler.hpp"
+#include "Ring.hpp"
+#include "SeekIndex.hpp"
+#include "Trace.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+constexpr unsigned int OUT_CHANNELS = 2;
+// The device always runs at this, anything else goes through a Resampler.
+// Opus is 48k natively, and it's what most hardware runs at anyway.
+constexpr unsigned int OUT_RATE = 48000;
+// ~1.4 s at 48k, which is how long the disk gets to stall before we drop out
+constexpr size_t PCM_RING_SIZE = 1 << 17;
+constexpr size_t CHUNK_FRAMES = 1024;
+constexpr size_t SCRATCH_FRAMES = 1024;
+// The ring gets topped up in bursts of this many chunks (~370 ms at 44.1k)
+// rather than a chunk every poll, so the decoder stays hot in cache and
+// usage can be sampled once per burst.
+constexpr size_t REFILL_CHUNKS = 16;
+// How much of the next song to ask the kernel for as soon as it's queued
+constexpr size_t NEXT_READAHEAD_BYTES = 16 << 20;
+constexpr float PREDECODE_SECONDS = 2.0f;
+constexpr auto DECODE_POLL = std::chrono::milliseconds(5);
+constexpr uint64_t NO_FRAME = UINT64_MAX;
+
+struct Track {
+    const SongEntry* song = nullptr;
+    Decoder dec;
+    uint64_t totalFrames = 0;
+
+    // Only if the file isn't at OUT_RATE. Frames, positions and lengths
+    // are all at OUT_RATE either way.
+    std::unique_ptr<Resampler> resampler;
+    std::vector<float> stereo;   // decoded, on the way into the resampler
+    bool inputDone = false;      // the decoder ran out, the resampler is draining
+
+    // The first PREDECODE_SECONDS, decoded on the loader thread (or read
+    // from the head cache), so the first chunk after a transition never
+    // touches the file.
+    std::vector<float> head;
+    size_t headPos = 0;  // in frames
+    uint64_t position = 0;
+    float gain = 1.0f;  // loudness normalization, fixed when the track is opened
+
+    // A track started from the head cache has no decoder until LOAD_SOURCE
+    // brings one (see AttachSource). Reads past the head come up short until then.
+    bool sourceReady = true;
+    uint64_t sourceFrame = 0;  // where the decoder has to start once it's here
+
+    std::vector<float> scratch;  // native channel layout
+
+    // Faults and CPU time spent opening and decoding this track,
+    // reported when it's closed.
+    IoUsage io;
+
+    ~Track();
+};
+
+Track::~Track() {
+    if (song && position > 0) {
+        constexpr double MiB = 1024.0 * 1024.0;
+        std::printf("[PLAYER] \"%s\": %ld major / %ld minor faults, %.1f of %.1f MiB paged in, %.1f ms CPU\n",
+                    song->filename.c_str(), io.majorFaults, io.minorFaults,
+                    ResidentBytes(dec.file) / MiB, dec.file.size / MiB, io.cpuMs);
+    }
+    CloseDecoder(dec);
+}
+
+enum class CommandType : uint8_t {
+    PLAY,
+    SET_NEXT,
+    PAUSE,
+    RESUME,
+    SEEK,
+    CROSSFADE
+};
+
+struct PlayerCommand {
+    CommandType type;
+    uint64_t serial;          // which PlaySong this belongs to
+    const SongEntry* song;    // PLAY/SEEK: the song, SET_NEXT: what comes next
+    const SongEntry* after;   // SET_NEXT: the song `song` comes after
+    float seconds;            // SEEK, CROSSFADE
+};
+
+enum class NoticeType : uint8_t {
+    STARTED,
+    SPLICED,
+    SEEKED,
+    ENDED
+};
+
+// Sent by the decode thread when it writes something noteworthy into the
+// ring. `frame` is where in the ring that happened, so the main thread can
+// hold on to it until the callback actually gets there.
+struct PlayerNotice {
+    NoticeType type;
+    uint64_t serial;
+    const SongEntry* song;
+    uint64_t frame;
+    uint64_t trackFrame;   // position within the song at `frame`
+    uint64_t totalFrames;
+    bool needsNext;        // the decode thread wants to know what follows `song`
+    double gapMs;          // SPLICED: silence the listener got while waiting on the next song
+};
+
+enum LoadSlot {
+    LOAD_PLAY,
+    LOAD_NEXT,
+    LOAD_SOURCE,  // the decoder for a PLAY that started from the head cache
+    LOAD_SLOT_COUNT
+};
+
+struct PlayerState {
+    // Shared with the audio callback. The ring counts samples,
+    // everything else counts frames written to/read from the ring.
+    SpscRing<float, PCM_RING_SIZE> pcm;
+    std::atomic<uint64_t> discardTo{0};      // the callback skips anything before this
+    std::atomic<bool> playing{false};        // running dry now would be an underrun
+    std::atomic<bool> paused{false};
+    std::atomic<uint64_t> underruns{0};
+    std::atomic<PlaybackTapFn> tap{nullptr};
+    std::atomic<bool> starved{false};        // an offline output is waiting on the decoder
+    // Main thread to callback, only the latest one counts
+    SpscRing<DspCoefficients, 8> dspUpdates;
+    DspChain dsp;  // audio thread only
+
+    // The callback notes when it plays the first frame of a PlaySong
+    std::atomic<uint64_t> startMark{NO_FRAME};
+    std::atomic<int64_t> startMarkAt{0};     // steady_clock ticks
+
+    SpscRing<PlayerCommand, 64> commands;
+    SpscRing<PlayerNotice, 256> notices;
+
+    // Decode thread only
+    std::thread decoder;
+    std::unique_ptr<Track> current;
+    std::unique_ptr<Track> next;
+    const SongEntry* nextSong = nullptr;
+    bool nextPending = false;   // next has been asked for but isn't open yet
+    bool nextAnswered = false;  // the main thread has said what comes after current
+    uint64_t serial = 0;
+    uint64_t written = 0;
+    float loadSeekSeconds = -1.0f;     // the PLAY load is really a seek
+    float crossfadeSeconds = 0.0f;
+    // During a crossfade `current` is the incoming song
+    // and this is the one on its way out.
+    std::unique_ptr<Track> fading;
+    uint64_t fadePos = 0;
+    uint64_t fadeLength = 0;
+    std::vector<float> fadeBuffer;
+    bool dry = false;                  // current ran out, waiting on next
+    Clock::time_point dryAt;
+    uint64_t bufferedAtDry = 0;
+
+    // Loader thread, plus the lock/wakeup shared with the decode thread.
+    // Each slot holds the latest request only; anything that finishes
+    // loading after being superseded is thrown away.
+    std::thread loader;
+    std::mutex mutex;
+    std::condition_variable loaderWake;
+    std::condition_variable decodeWake;
+    bool stop = false;
+    const SongEntry* requests[LOAD_SLOT_COUNT] = {};
+    bool requested[LOAD_SLOT_COUNT] = {};
+    uint64_t generation[LOAD_SLOT_COUNT] = {};
+    std::unique_ptr<Track> loaded[LOAD_SLOT_COUNT];
+    bool loadedReady[LOAD_SLOT_COUNT] = {};
+
+    // Main thread only
+    NextSongFn nextSongFn = nullptr;
+    uint64_t playSerial = 0;
+    std::deque<PlayerNotice> pending;
+    const SongEntry* decodingSong = nullptr;
+    const SongEntry* audibleSong = nullptr;
+    int64_t audibleStart = 0;
+    uint64_t audibleFrames = 0;
+    Clock::time_point playClickedAt;
+    float startLatencyMs = -1.0f;
+    DspSettings mainDsp = DefaultDspSettings();
+    bool mainPaused = false;
+    float mainCrossfade = 0.0f;
+    uint64_t underrunsLogged = 0;
+    PlayerTransition lastTransition;
+};
+
+PlayerState g_player;
+
+static double MsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Audio thread
+////////////////////////////////////////////////////////////////////////////////
+
+// Runs on the output's audio thread (raylib's, or a sink's, see Output.hpp).
+// No locks, no allocation, no IO.
+static void FillAudio(void* bufferData, unsigned int frames) {
+    PlayerState& p = g_player;
+    float* out = static_cast<float*>(bufferData);
+    size_t done = 0;
+
+    if (!p.paused.load(std::memory_order_acquire)) {
+        // drop whatever was written before the last play/seek
+        const uint64_t discardTo = p.discardTo.load(std::memory_order_acquire);
+        uint64_t read = p.pcm.tail.load(std::memory_order_relaxed) / OUT_CHANNELS;
+        if (read < discardTo)
+            read += p.pcm.PopSome(nullptr, (discardTo - read) * OUT_CHANNELS) / OUT_CHANNELS;
+
+        done = p.pcm.PopSome(out, frames * OUT_CHANNELS) / OUT_CHANNELS;
+
+        uint64_t mark = p.startMark.load(std::memory_order_acquire);
+        if (mark != NO_FRAME && mark < read + done) {
+            p.startMarkAt.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+            p.startMark.compare_exchange_strong(mark, NO_FRAME, std::memory_order_release);
+        }
+
+        if (done < frames && p.playing.load(std::memory_order_acquire))
+            p.underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::fill(out + done * OUT_CHANNELS, out + frames * OUT_CHANNELS, 0.0f);
+
+    // Here rather than on the decode thread so changes are heard right
+    // away, not once the ring has caught up
+    DspCoefficients update;
+    bool updated = false;
+    while (p.dspUpdates.TryPop(update))
+        updated = true;
+    if (updated)
+        p.dsp.Set(update);
+    p.dsp.Process(out, frames);
+
+    if (const PlaybackTapFn tap = p.tap.load(std::memory_order_acquire))
+        tap(out, frames);
+}
+
+// Offline outputs only. Rather than play silence while the decoder catches
+// up, they wait (and poke it), so a render comes out the same every time.
+static bool AudioReady(unsigned int frames) {
+    PlayerState& p = g_player;
+    if (p.paused.load(std::memory_order_acquire))
+        return false;
+
+    const uint64_t written = p.pcm.head.load(std::memory_order_acquire) / OUT_CHANNELS;
+    const uint64_t read = std::max(p.pcm.tail.load(std::memory_order_relaxed) / OUT_CHANNELS,
+                                   p.discardTo.load(std::memory_order_acquire));
+    const uint64_t buffered = written > read ? written - read : 0;
+    if (buffered >= frames)
+        return true;
+
+    // whatever's left of a song that has ended goes out padded with silence
+    if (!p.playing.load(std::memory_order_acquire))
+        return buffered > 0;
+
+    p.starved.store(true, std::memory_order_relaxed);
+    p.decodeWake.notify_one();
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Loader thread
+////////////////////////////////////////////////////////////////////////////////
+
+static void ToStereo(const float* in, unsigned int channels, float* out, size_t frames) {
+    if (channels == 1) {
+        for (size_t i = 0; i < frames; i++) {
+            out[2 * i] = in[i];
+            out[2 * i + 1] = in[i];
+        }
+        return;
+    }
+
+    // anything past the front pair is dropped for now
+    for (size_t i = 0; i < frames; i++) {
+        out[2 * i] = in[i * channels];
+        out[2 * i + 1] = in[i * channels + 1];
+    }
+}
+
+// Native rate, straight from the decoder.
+static size_t DecodeStereo(Track& track, float* out, size_t frames) {
+    const size_t got = ReadFrames(track.dec, track.scratch.data(), frames);
+    ToStereo(track.scratch.data(), track.dec.channels, out, got);
+    // (the head went through here too, so it already has the gain)
+    if (track.gain != 1.0f)
+        ApplyGain(out, got * OUT_CHANNELS, track.gain);
+    return got;
+}
+
+// Reads up to `frames` stereo frames at OUT_RATE, returns how many there were.
+static size_t ReadTrack(Track& track, float* out, size_t frames) {
+    size_t done = 0;
+
+    const size_t headFrames = track.head.size() / OUT_CHANNELS;
+    if (track.headPos < headFrames) {
+        const size_t n = std::min(frames, headFrames - track.headPos);
+        std::memcpy(out, track.head.data() + track.headPos * OUT_CHANNELS, n * OUT_CHANNELS * sizeof(float));
+        track.headPos += n;
+        done += n;
+    }
+
+    while (done < frames && track.sourceReady) {
+        float* dst = out + done * OUT_CHANNELS;
+        if (!track.resampler) {
+            const size_t got = DecodeStereo(track, dst, std::min(frames - done, SCRATCH_FRAMES));
+            if (got == 0)
+                break;
+            done += got;
+            continue;
+        }
+
+        done += track.resampler->Pull(dst, frames - done);
+        if (done == frames || track.inputDone)
+            break;
+
+        const size_t got = DecodeStereo(track, track.stereo.data(), SCRATCH_FRAMES);
+        if (got == 0) {
+            track.resampler->Finish();
+            track.inputDone = true;
+        } else {
+            track.resampler->Push(track.stereo.data(), got);
+        }
+    }
+
+    track.position += done;
+    return done;
+}
+
+// Puts the decoder (and resampler) where output frame `frame` comes from next.
+static bool SeekSource(Track& track, uint64_t frame) {
+    if (!track.resampler)
+        return SeekDecoder(track.dec, frame);
+
+    // back up far enough to fill the filter, so there's no click
+    uint64_t input = 0;
+    uint32_t phase = 0;
+    track.resampler->Locate(frame, input, phase);
+    const uint64_t from = input > track.resampler->History() ? input - track.resampler->History() : 0;
+    track.resampler->Reset(input - from, phase);
+    track.inputDone = false;
+    return SeekDecoder(track.dec, from);
+}
+
+static bool SeekTrack(Track& track, uint64_t frame) {
+    track.position = frame;
+
+    // the head is still good if we land inside it
+    const size_t headFrames = track.head.size() / OUT_CHANNELS;
+    track.headPos = std::min<uint64_t>(frame, headFrames);
+    track.sourceFrame = std::max<uint64_t>(frame, headFrames);
+    if (!track.sourceReady)
+        return true;  // AttachSource does it
+    return SeekSource(track, track.sourceFrame);
+}
+
+// Everything but the head, at the start of the song.
+static std::unique_ptr<Track> OpenSource(const SongEntry* song) {
+    TRACE_ZONE("OpenSource");
+    const IoUsage before = ThreadUsage();
+    auto track = std::make_unique<Track>();
+    track->song = song;
+    if (!OpenDecoder(track->dec, song->filename.c_str()))
+        return nullptr;
+
+    // first time around this is the one full scan, after that it's free
+    PrepareSeeking(track->dec, *song);
+    track->totalFrames = TotalFrames(track->dec);
+    track->scratch.resize(SCRATCH_FRAMES * track->dec.channels);
+
+    if (track->dec.sampleRate != OUT_RATE) {
+        track->resampler = std::make_unique<Resampler>(track->dec.sampleRate, OUT_RATE);
+        track->stereo.resize(SCRATCH_FRAMES * OUT_CHANNELS);
+        track->totalFrames = track->resampler->OutputFrames(track->totalFrames);
+    }
+    track->io += ThreadUsage() - before;
+    return track;
+}
+
+static std::unique_ptr<Track> OpenTrack(const SongEntry* song) {
+    TRACE_ZONE("OpenTrack");
+    auto track = OpenSource(song);
+    if (!track)
+        return nullptr;
+
+    // The gain has to be in place before anything is decoded: whatever the
+    // resampler holds past the head comes out after it, and has to match.
+    const IoUsage before = ThreadUsage();
+    track->gain = PlaybackGain(song->id);
+    std::vector<float> head(static_cast<size_t>(PREDECODE_SECONDS * OUT_RATE) * OUT_CHANNELS);
+    head.resize(ReadTrack(*track, head.data(), head.size() / OUT_CHANNELS) * OUT_CHANNELS);
+    track->position = 0;
+
+    // the cache gets it before gain, that can change by the next time
+    if (!HasHead(*song)) {
+        std::vector<float> raw;
+        const float* pcm = head.data();
+        if (track->gain != 1.0f) {
+            raw = head;
+            ApplyGain(raw.data(), raw.size(), 1.0f / track->gain);
+            pcm = raw.data();
+        }
+        StoreHead(*song, OUT_RATE, track->totalFrames, pcm, head.size() / OUT_CHANNELS);
+    }
+
+    track->head = std::move(head);
+    track->io += ThreadUsage() - before;
+    return track;
+}
+
+// Just the head, out of the head cache. The rest comes through LOAD_SOURCE.
+static std::unique_ptr<Track> CachedTrack(const SongEntry* song) {
+    TRACE_ZONE("CachedTrack");
+    const float gain = PlaybackGain(song->id);
+    CachedHead cached;
+    if (!LoadHead(*song, OUT_RATE, gain, cached))
+        return nullptr;
+
+    auto track = std::make_unique<Track>();
+    track->song = song;
+    track->gain = gain;
+    track->totalFrames = cached.totalFrames;
+    track->head = std::move(cached.pcm);
+    track->sourceReady = false;
+    track->sourceFrame = track->head.size() / OUT_CHANNELS;
+    return track;
+}
+
+static void LoaderMain() {
+    TRACE_THREAD("loader");
+    PlayerState& p = g_player;
+    std::unique_lock lock(p.mutex);
+
+    while (true) {
+        p.loaderWake.wait(lock, [&p]() {
+            return p.stop || p.requested[LOAD_PLAY] || p.requested[LOAD_NEXT] || p.requested[LOAD_SOURCE];
+        });
+        if (p.stop)
+            return;
+
+        // whatever the user just clicked goes ahead of the prefetch
+        int slot = LOAD_NEXT;
+        if (p.requested[LOAD_PLAY])
+            slot = LOAD_PLAY;
+        else if (p.requested[LOAD_SOURCE])
+            slot = LOAD_SOURCE;
+        const SongEntry* song = p.requests[slot];
+        const uint64_t generation = p.generation[slot];
+        p.requested[slot] = false;
+
+        lock.unlock();
+        const auto start = Clock::now();
+        std::unique_ptr<Track> track;
+        bool cached = false;
+        if (slot == LOAD_PLAY) {
+            track = CachedTrack(song);
+            cached = track != nullptr;
+        }
+        if (slot == LOAD_SOURCE)
+            track = OpenSource(song);
+        else if (!track)
+            track = OpenTrack(song);
+
+        if (!track) {
+            std::printf("[PLAYER] Could not open \"%s\"\n", song->filename.c_str());
+        } else {
+            std::printf("[PLAYER] Opened \"%s\"%s in %.1f ms\n", song->filename.c_str(),
+                        cached ? " from the head cache" : slot == LOAD_SOURCE ? " behind its cached head" : "",
+                        MsSince(start));
+            // the head is decoded already, get the rest coming in before the transition
+            if (slot == LOAD_NEXT)
+                ReadaheadFile(track->dec.file, NEXT_READAHEAD_BYTES);
+        }
+        lock.lock();
+
+        if (generation == p.generation[slot]) {
+            p.loaded[slot] = std::move(track);
+            p.loadedReady[slot] = true;
+            p.decodeWake.notify_one();
+
+            // it can start playing now, the decoder is next in line
+            if (cached) {
+                p.generation[LOAD_SOURCE]++;
+                p.requests[LOAD_SOURCE] = song;
+                p.requested[LOAD_SOURCE] = true;
+                p.loaded[LOAD_SOURCE].reset();
+                p.loadedReady[LOAD_SOURCE] = false;
+            }
+        }
+    }
+}
+
+static void Request(LoadSlot slot, const SongEntry* song) {
+    PlayerState& p = g_player;
+    {
+        std::lock_guard lock(p.mutex);
+        p.generation[slot]++;
+        p.requests[slot] = song;
+        p.requested[slot] = song != nullptr;
+        p.loaded[slot].reset();
+        p.loadedReady[slot] = false;
+    }
+    p.loaderWake.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Decode thread
+////////////////////////////////////////////////////////////////////////////////
+
+static void Notify(const PlayerNotice& notice) {
+    if (!g_player.notices.TryPush(notice))
+        std::printf("[PLAYER] Notice queue is full, the UI is going to be confused.\n");
+}
+
+// Everything written so far is stale, the callback skips it.
+static void Flush() {
+    PlayerState& p = g_player;
+    p.discardTo.store(p.written, std::memory_order_release);
+    p.dry = false;
+}
+
+static void DropTracks() {
+    PlayerState& p = g_player;
+    p.current.reset();
+    p.next.reset();
+    p.fading.reset();
+    p.nextSong = nullptr;
+    p.nextPending = false;
+    p.nextAnswered = false;
+    p.playing.store(false, std::memory_order_release);
+    Request(LOAD_NEXT, nullptr);
+    Request(LOAD_SOURCE, nullptr);
+}
+
+static void SetNext(const SongEntry* song) {
+    PlayerState& p = g_player;
+    p.nextAnswered = true;
+    if (song == p.nextSong)
+        return;
+
+    p.nextSong = song;
+    p.next.reset();
+    p.nextPending = song != nullptr;
+    Request(LOAD_NEXT, song);
+}
+
+static void HandleCommand(const PlayerCommand& cmd) {
+    PlayerState& p = g_player;
+
+    switch (cmd.type) {
+    case CommandType::PLAY: {
+        p.serial = cmd.serial;
+        DropTracks();
+        Flush();
+        p.loadSeekSeconds = -1.0f;
+        Request(LOAD_PLAY, cmd.song);
+    } break;
+
+    case CommandType::SET_NEXT: {
+        // if we've moved on since, a newer question is already on its way
+        if (cmd.serial == p.serial && p.current && p.current->song == cmd.after)
+            SetNext(cmd.song);
+    } break;
+
+    case CommandType::PAUSE:
+        p.paused.store(true, std::memory_order_release);
+        break;
+
+    case CommandType::RESUME:
+        p.paused.store(false, std::memory_order_release);
+        break;
+
+    case CommandType::SEEK: {
+        if (cmd.serial != p.serial)
+            break;
+
+        if (p.current && p.current->song == cmd.song) {
+            const uint64_t frame = static_cast<uint64_t>(cmd.seconds * OUT_RATE);
+            Flush();
+            // cut any fade short, seeking out of one would be weird anyway
+            p.fading.reset();
+            SeekTrack(*p.current, frame);
+            Notify({
+                .type = NoticeType::SEEKED,
+                .serial = p.serial,
+                .song = p.current->song,
+                .frame = p.written,
+                .trackFrame = frame,
+                .totalFrames = p.current->totalFrames,
+                .needsNext = false,
+                .gapMs = 0.0
+            });
+            break;
+        }
+
+        // We've already moved past it in the ring (or it ended),
+        // so it has to be opened again.
+        DropTracks();
+        Flush();
+        p.loadSeekSeconds = cmd.seconds;
+        Request(LOAD_PLAY, cmd.song);
+    } break;
+
+    case CommandType::CROSSFADE:
+        p.crossfadeSeconds = cmd.seconds;
+        break;
+    }
+}
+
+// Hands a decoder to the cache-started track it was opened for. If it
+// couldn't be opened, the track just ends after its head.
+static void AttachSource(const SongEntry* song, std::unique_ptr<Track> source) {
+    PlayerState& p = g_player;
+    for (Track* track : { p.current.get(), p.fading.get() }) {
+        if (!track || track->sourceReady || track->song != song)
+            continue;
+
+        track->sourceReady = true;
+        if (!source)
+            return;
+        track->dec = std::exchange(source->dec, Decoder{});
+        track->resampler = std::move(source->resampler);
+        track->stereo = std::move(source->stereo);
+        track->scratch = std::move(source->scratch);
+        track->io += source->io;
+        SeekSource(*track, track->sourceFrame);
+        return;
+    }
+}
+
+static void StartLoaded(std::unique_ptr<Track> play) {
+    PlayerState& p = g_player;
+    NoticeType type = NoticeType::STARTED;
+    uint64_t trackFrame = 0;
+    if (p.loadSeekSeconds >= 0.0f) {
+        type = NoticeType::SEEKED;
+        trackFrame = static_cast<uint64_t>(p.loadSeekSeconds * OUT_RATE);
+        SeekTrack(*play, trackFrame);
+        p.loadSeekSeconds = -1.0f;
+    } else {
+        p.startMark.store(p.written, std::memory_order_release);
+    }
+
+    Notify({
+        .type = type,
+        .serial = p.serial,
+        .song = play->song,
+        .frame = p.written,
+        .trackFrame = trackFrame,
+        .totalFrames = play->totalFrames,
+        .needsNext = true,
+        .gapMs = 0.0
+    });
+
+    p.current = std::move(play);
+    p.nextAnswered = false;
+    p.playing.store(true, std::memory_order_release);
+}
+
+static void TakeLoads() {
+    PlayerState& p = g_player;
+    std::unique_ptr<Track> play;
+    std::unique_ptr<Track> source;
+    const SongEntry* sourceSong = nullptr;
+    bool sourceReady = false;
+    {
+        std::lock_guard lock(p.mutex);
+        if (p.loadedReady[LOAD_SOURCE]) {
+            source = std::move(p.loaded[LOAD_SOURCE]);
+            sourceSong = p.requests[LOAD_SOURCE];
+            p.loadedReady[LOAD_SOURCE] = false;
+            sourceReady = true;
+        }
+        if (p.loadedReady[LOAD_PLAY]) {
+            play = std::move(p.loaded[LOAD_PLAY]);
+            p.loadedReady[LOAD_PLAY] = false;
+        }
+        if (p.loadedReady[LOAD_NEXT]) {
+            p.next = std::move(p.loaded[LOAD_NEXT]);
+            p.loadedReady[LOAD_NEXT] = false;
+            p.nextPending = false;
+        }
+    }
+
+    if (play)
+        StartLoaded(std::move(play));
+    if (sourceReady)
+        AttachSource(sourceSong, std::move(source));
+}
+
+// How many more frames of current to write before fading into next,
+// NO_FRAME if that isn't going to happen (yet). `length` is how long
+// the fade would be.
+static uint64_t FramesUntilFade(uint64_t& length) {
+    PlayerState& p = g_player;
+    if (p.fading || p.crossfadeSeconds <= 0.0f || !p.nextAnswered || !p.next)
+        return NO_FRAME;
+
+    const Track& cur = *p.current;
+    if (cur.position >= cur.totalFrames || p.next->totalFrames == 0)
+        return NO_FRAME;
+
+    // never more than half of either song, or short ones would be all fade
+    length = std::min({ static_cast<uint64_t>(p.crossfadeSeconds * OUT_RATE),
+                        cur.totalFrames / 2, p.next->totalFrames / 2 });
+    const uint64_t start = cur.totalFrames - length;
+    if (cur.position >= start) {
+        // next showed up late, fade over whatever is left
+        length = cur.totalFrames - cur.position;
+        return 0;
+    }
+    return start - cur.position;
+}
+
+// Next starts playing at `written + filled`, on top of current.
+static void BeginFade(size_t filled, uint64_t length) {
+    PlayerState& p = g_player;
+    Notify({
+        .type = NoticeType::SPLICED,
+        .serial = p.serial,
+        .song = p.next->song,
+        .frame = p.written + filled,
+        .trackFrame = 0,
+        .totalFrames = p.next->totalFrames,
+        .needsNext = true,
+        .gapMs = 0.0
+    });
+
+    p.fading = std::move(p.current);
+    p.fadePos = 0;
+    p.fadeLength = length;
+    p.current = std::move(p.next);
+    p.nextSong = nullptr;
+    p.nextAnswered = false;
+    p.dry = false;
+}
+
+// Mixes the fading song into `frames` frames that were just read from current.
+static void MixFading(float* out, size_t frames) {
+    PlayerState& p = g_player;
+    float* outgoing = p.fadeBuffer.data();
+    const size_t got = ReadTrack(*p.fading, outgoing, frames);
+    std::fill(outgoing + got * OUT_CHANNELS, outgoing + frames * OUT_CHANNELS, 0.0f);
+
+    const float t0 = static_cast<float>(p.fadePos) / p.fadeLength;
+    p.fadePos += frames;
+    const float t1 = static_cast<float>(p.fadePos) / p.fadeLength;
+    CrossfadeFrames(out, outgoing, frames, t0, t1);
+
+    if (p.fadePos >= p.fadeLength)
+        p.fading.reset();
+}
+
+// Decodes one chunk into the ring, moving on to the next song mid-chunk if
+// the current one runs out (or fading into it, if crossfading is on).
+// Returns false if there was nothing to write.
+static bool WriteChunk(float* out) {
+    PlayerState& p = g_player;
+    size_t filled = 0;
+
+    while (p.current && filled < CHUNK_FRAMES) {
+        // reads stop exactly where a fade starts or ends
+        size_t want = CHUNK_FRAMES - filled;
+        uint64_t fadeLength = 0;
+        const uint64_t untilFade = FramesUntilFade(fadeLength);
+        if (untilFade == 0 && fadeLength > 0) {
+            BeginFade(filled, fadeLength);
+            continue;
+        }
+        if (untilFade != NO_FRAME)
+            want = std::min<uint64_t>(want, untilFade);
+        if (p.fading)
+            want = std::min<uint64_t>(want, p.fadeLength - p.fadePos);
+
+        float* dst = out + filled * OUT_CHANNELS;
+        const size_t got = ReadTrack(*p.current, dst, want);
+        if (p.fading)
+            MixFading(dst, got);
+        filled += got;
+        if (got == want)
+            continue;
+
+        // started from the head cache and the decoder isn't here yet
+        if (!p.current->sourceReady)
+            break;
+
+        // current ran dry
+        if (!p.dry) {
+            p.dry = true;
+            p.dryAt = Clock::now();
+            p.bufferedAtDry = p.pcm.Size() / OUT_CHANNELS + filled;
+        }
+
+        // still waiting to hear what's next, or for it to open
+        if (!p.nextAnswered || p.nextPending)
+            break;
+
+        if (!p.next) {
+            Notify({
+                .type = NoticeType::ENDED,
+                .serial = p.serial,
+                .song = p.current->song,
+                .frame = p.written + filled,
+                .trackFrame = p.current->totalFrames,
+                .totalFrames = p.current->totalFrames,
+                .needsNext = false,
+                .gapMs = 0.0
+            });
+            p.current.reset();
+            p.playing.store(false, std::memory_order_release);
+            break;
+        }
+
+        const double waitedMs = MsSince(p.dryAt);
+        const double bufferedMs = 1000.0 * p.bufferedAtDry / OUT_RATE;
+        Notify({
+            .type = NoticeType::SPLICED,
+            .serial = p.serial,
+            .song = p.next->song,
+            .frame = p.written + filled,
+            .trackFrame = 0,
+            .totalFrames = p.next->totalFrames,
+            .needsNext = true,
+            .gapMs = std::max(0.0, waitedMs - bufferedMs)
+        });
+
+        p.current = std::move(p.next);
+        p.fading.reset();
+        p.nextSong = nullptr;
+        p.nextAnswered = false;
+        p.dry = false;
+    }
+
+    if (filled == 0)
+        return false;
+
+    p.pcm.PushSome(out, filled * OUT_CHANNELS);
+    p.written += filled;
+    return true;
+}
+
+static void DecodeMain() {
+    PlayerState& p = g_player;
+    std::vector<float> chunk(CHUNK_FRAMES * OUT_CHANNELS);
+    p.fadeBuffer.resize(CHUNK_FRAMES * OUT_CHANNELS);
+
+    std::unique_lock lock(p.mutex);
+    while (!p.stop) {
+        lock.unlock();
+        p.starved.store(false, std::memory_order_relaxed);
+
+        PlayerCommand cmd;
+        while (p.commands.TryPop(cmd))
+            HandleCommand(cmd);
+
+        TakeLoads();
+
+        if (PCM_RING_SIZE - p.pcm.Size() >= REFILL_CHUNKS * CHUNK_FRAMES * OUT_CHANNELS) {
+            const IoUsage before = ThreadUsage();
+            while (PCM_RING_SIZE - p.pcm.Size() >= CHUNK_FRAMES * OUT_CHANNELS && WriteChunk(chunk.data()))
+                ;
+            // whatever faded out or ended mid-burst gets counted against what's playing now
+            if (p.current)
+                p.current->io += ThreadUsage() - before;
+        }
+
+        lock.lock();
+        // Nothing wakes us up when the callback frees up space, polling is
+        // plenty with a ring this deep. Offline outputs can't wait that long.
+        p.decodeWake.wait_for(lock, DECODE_POLL, [&p]() {
+            return p.stop || p.commands.Size() > 0 || p.starved.load(std::memory_order_relaxed) ||
+                   p.loadedReady[LOAD_PLAY] || p.loadedReady[LOAD_NEXT] || p.loadedReady[LOAD_SOURCE];
+        });
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Main thread
+////////////////////////////////////////////////////////////////////////////////
+
+static void Send(const PlayerCommand& cmd) {
+    PlayerState& p = g_player;
+    if (!p.commands.TryPush(cmd)) {
+        std::printf("[PLAYER] Command queue is full, dropping a command.\n");
+        return;
+    }
+    p.decodeWake.notify_one();
+}
+
+static uint64_t FramesRead() {
+    return g_player.pcm.tail.load(std::memory_order_acquire) / OUT_CHANNELS;
+}
+
+bool InitPlayer(NextSongFn nextSong, const OutputConfig& output) {
+    PlayerState& p = g_player;
+    p.nextSongFn = nextSong;
+    p.stop = false;
+
+    p.dsp.Set(MakeDspCoefficients(p.mainDsp, OUT_RATE));
+
+    if (!OpenOutput(output, OUT_RATE, OUT_CHANNELS, FillAudio, AudioReady)) {
+        std::printf("[PLAYER] Failed to open the audio output.\n");
+        return false;
+    }
+
+    p.loader = std::thread(LoaderMain);
+    p.decoder = std::thread(DecodeMain);
+    return true;
+}
+
+void SetPlaybackTap(PlaybackTapFn tap) {
+    g_player.tap.store(tap, std::memory_order_release);
+}
+
+unsigned int PlayerSampleRate() {
+    return OUT_RATE;
+}
+
+void ShutdownPlayer() {
+    PlayerState& p = g_player;
+    {
+        std::lock_guard lock(p.mutex);
+        p.stop = true;
+    }
+    p.loaderWake.notify_all();
+    p.decodeWake.notify_all();
+    if (p.decoder.joinable())
+        p.decoder.join();
+    if (p.loader.joinable())
+        p.loader.join();
+
+    CloseOutput();
+
+    p.current.reset();
+    p.next.reset();
+    p.fading.reset();
+    for (auto& track : p.loaded)
+        track.reset();
+
+    const uint64_t underruns = p.underruns.load();
+    if (underruns > 0)
+        std::printf("[PLAYER] %llu underruns this session.\n", static_cast<unsigned long long>(underruns));
+}
+
+void PlaySong(const SongEntry& song) {
+    PlayerState& p = g_player;
+
+    // anything still in flight from the old song is ignored from here on
+    p.playSerial++;
+    p.playClickedAt = Clock::now();
+    p.pending.clear();
+    p.decodingSong = nullptr;
+    p.audibleSong = nullptr;
+
+    Send({ .type = CommandType::PLAY, .serial = p.playSerial, .song = &song, .after = nullptr, .seconds = 0.0f });
+}
+
+void PausePlayer() {
+    PlayerState& p = g_player;
+    p.mainPaused = true;
+    Send({ .type = CommandType::PAUSE, .serial = p.playSerial, .song = nullptr, .after = nullptr, .seconds = 0.0f });
+}
+
+void ResumePlayer() {
+    PlayerState& p = g_player;
+    p.mainPaused = false;
+    Send({ .type = CommandType::RESUME, .serial = p.playSerial, .song = nullptr, .after = nullptr, .seconds = 0.0f });
+}
+
+void SeekPlayer(float seconds) {
+    PlayerState& p = g_player;
+    if (!p.audibleSong)
+        return;
+
+    seconds = std::clamp(seconds, 0.0f, PlayerDuration());
+    // anything still queued up is about to be skipped over
+    p.pending.clear();
+    p.decodingSong = p.audibleSong;
+
+    Send({ .type = CommandType::SEEK, .serial = p.playSerial, .song = p.audibleSong, .after = nullptr, .seconds = seconds });
+}
+
+void SetCrossfade(float seconds) {
+    PlayerState& p = g_player;
+    p.mainCrossfade = std::clamp(seconds, 0.0f, MAX_CROSSFADE_SECONDS);
+    Send({ .type = CommandType::CROSSFADE, .serial = p.playSerial, .song = nullptr, .after = nullptr, .seconds = p.mainCrossfade });
+}
+
+float PlayerCrossfade() {
+    return g_player.mainCrossfade;
+}
+
+void SetPlayerDsp(const DspSettings& settings) {
+    PlayerState& p = g_player;
+    p.mainDsp = settings;
+    if (!p.dspUpdates.TryPush(MakeDspCoefficients(settings, OUT_RATE)))
+        std::printf("[PLAYER] DSP queue is full, dropping a change.\n");
+}
+
+const DspSettings& PlayerDsp() {
+    return g_player.mainDsp;
+}
+
+void RefreshNextSong() {
+    PlayerState& p = g_player;
+    if (!p.decodingSong || !p.nextSongFn)
+        return;
+
+    Send({
+        .type = CommandType::SET_NEXT,
+        .serial = p.playSerial,
+        .song = p.nextSongFn(p.decodingSong),
+        .after = p.decodingSong,
+        .seconds = 0.0f
+    });
+}
+
+// From PlaySong to the callback playing the first frame. If the callback
+// hasn't noted the time yet (it's a little behind FramesRead), now is close.
+static float StartLatencyMs() {
+    const PlayerState& p = g_player;
+    Clock::time_point heard(Clock::duration(p.startMarkAt.load(std::memory_order_relaxed)));
+    if (heard < p.playClickedAt)
+        heard = Clock::now();
+    return std::chrono::duration<float, std::milli>(heard - p.playClickedAt).count();
+}
+
+PlayerEvent UpdatePlayer() {
+    PlayerState& p = g_player;
+    const auto start = Clock::now();
+
+    PlayerNotice notice;
+    while (p.notices.TryPop(notice)) {
+        if (notice.serial != p.playSerial)
+            continue;
+
+        // The decode thread is waiting on this, so answer now
+        // rather than when the song actually becomes audible.
+        if (notice.needsNext) {
+            p.decodingSong = notice.song;
+            RefreshNextSong();
+        }
+        p.pending.push_back(notice);
+    }
+
+    const uint64_t underruns = p.underruns.load(std::memory_order_relaxed);
+    if (underruns != p.underrunsLogged) {
+        std::printf("[PLAYER] Underrun (%llu so far)\n", static_cast<unsigned long long>(underruns));
+        p.underrunsLogged = underruns;
+    }
+
+    // At most one event per call, the rest get picked up next frame.
+    while (!p.pending.empty() && FramesRead() >= p.pending.front().frame) {
+        notice = p.pending.front();
+        p.pending.pop_front();
+
+        switch (notice.type) {
+        case NoticeType::STARTED:
+            p.audibleSong = notice.song;
+            p.audibleStart = notice.frame;
+            p.audibleFrames = notice.totalFrames;
+            p.startLatencyMs = StartLatencyMs();
+            std::printf("[PLAYER] Started \"%s\" %.1f ms after the click, hitch %.2f ms\n",
+                        notice.song->filename.c_str(), p.startLatencyMs, MsSince(start));
+            return PlayerEvent::STARTED;
+
+        case NoticeType::SPLICED:
+            p.lastTransition = {
+                .frames = static_cast<uint64_t>(static_cast<int64_t>(notice.frame) - p.audibleStart),
+                .gapMs = notice.gapMs,
+                .hitchMs = MsSince(start)
+            };
+            p.audibleSong = notice.song;
+            p.audibleStart = notice.frame;
+            p.audibleFrames = notice.totalFrames;
+            std::printf("[PLAYER] Continued into \"%s\", gap %.1f ms, hitch %.2f ms\n",
+                        notice.song->filename.c_str(), notice.gapMs, p.lastTransition.hitchMs);
+            return PlayerEvent::ADVANCED;
+
+        case NoticeType::SEEKED:
+            p.audibleSong = notice.song;
+            p.audibleStart = static_cast<int64_t>(notice.frame) - static_cast<int64_t>(notice.trackFrame);
+            p.audibleFrames = notice.totalFrames;
+            break;
+
+        case NoticeType::ENDED:
+            p.lastTransition = {
+                .frames = static_cast<uint64_t>(static_cast<int64_t>(notice.frame) - p.audibleStart),
+                .gapMs = 0.0,
+                .hitchMs = MsSince(start)
+            };
+            return PlayerEvent::FINISHED;
+        }
+    }
+
+    return PlayerEvent::NONE;
+}
+
+const SongEntry* PlayerSong() {
+    return g_player.audibleSong;
+}
+
+float PlayerTime() {
+    const PlayerState& p = g_player;
+    if (!p.audibleSong)
+        return 0.0f;
+
+    const int64_t frames = std::clamp<int64_t>(static_cast<int64_t>(FramesRead()) - p.audibleStart,
+                                               0, p.audibleFrames);
+    return static_cast<float>(frames) / OUT_RATE;
+}
+
+float PlayerDuration() {
+    const PlayerState& p = g_player;
+    if (!p.audibleSong)
+        return 0.0f;
+    return static_cast<float>(p.audibleFrames) / OUT_RATE;
+}
+
+bool PlayerPaused() {
+    return g_player.mainPaused;
+}
+
+const PlayerTransition& PlayerLastTransition() {
+    return g_player.lastTransition;
+}
+
+float PlayerStartLatencyMs() {
+    return g_player.startLatencyMs;
+}
+
+uint64_t PlayerUnderruns() {
+    return g_player.underruns.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Data.hpp"
+#include "Dsp.hpp"
+#include "Output.hpp"
+
+// Playback on top of a raw raylib AudioStream instead of Music, or with no
+// device at all (see Output.hpp).
+//
+// Three threads are involved:
+//  - the main thread sends commands and hears back about what happened,
+//  - a decode thread owns the decoders and keeps a PCM ring topped up,
+//  - the output's audio thread runs our callback, which only ever reads the ring.
+// Commands and notices go through lock-free queues as well, so neither the
+// render loop nor the audio callback ever waits on decoding or file IO.
+// A slow frame can't cause a dropout anymore, only a slow disk can.
+//
+// Tracks are opened (and their first couple of seconds decoded) on a loader
+// thread. When the current track runs out, the decode thread continues with
+// the next one in the middle of the same chunk, so the transition is sample
+// accurate. The stream always runs at 48 kHz, anything else goes through a
+// Resampler (see Resampler.hpp) on the decode thread, so a change of sample
+// rate between tracks doesn't mean a gap anymore.
+//
+// With crossfading on, the next track instead starts that many seconds
+// before the current one ends and the two are mixed with equal-power
+// curves (see Mixer.hpp). That's still on the decode thread, so the
+// callback doesn't know or care.
+//
+// Everything here is to be called from the main thread only.
+
+enum class PlayerEvent {
+    NONE,
+    STARTED,   // a PlaySong request is now audible
+    ADVANCED,  // the current song ran into the next one
+    FINISHED   // the current song ended with nothing queued after it
+};
+
+// Sees every buffer the device plays (silence included), on the audio
+// thread, as interleaved stereo at PlayerSampleRate(). It has to be as
+// careful as the callback itself: no locks, no allocation, no IO.
+using PlaybackTapFn = void (*)(const float* frames, size_t count);
+
+// Asked (on the main thread) what to play once `after` is done.
+// Returning nullptr stops playback at the end of `after`.
+using NextSongFn = const SongEntry* (*)(const SongEntry* after);
+
+constexpr float MAX_CROSSFADE_SECONDS = 12.0f;
+
+// Fails if the output can't be opened.
+bool InitPlayer(NextSongFn nextSong, const OutputConfig& output = {});
+void ShutdownPlayer();
+// nullptr takes it off again
+void SetPlaybackTap(PlaybackTapFn tap);
+unsigned int PlayerSampleRate();
+
+// Goes quiet right away and starts `song` as soon as it's been opened.
+// Songs handed to the player (here or from NextSongFn) must outlive playback.
+void PlaySong(const SongEntry& song);
+void PausePlayer();
+void ResumePlayer();
+// Within the song that's currently audible.
+void SeekPlayer(float seconds);
+// 0 turns crossfading off (transitions are gapless then).
+// Applies from the next transition on.
+void SetCrossfade(float seconds);
+float PlayerCrossfade();
+// Preamp, EQ and limiter, see Dsp.hpp. Heard within a callback's worth
+// of audio, crossfaded so nothing clicks.
+void SetPlayerDsp(const DspSettings& settings);
+const DspSettings& PlayerDsp();
+// Asks NextSongFn again, for when the queue changes under the player.
+void RefreshNextSong();
+
+// Picks up what the other threads did. Call once per frame.
+PlayerEvent UpdatePlayer();
+
+// The song that is currently audible, which isn't necessarily the one
+// being decoded right around a transition.
+const SongEntry* PlayerSong();
+float PlayerTime();
+float PlayerDuration();
+bool PlayerPaused();
+// From the last PlaySong to its first sample coming out of the callback,
+// -1 before the first one.
+float PlayerStartLatencyMs();
+// Callbacks that ran out of samples while a song was supposed to be playing.
+uint64_t PlayerUnderruns();
+
+// What the last ADVANCED or FINISHED looked like. `frames` is how much of
+// the song before it was heard (at PlayerSampleRate(), up to where the next
+// one came in), `hitchMs` is how long that UpdatePlayer call took.
+struct PlayerTransition {
+    uint64_t frames = 0;
+    double gapMs = 0.0;
+    double hitchMs = 0.0;
+};
+const PlayerTransition& PlayerLastTransition();
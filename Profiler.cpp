@@ -0,0 +1,154 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+
+#include <raylib.h>
+#include <sqlite3.h>
+
+constexpr int PHASE_COUNT = static_cast<int>(FramePhase::COUNT);
+constexpr int OVERLAY_FONT_SIZE = 10;
+constexpr int OVERLAY_LINE = 12;
+constexpr int OVERLAY_NAME_WIDTH = 70;
+constexpr int OVERLAY_COLUMN_WIDTH = 44;
+constexpr int OVERLAY_WIDTH = OVERLAY_NAME_WIDTH + OVERLAY_COLUMN_WIDTH * 4 + 8;
+constexpr int GRAPH_HEIGHT = 60;
+constexpr float GRAPH_MAX_MS = 50.0f;  // anything slower just hits the top
+constexpr float TARGET_FRAME_MS = 1000.0f / 60.0f;
+
+struct ProfilerState {
+    std::array<FrameProfile, PROFILER_WINDOW> frames{};
+    size_t count = 0;  // total ever recorded, the ring wraps
+    sqlite3_int64 sqliteNs = 0;
+};
+
+ProfilerState g_profiler;
+
+static int SqliteTrace(unsigned int type, void*, void*, void* x) {
+    if (type == SQLITE_TRACE_PROFILE)
+        g_profiler.sqliteNs += *static_cast<sqlite3_int64*>(x);
+    return 0;
+}
+
+void ProfileSqlite(sqlite3* db) {
+    sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, SqliteTrace, nullptr);
+}
+
+float TakeSqliteMs() {
+    const float ms = g_profiler.sqliteNs / 1e6f;
+    g_profiler.sqliteNs = 0;
+    return ms;
+}
+
+void RecordFrame(const FrameProfile& frame) {
+    ProfilerState& p = g_profiler;
+    p.frames[p.count % PROFILER_WINDOW] = frame;
+    p.count++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Overlay
+////////////////////////////////////////////////////////////////////////////////
+
+struct Spread {
+    float last, p50, p99, max;
+};
+
+// Over the whole window
+template <typename Fn>
+static Spread SpreadOf(Fn&& value) {
+    const ProfilerState& p = g_profiler;
+    const size_t count = std::min(p.count, PROFILER_WINDOW);
+    std::array<float, PROFILER_WINDOW> sorted;
+    for (size_t i = 0; i < count; i++)
+        sorted[i] = value(p.frames[i]);
+    std::sort(sorted.begin(), sorted.begin() + count);
+
+    // nearest rank
+    const auto at = [&](float q) {
+        const size_t rank = static_cast<size_t>(std::ceil(q * count));
+        return sorted[std::clamp<size_t>(rank, 1, count) - 1];
+    };
+    return {
+        .last = value(p.frames[(p.count - 1) % PROFILER_WINDOW]),
+        .p50 = at(0.50f),
+        .p99 = at(0.99f),
+        .max = sorted[count - 1]
+    };
+}
+
+static void DrawRow(int x, int y, const char* name, const Spread& spread) {
+    DrawText(name, x, y, OVERLAY_FONT_SIZE, WHITE);
+    const float values[] = { spread.last, spread.p50, spread.p99, spread.max };
+    for (int c = 0; c < 4; c++) {
+        char text[16];
+        std::snprintf(text, sizeof(text), "%.2f", values[c]);
+        DrawText(text, x + OVERLAY_NAME_WIDTH + OVERLAY_COLUMN_WIDTH * c, y, OVERLAY_FONT_SIZE, WHITE);
+    }
+}
+
+void DrawProfilerOverlay() {
+    static constexpr const char* phaseNames[] = { "input", "state", "layout*", "render", "present", "wait" };
+    static constexpr const char* headers[] = { "last", "p50", "p99", "max" };
+    static_assert(std::size(phaseNames) == PHASE_COUNT);
+
+    const ProfilerState& p = g_profiler;
+    if (p.count == 0)
+        return;
+
+    const int rows = 1 + PHASE_COUNT + 2 + 4;
+    const int height = OVERLAY_LINE * rows + GRAPH_HEIGHT + 16;
+    const int x = GetScreenWidth() - OVERLAY_WIDTH - 8;
+    int y = 8;
+    DrawRectangle(x, y, OVERLAY_WIDTH, height, Color{ 0, 0, 0, 200 });
+    const int left = x + 4;
+    y += 4;
+
+    DrawText("ms", left, y, OVERLAY_FONT_SIZE, LIGHTGRAY);
+    for (int c = 0; c < 4; c++)
+        DrawText(headers[c], left + OVERLAY_NAME_WIDTH + OVERLAY_COLUMN_WIDTH * c, y, OVERLAY_FONT_SIZE, LIGHTGRAY);
+    y += OVERLAY_LINE;
+
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        DrawRow(left, y, phaseNames[i], SpreadOf([i](const FrameProfile& f) { return f.phaseMs[i]; }));
+        y += OVERLAY_LINE;
+    }
+    DrawRow(left, y, "sqlite", SpreadOf([](const FrameProfile& f) { return f.sqliteMs; }));
+    y += OVERLAY_LINE;
+    DrawRow(left, y, "frame", SpreadOf([](const FrameProfile& f) { return f.frameMs; }));
+    y += OVERLAY_LINE;
+
+    // the renderer's counters, for the last frame
+    const RenderStats& r = p.frames[(p.count - 1) % PROFILER_WINDOW].render;
+    const int lookups = r.textCacheHits + r.textCacheMisses;
+    char line[96];
+    std::snprintf(line, sizeof(line), "%d commands, %d draws, %d glyphs", r.commands, r.draws, r.glyphs);
+    DrawText(line, left, y, OVERLAY_FONT_SIZE, WHITE);
+    y += OVERLAY_LINE;
+    if (lookups > 0)
+        std::snprintf(line, sizeof(line), "text cache %d/%d hits (%.0f%%)", r.textCacheHits, lookups,
+                      100.0f * r.textCacheHits / lookups);
+    else
+        std::snprintf(line, sizeof(line), "text cache unused");
+    DrawText(line, left, y, OVERLAY_FONT_SIZE, WHITE);
+    y += OVERLAY_LINE;
+    std::snprintf(line, sizeof(line), "canvas upload %.0f KiB", r.uploadBytes / 1024.0);
+    DrawText(line, left, y, OVERLAY_FONT_SIZE, WHITE);
+    y += OVERLAY_LINE;
+    DrawText("* overlaps render and present", left, y, OVERLAY_FONT_SIZE, LIGHTGRAY);
+    y += OVERLAY_LINE + 4;
+
+    // Frame times, newest on the right, with a line at 60 fps
+    const int graphWidth = std::min<int>(PROFILER_WINDOW, OVERLAY_WIDTH - 8);
+    const size_t shown = std::min<size_t>(p.count, graphWidth);
+    for (size_t i = 0; i < shown; i++) {
+        const float ms = p.frames[(p.count - shown + i) % PROFILER_WINDOW].frameMs;
+        const int barHeight = std::max(1, static_cast<int>(std::min(ms / GRAPH_MAX_MS, 1.0f) * GRAPH_HEIGHT));
+        const Color color = ms > TARGET_FRAME_MS * 1.5f ? RED : GREEN;
+        DrawRectangle(left + graphWidth - shown + i, y + GRAPH_HEIGHT - barHeight, 1, barHeight, color);
+    }
+    const int targetY = y + GRAPH_HEIGHT - static_cast<int>(TARGET_FRAME_MS / GRAPH_MAX_MS * GRAPH_HEIGHT);
+    DrawRectangle(left, targetY, graphWidth, 1, LIGHTGRAY);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+
+#include "Renderer.hpp"
+
+struct sqlite3;
+
+// The frame profiler overlay (P): time per main loop phase, what the
+// renderer did and how long the main thread sat in sqlite, for the last
+// frame and as p50/p99/max over the last PROFILER_WINDOW frames, plus a
+// graph of recent frame times.
+//
+// Collecting is a few clock reads and counters per frame, so it's always
+// on. Only drawing the overlay costs anything. Main thread only.
+
+constexpr size_t PROFILER_WINDOW = 240;  // 4 s at 60 fps
+
+enum class FramePhase {
+    INPUT,    // phase 1
+    STATE,    // phase 2
+    LAYOUT,   // on the layout thread, overlapping RENDER and PRESENT
+    RENDER,   // up to the draw calls being submitted
+    PRESENT,  // EndDrawing: swap and the frame limiter
+    WAIT,     // for the layout thread after presenting
+    COUNT
+};
+
+struct FrameProfile {
+    float frameMs;  // the whole loop iteration
+    float phaseMs[static_cast<int>(FramePhase::COUNT)];
+    float sqliteMs;
+    RenderStats render;
+};
+
+// Counts the time spent stepping statements on `db` from then on.
+// Only meant for the main thread's connection.
+void ProfileSqlite(sqlite3* db);
+// Since the last call
+float TakeSqliteMs();
+
+void RecordFrame(const FrameProfile& frame);
+// Top-right corner of the window, raylib's font
+void DrawProfilerOverlay();
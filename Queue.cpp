@@ -0,0 +1,422 @@
+#include "Queue.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "Library.hpp"
+#include "Trace.hpp"
+#include "WriteBehind.hpp"
+
+constexpr size_t CHUNK_SIZE = 1024;
+constexpr size_t HISTORY_LIMIT = 1000;
+
+struct QueueChunk {
+    size_t count = 0;
+    EntityId songs[CHUNK_SIZE];
+    int64_t keys[CHUNK_SIZE];
+};
+
+struct QueueState {
+    std::vector<std::unique_ptr<QueueChunk>> chunks;
+    size_t size = 0;
+    size_t current = NO_INDEX;
+    size_t answered = NO_INDEX;  // what QueueNextSong handed out last
+    RepeatMode repeat = RepeatMode::OFF;
+
+    sqlite3* db = nullptr;
+    // node-based, so the pointers given to the player stay put
+    std::unordered_map<EntityId, SongEntry> songs;
+};
+
+QueueState g_queue;
+
+////////////////////////////////////////////////////////////////////////////////
+// Chunked storage
+////////////////////////////////////////////////////////////////////////////////
+
+struct Slot {
+    size_t chunk;
+    size_t offset;
+};
+
+// Only valid for index < size.
+static Slot Locate(size_t index) {
+    size_t chunk = 0;
+    while (index >= g_queue.chunks[chunk]->count) {
+        index -= g_queue.chunks[chunk]->count;
+        chunk++;
+    }
+    return { chunk, index };
+}
+
+static EntityId SongAt(size_t index) {
+    const Slot slot = Locate(index);
+    return g_queue.chunks[slot.chunk]->songs[slot.offset];
+}
+
+static int64_t KeyAt(size_t index) {
+    const Slot slot = Locate(index);
+    return g_queue.chunks[slot.chunk]->keys[slot.offset];
+}
+
+static void InsertRaw(size_t index, EntityId song, int64_t key) {
+    QueueState& q = g_queue;
+
+    if (q.chunks.empty() || (index == q.size && q.chunks.back()->count == CHUNK_SIZE))
+        q.chunks.push_back(std::make_unique<QueueChunk>());
+
+    Slot slot = index == q.size ? Slot{ q.chunks.size() - 1, q.chunks.back()->count } : Locate(index);
+    QueueChunk* chunk = q.chunks[slot.chunk].get();
+
+    // full chunk in the middle: split it in half rather than spill over
+    if (chunk->count == CHUNK_SIZE) {
+        auto upper = std::make_unique<QueueChunk>();
+        constexpr size_t half = CHUNK_SIZE / 2;
+        std::copy(chunk->songs + half, chunk->songs + CHUNK_SIZE, upper->songs);
+        std::copy(chunk->keys + half, chunk->keys + CHUNK_SIZE, upper->keys);
+        upper->count = CHUNK_SIZE - half;
+        chunk->count = half;
+
+        q.chunks.insert(q.chunks.begin() + slot.chunk + 1, std::move(upper));
+        if (slot.offset > half) {
+            slot = { slot.chunk + 1, slot.offset - half };
+            chunk = q.chunks[slot.chunk].get();
+        }
+    }
+
+    std::copy_backward(chunk->songs + slot.offset, chunk->songs + chunk->count, chunk->songs + chunk->count + 1);
+    std::copy_backward(chunk->keys + slot.offset, chunk->keys + chunk->count, chunk->keys + chunk->count + 1);
+    chunk->songs[slot.offset] = song;
+    chunk->keys[slot.offset] = key;
+    chunk->count++;
+    q.size++;
+
+    if (q.current != NO_INDEX && q.current >= index)
+        q.current++;
+    if (q.answered != NO_INDEX && q.answered >= index)
+        q.answered++;
+}
+
+static void RemoveRaw(size_t index) {
+    QueueState& q = g_queue;
+
+    const Slot slot = Locate(index);
+    QueueChunk* chunk = q.chunks[slot.chunk].get();
+    std::copy(chunk->songs + slot.offset + 1, chunk->songs + chunk->count, chunk->songs + slot.offset);
+    std::copy(chunk->keys + slot.offset + 1, chunk->keys + chunk->count, chunk->keys + slot.offset);
+    chunk->count--;
+    q.size--;
+
+    if (chunk->count == 0)
+        q.chunks.erase(q.chunks.begin() + slot.chunk);
+
+    // removing the current song makes the one after it current
+    if (q.current != NO_INDEX && (q.current > index || q.current == q.size))
+        q.current = q.current == 0 ? NO_INDEX : q.current - 1;
+    if (q.answered == index)
+        q.answered = NO_INDEX;
+    else if (q.answered != NO_INDEX && q.answered > index)
+        q.answered--;
+}
+
+// Drops everything from `index` on.
+static void TruncateRaw(size_t index) {
+    QueueState& q = g_queue;
+    while (q.size > index) {
+        QueueChunk* last = q.chunks.back().get();
+        const size_t drop = std::min(last->count, q.size - index);
+        last->count -= drop;
+        q.size -= drop;
+        if (last->count == 0)
+            q.chunks.pop_back();
+    }
+
+    if (q.current != NO_INDEX && q.current >= index)
+        q.current = NO_INDEX;
+    if (q.answered != NO_INDEX && q.answered >= index)
+        q.answered = NO_INDEX;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Persistence
+////////////////////////////////////////////////////////////////////////////////
+
+static void Respace() {
+    int64_t key = POSITION_GAP;
+    for (auto& chunk : g_queue.chunks) {
+        for (size_t i = 0; i < chunk->count; i++, key += POSITION_GAP)
+            chunk->keys[i] = key;
+    }
+    RecordQueueRespace(POSITION_GAP);
+}
+
+// A key that sorts between the items at index - 1 and index.
+static int64_t KeyFor(size_t index) {
+    const QueueState& q = g_queue;
+    int64_t prev = index > 0 ? KeyAt(index - 1) : 0;
+    if (index == q.size)
+        return prev + POSITION_GAP;
+
+    int64_t next = KeyAt(index);
+    if (next - prev < 2) {
+        Respace();
+        prev = static_cast<int64_t>(index) * POSITION_GAP;
+        next = prev + POSITION_GAP;
+    }
+    return prev + (next - prev) / 2;
+}
+
+static void SaveState() {
+    const QueueState& q = g_queue;
+    RecordQueueState(q.current == NO_INDEX ? -1 : KeyAt(q.current), static_cast<int>(q.repeat));
+}
+
+static void TrimHistory() {
+    QueueState& q = g_queue;
+    while (q.current != NO_INDEX && q.current > HISTORY_LIMIT) {
+        RecordQueueRemove(KeyAt(0));
+        RemoveRaw(0);
+    }
+}
+
+int LoadQueue(sqlite3* db) {
+    TRACE_ZONE("LoadQueue");
+    QueueState& q = g_queue;
+    q.db = db;
+
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt, "SELECT songId, position FROM queue_items ORDER BY position;");
+    if (err != SQLITE_OK) return err;
+
+    while ((err = sqlite3_step(stmt)) == SQLITE_ROW)
+        InsertRaw(q.size, sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1));
+    sqlite3_finalize(stmt);
+    if (err != SQLITE_DONE) return err;
+
+    err = PrepareQuery(db, &stmt, "SELECT current, repeat FROM queue_state;");
+    if (err != SQLITE_OK) return err;
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const int64_t currentKey = sqlite3_column_int64(stmt, 0);
+        q.repeat = static_cast<RepeatMode>(sqlite3_column_int(stmt, 1));
+
+        size_t index = 0;
+        for (const auto& chunk : q.chunks) {
+            const int64_t* found = std::find(chunk->keys, chunk->keys + chunk->count, currentKey);
+            if (found != chunk->keys + chunk->count) {
+                q.current = index + (found - chunk->keys);
+                break;
+            }
+            index += chunk->count;
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    std::printf("[QUEUE] Restored %zu songs.\n", q.size);
+    return SQLITE_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Queue operations
+////////////////////////////////////////////////////////////////////////////////
+
+static const SongEntry* GetSong(EntityId id) {
+    QueueState& q = g_queue;
+    auto it = q.songs.find(id);
+    if (it != q.songs.end())
+        return &it->second;
+
+    SongEntry song;
+    if (LoadSong(q.db, id, song) != SQLITE_OK)
+        return nullptr;
+    return &q.songs.emplace(id, std::move(song)).first->second;
+}
+
+size_t QueueSize() {
+    return g_queue.size;
+}
+
+size_t QueueCurrentIndex() {
+    return g_queue.current;
+}
+
+EntityId QueueAt(size_t index) {
+    return SongAt(index);
+}
+
+const SongEntry* QueueCurrentSong() {
+    if (g_queue.current == NO_INDEX)
+        return nullptr;
+    return GetSong(SongAt(g_queue.current));
+}
+
+void QueueReplace(std::span<const EntityId> songs) {
+    QueueState& q = g_queue;
+
+    const size_t cut = q.current == NO_INDEX ? q.size : q.current;
+    if (cut < q.size) {
+        RecordQueueTruncate(KeyAt(cut));
+        TruncateRaw(cut);
+    }
+
+    const int64_t firstKey = (q.size > 0 ? KeyAt(q.size - 1) : 0) + POSITION_GAP;
+    for (size_t i = 0; i < songs.size(); i++)
+        InsertRaw(q.size, songs[i], firstKey + static_cast<int64_t>(i) * POSITION_GAP);
+    RecordQueueAppend(firstKey, POSITION_GAP, std::vector<EntityId>(songs.begin(), songs.end()));
+
+    q.current = songs.empty() ? NO_INDEX : cut;
+    q.answered = NO_INDEX;
+    TrimHistory();
+    SaveState();
+}
+
+void QueueEnqueue(EntityId song) {
+    QueueState& q = g_queue;
+    const int64_t key = KeyFor(q.size);
+    InsertRaw(q.size, song, key);
+    RecordQueueInsert(key, song);
+
+    if (q.current == NO_INDEX) {
+        q.current = q.size - 1;
+        SaveState();
+    }
+}
+
+void QueuePlayNext(EntityId song) {
+    QueueState& q = g_queue;
+    if (q.current == NO_INDEX) {
+        QueueEnqueue(song);
+        return;
+    }
+
+    const size_t index = q.current + 1;
+    const int64_t key = KeyFor(index);
+    InsertRaw(index, song, key);
+    RecordQueueInsert(key, song);
+}
+
+void QueueRemove(size_t index) {
+    QueueState& q = g_queue;
+    if (index >= q.size)
+        return;
+
+    const bool wasCurrent = index == q.current;
+    RecordQueueRemove(KeyAt(index));
+    RemoveRaw(index);
+    if (wasCurrent)
+        SaveState();
+}
+
+void QueueMove(size_t from, size_t to) {
+    QueueState& q = g_queue;
+    if (from >= q.size || to >= q.size || from == to)
+        return;
+
+    const EntityId song = SongAt(from);
+    const bool wasCurrent = q.current == from;
+    const bool wasAnswered = q.answered == from;
+
+    // As far as the database is concerned this is a delete and an insert,
+    // so a renumbering in between can't get the two out of sync.
+    RecordQueueRemove(KeyAt(from));
+    RemoveRaw(from);
+    const int64_t key = KeyFor(to);
+    InsertRaw(to, song, key);
+    RecordQueueInsert(key, song);
+
+    if (wasCurrent)
+        q.current = to;
+    if (wasAnswered)
+        q.answered = to;
+    SaveState();
+}
+
+bool QueuePrevious() {
+    QueueState& q = g_queue;
+    if (q.current == NO_INDEX || q.current == 0)
+        return false;
+
+    q.current--;
+    q.answered = NO_INDEX;
+    SaveState();
+    return true;
+}
+
+bool QueueSkip() {
+    QueueState& q = g_queue;
+    if (q.current == NO_INDEX || q.current + 1 >= q.size)
+        return false;
+
+    q.current++;
+    q.answered = NO_INDEX;
+    TrimHistory();
+    SaveState();
+    return true;
+}
+
+void QueueSetRepeat(RepeatMode mode) {
+    g_queue.repeat = mode;
+    SaveState();
+}
+
+RepeatMode QueueRepeat() {
+    return g_queue.repeat;
+}
+
+static size_t NextIndex(size_t from) {
+    const QueueState& q = g_queue;
+    switch (q.repeat) {
+    case RepeatMode::ONE:
+        return from;
+    case RepeatMode::ALL:
+        return (from + 1) % q.size;
+    case RepeatMode::OFF:
+        break;
+    }
+    return from + 1 < q.size ? from + 1 : NO_INDEX;
+}
+
+const SongEntry* QueueNextSong(const SongEntry* after) {
+    QueueState& q = g_queue;
+
+    // The player asks again after every transition, and also whenever the
+    // queue changes. Either way it's asking about the newest song it has.
+    size_t from = q.current;
+    if (q.answered != NO_INDEX && after && after->id == SongAt(q.answered))
+        from = q.answered;
+    if (from == NO_INDEX)
+        return nullptr;
+
+    q.answered = NextIndex(from);
+    if (q.answered == NO_INDEX)
+        return nullptr;
+    return GetSong(SongAt(q.answered));
+}
+
+void QueueFollow(const SongEntry* song) {
+    QueueState& q = g_queue;
+    if (!song)
+        return;
+
+    // almost always what we handed out last, but the queue
+    // may have changed under the player in the meantime
+    size_t found = NO_INDEX;
+    if (q.answered != NO_INDEX && SongAt(q.answered) == song->id)
+        found = q.answered;
+    else if (q.current != NO_INDEX && q.current + 1 < q.size && SongAt(q.current + 1) == song->id)
+        found = q.current + 1;
+    else if (q.current != NO_INDEX && SongAt(q.current) == song->id)
+        found = q.current;
+
+    for (size_t i = 0; found == NO_INDEX && i < q.size; i++) {
+        if (SongAt(i) == song->id)
+            found = i;
+    }
+
+    q.current = found;
+    TrimHistory();
+    SaveState();
+}
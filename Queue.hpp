@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include <sqlite3.h>
+
+#include "Data.hpp"
+
+// The play queue.
+//
+// Songs that have been played stay in the queue ahead of the current one,
+// which is all "history" is (QueuePrevious walks back into it). Only the
+// HISTORY_LIMIT most recent ones are kept.
+//
+// The queue only holds song ids, in fixed-size chunks, so a 50k song queue
+// is under a megabyte and appending never moves more than one chunk.
+// Inserting/removing shifts at most one chunk. SongEntry metadata is loaded
+// the first time a song is actually needed and cached from then on.
+//
+// Each item also carries a sparse position key, same idea as playlist
+// positions (see POSITION_GAP), and every change is written to queue_items
+// through the write-behind thread as the one or two rows it touches.
+//
+// Main thread only.
+
+enum class RepeatMode : uint8_t {
+    OFF,
+    ALL,
+    ONE
+};
+
+constexpr size_t NO_INDEX = SIZE_MAX;
+
+// Reads back whatever was queued last session.
+int LoadQueue(sqlite3* db);
+
+size_t QueueSize();
+size_t QueueCurrentIndex();
+EntityId QueueAt(size_t index);
+
+// nullptr if the queue is empty or the song has vanished from the library
+const SongEntry* QueueCurrentSong();
+
+// Throws out the current song and everything after it,
+// and puts `songs` there instead. The first one becomes current.
+void QueueReplace(std::span<const EntityId> songs);
+void QueueEnqueue(EntityId song);
+// Right after the current song.
+void QueuePlayNext(EntityId song);
+void QueueRemove(size_t index);
+void QueueMove(size_t from, size_t to);
+
+// Moves the current song back/forward by one, ignoring the repeat mode.
+bool QueuePrevious();
+bool QueueSkip();
+
+void QueueSetRepeat(RepeatMode mode);
+RepeatMode QueueRepeat();
+
+// For the player (see NextSongFn): what to play after `after`,
+// which is either the current song or the last one this returned.
+const SongEntry* QueueNextSong(const SongEntry* after);
+// The player moved on to `song` by itself.
+void QueueFollow(const SongEntry* song);
@@ -1,5 +1,6 @@
 #include "Renderer.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
@@ -14,6 +15,7 @@
 #include "Casts.hpp"
 #include "LayoutElements.hpp"
 #include "TextUtils.hpp"
+#include "Trace.hpp"
 
 struct TextCanvas {
     int width;
@@ -27,6 +29,7 @@ struct TextCanvas {
 // also needs ownership of the strings
 std::unordered_map<std::string, TGAImage> g_renderedText;
 TextCanvas g_canvas;
+RenderStats g_renderStats;
 
 void InitRenderer(int screenWidth, int screenHeight) {
     g_canvas.width = screenWidth;
@@ -62,7 +65,8 @@ bool IsASCII(Clay_StringSlice str) {
 //       Thus the burden falls on us to know when Clay will wrap
 //       and we must adjust our measure accordingly.
 Clay_Dimensions MeasureText(Clay_StringSlice text, Clay_TextElementConfig*, void* userData) {
-    auto& textCtx = *reinterpret_cast<TextRenderContext*>(userData);
+    TRACE_ZONE("MeasureText");
+    auto& textCtx = *reinterpret_cast<TextMeasureContext*>(userData);
 
     raqm_clear_contents(textCtx.rq);
     raqm_set_text_utf8(textCtx.rq, text.chars, text.length);
@@ -90,7 +94,7 @@ Clay_Dimensions MeasureText(Clay_StringSlice text, Clay_TextElementConfig*, void
 #pragma GCC diagnostic ignored "-Wnarrowing"
     return {
         .width = width,
-        .height = textCtx.atlas.GetMaxHeight()  // this is already in pixels
+        .height = textCtx.lineHeight  // this is already in pixels
     };
 #pragma GCC diagnostic pop
 }
@@ -131,14 +135,20 @@ void DrawTextASCII(TextRenderContext& textCtx, Clay_StringSlice str, int x, int
         DrawTextureRec(tex, glyphSlice, pos, WHITE);
         x += glyphs[i].x_advance >> 6; 
     }
+    g_renderStats.glyphs += count;
+    g_renderStats.draws += count;
 }
 
 void DrawTextUTF8(TextRenderContext& textCtx, Clay_StringSlice str, int x, int y) {
+    TRACE_ZONE("DrawTextUTF8");
     std::string copyPain(str.chars, str.length);
     auto it = g_renderedText.find(copyPain);
     if (it == g_renderedText.end()) {
         auto pair = g_renderedText.insert({copyPain, RenderText(copyPain, textCtx)});
         it = pair.first;
+        g_renderStats.textCacheMisses++;
+    } else {
+        g_renderStats.textCacheHits++;
     }
 
     const int scissorX = static_cast<int>(g_canvas.scissor.x);
@@ -167,9 +177,79 @@ void DrawTextUTF8(TextRenderContext& textCtx, Clay_StringSlice str, int x, int y
     }
 } 
 
+// One column per pixel, each showing the loudest bucket that falls in it.
+// Hovering previews where a click would land.
+static void DrawWaveform(const CustomElement& element, const Clay_BoundingBox& bb) {
+    const auto& waveform = element.waveform;
+    const int width = static_cast<int>(bb.width);
+    if (width <= 0 || waveform.count == 0)
+        return;
+
+    const Vector2 mouse = GetMousePosition();
+    const bool hovered = CheckCollisionPointRec(mouse, { bb.x, bb.y, bb.width, bb.height });
+    const float hoverX = mouse.x - bb.x;
+
+    const float mid = bb.y + bb.height * 0.5f;
+    const float halfHeight = bb.height * 0.5f;
+    const float playedX = waveform.progress * bb.width;
+
+    for (int x = 0; x < width; x++) {
+        const int first = static_cast<int>(static_cast<int64_t>(x) * waveform.count / width);
+        const int last = std::max(first + 1, static_cast<int>(static_cast<int64_t>(x + 1) * waveform.count / width));
+
+        int lo = 0, hi = 0, rms = 0;
+        for (int b = first; b < last && b < waveform.count; b++) {
+            lo = std::min<int>(lo, waveform.buckets[b].min);
+            hi = std::max<int>(hi, waveform.buckets[b].max);
+            rms = std::max<int>(rms, waveform.buckets[b].rms);
+        }
+
+        Color peak{ 100, 100, 100, 255 };
+        Color body{ 140, 140, 140, 255 };
+        if (x < playedX) {
+            peak = Color{ 200, 200, 200, 255 };
+            body = Color{ 255, 255, 255, 255 };
+        } else if (hovered && x < hoverX) {
+            peak = Color{ 130, 130, 130, 255 };
+            body = Color{ 180, 180, 180, 255 };
+        }
+
+        // peaks are -127..127, RMS is 0..255
+        const float top = mid - hi / 127.0f * halfHeight;
+        const float bottom = mid - lo / 127.0f * halfHeight;
+        const float rmsHeight = rms / 255.0f * halfHeight;
+        DrawRectangleRec({ bb.x + x, top, 1.0f, std::max(1.0f, bottom - top) }, peak);
+        DrawRectangleRec({ bb.x + x, mid - rmsHeight, 1.0f, std::max(1.0f, 2.0f * rmsHeight) }, body);
+    }
+    g_renderStats.draws += 2 * width;
+
+    if (hovered) {
+        DrawRectangleRec({ mouse.x, bb.y, 1.0f, bb.height }, Color{ 255, 255, 255, 255 });
+        g_renderStats.draws++;
+    }
+}
+
+// Bars fill the element bottom up, with a pixel between each.
+static void DrawSpectrum(const CustomElement& element, const Clay_BoundingBox& bb) {
+    const auto& spectrum = element.spectrum;
+    if (spectrum.count == 0 || bb.width < spectrum.count)
+        return;
+
+    const float step = bb.width / spectrum.count;
+    for (int b = 0; b < spectrum.count; b++) {
+        const float height = std::max(1.0f, spectrum.bars[b] * bb.height);
+        const float x = bb.x + b * step;
+        DrawRectangleRec({ x, bb.y + bb.height - height, std::max(1.0f, step - 1.0f), height },
+                         Color{ 200, 200, 200, 255 });
+    }
+    g_renderStats.draws += spectrum.count;
+}
+
 // I really don't foresee the bounds-checked get being necessary here.
 // (If I become a Rust dev in the next 5 years I'll eat my Suisei plushie)
 void RenderFrame(Clay_RenderCommandArray cmds, TextRenderContext& textCtx) {
+    TRACE_ZONE("RenderFrame");
+    g_renderStats = { .commands = cmds.length };
     std::memset(g_canvas.data, 0, g_canvas.size);
     g_canvas.scissor = {
         .x = 0,
@@ -203,6 +283,7 @@ void RenderFrame(Clay_RenderCommandArray cmds, TextRenderContext& textCtx) {
                 tint = Color{ 255, 255, 255, 255 };
             // DrawRectangle(bb.x, bb.y, bb.width, bb.height, RED);
             DrawTextureEx(imageTexture, origin, 0, scale, tint);
+            g_renderStats.draws++;
         } break;
 
         case CLAY_RENDER_COMMAND_TYPE_SCISSOR_START: {
@@ -227,6 +308,7 @@ void RenderFrame(Clay_RenderCommandArray cmds, TextRenderContext& textCtx) {
             } else {
                 DrawRectangleRec(rect, color);
             }
+            g_renderStats.draws++;
         } break;
 
         // NOTE: borders are drawn IN the main rect, not outside of it
@@ -286,6 +368,7 @@ void RenderFrame(Clay_RenderCommandArray cmds, TextRenderContext& textCtx) {
                      90.0f, 180.0f, 10, color);
             DrawRing(bottomRight, corner.bottomRight - width.bottom, corner.bottomRight,
                      0.1f, 90.0f, 10, color);
+            g_renderStats.draws += 8;
         } break;
 
         case CLAY_RENDER_COMMAND_TYPE_CUSTOM: {
@@ -305,6 +388,17 @@ void RenderFrame(Clay_RenderCommandArray cmds, TextRenderContext& textCtx) {
                 } else {
                     DrawRectangleRec(rect, color);
                 }
+                g_renderStats.draws++;
+            } break;
+            case CustomElement::Type::WAVEFORM: {
+                DrawRectangleRec({ bb.x, bb.y, bb.width, bb.height }, casts::raylib::Color(custom.backgroundColor));
+                g_renderStats.draws++;
+                DrawWaveform(customData, bb);
+            } break;
+            case CustomElement::Type::SPECTRUM: {
+                DrawRectangleRec({ bb.x, bb.y, bb.width, bb.height }, casts::raylib::Color(custom.backgroundColor));
+                g_renderStats.draws++;
+                DrawSpectrum(customData, bb);
             } break;
             default: {
                 std::printf("Unhandled custom render command.\n");
@@ -320,4 +414,10 @@ void RenderFrame(Clay_RenderCommandArray cmds, TextRenderContext& textCtx) {
 
     UpdateTexture(g_canvas.texture, g_canvas.data);
     DrawTexture(g_canvas.texture, 0, 0, WHITE);
+    g_renderStats.uploadBytes += g_canvas.size;
+    g_renderStats.draws++;
+}
+
+const RenderStats& LastRenderStats() {
+    return g_renderStats;
 }
@@ -8,13 +8,31 @@
 
 #include <raylib.h>
 
+#include <cstddef>
+
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
 #include "TextUtils.hpp"
 
+// What the last RenderFrame did, for the profiler overlay
+struct RenderStats {
+    int commands;
+    int draws;            // raylib draw calls, before rlgl batches them
+    int glyphs;           // ASCII glyphs drawn out of the atlas
+    int textCacheHits;    // UTF-8 strings that were already rasterized
+    int textCacheMisses;
+    size_t uploadBytes;   // the UTF-8 text canvas goes up every frame
+};
+
 void InitRenderer(int screenWidth, int screenHeight);
-// userData should be a pointer to TextRenderContext
+// userData should be a pointer to TextMeasureContext
 Clay_Dimensions MeasureText(Clay_StringSlice text, Clay_TextElementConfig* config, void* userData);
 void RenderFrame(Clay_RenderCommandArray cmds, TextRenderContext& textCtx);
+const RenderStats& LastRenderStats();
+
+// The text paths on their own, RenderFrame picks between them.
+// Out here for bench/BenchText.cpp.
+bool IsASCII(Clay_StringSlice str);
+void DrawTextUTF8(TextRenderContext& textCtx, Clay_StringSlice str, int x, int y);
 
@@ -0,0 +1,173 @@
+#include "Resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <numbers>
+#include <numeric>
+
+#include "Simd.hpp"
+
+// Per side, when not downsampling. Downsampling stretches the filter by
+// the same factor to keep the transition band the same width in Hz.
+constexpr size_t BASE_HALF_TAPS = 32;
+constexpr double KAISER_BETA = 8.6;
+
+struct FilterBank {
+    uint32_t up;
+    uint32_t down;
+    size_t half;
+    std::vector<float> taps;  // `up` phases of 2 * half
+};
+
+// Zeroth order modified Bessel function, for the window
+static double BesselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static std::shared_ptr<const FilterBank> BuildBank(uint32_t up, uint32_t down) {
+    auto bank = std::make_shared<FilterBank>();
+    bank->up = up;
+    bank->down = down;
+
+    const size_t stretch = (down + up - 1) / up;
+    bank->half = BASE_HALF_TAPS * std::max<size_t>(1, stretch);
+    const size_t taps = 2 * bank->half;
+    const double half = static_cast<double>(bank->half);
+
+    // Everything in cycles per input frame. The stopband starts at the
+    // lower Nyquist, the passband ends a transition width before that.
+    const double nyquist = 0.5 * std::min(1.0, static_cast<double>(up) / down);
+    const double transition = (KAISER_BETA / 0.1102 + 8.7 - 7.95) / (14.36 * taps);
+    const double cutoff = nyquist - transition / 2.0;
+    const double windowNorm = BesselI0(KAISER_BETA);
+
+    bank->taps.resize(up * taps);
+    for (uint32_t phase = 0; phase < up; phase++) {
+        float* h = &bank->taps[phase * taps];
+        double sum = 0.0;
+        std::vector<double> row(taps);
+        for (size_t j = 0; j < taps; j++) {
+            // distance from the output time to the input frame under tap j
+            const double t = static_cast<double>(j) - (half - 1.0) - static_cast<double>(phase) / up;
+            const double x = 2.0 * cutoff * t;
+            const double sinc = t == 0.0 ? 1.0 : std::sin(std::numbers::pi * x) / (std::numbers::pi * x);
+            const double r = t / half;
+            const double window = r * r < 1.0 ? BesselI0(KAISER_BETA * std::sqrt(1.0 - r * r)) / windowNorm : 0.0;
+            row[j] = 2.0 * cutoff * sinc * window;
+            sum += row[j];
+        }
+        // every phase passes DC at exactly 1, or the phases beat against each other
+        for (size_t j = 0; j < taps; j++)
+            h[j] = static_cast<float>(row[j] / sum);
+    }
+    return bank;
+}
+
+// Built the first time a rate pair shows up, kept for good after that.
+static std::shared_ptr<const FilterBank> GetBank(uint32_t up, uint32_t down) {
+    static std::mutex mutex;
+    static std::vector<std::shared_ptr<const FilterBank>> banks;
+
+    std::lock_guard lock(mutex);
+    for (const auto& bank : banks) {
+        if (bank->up == up && bank->down == down)
+            return bank;
+    }
+    return banks.emplace_back(BuildBank(up, down));
+}
+
+Resampler::Resampler(unsigned int inRate, unsigned int outRate) {
+    const unsigned int common = std::gcd(inRate, outRate);
+    m_up = outRate / common;
+    m_down = inRate / common;
+    m_bank = GetBank(m_up, m_down);
+    m_half = m_bank->half;
+    Reset();
+}
+
+void Resampler::Reset(uint64_t lead, uint32_t phase) {
+    m_left.assign(m_half - 1, 0.0f);
+    m_right.assign(m_half - 1, 0.0f);
+    m_pos = m_half - 1 + lead;
+    m_phase = phase;
+    m_end = SIZE_MAX;
+}
+
+void Resampler::Push(const float* frames, size_t count) {
+    const size_t start = m_left.size();
+    m_left.resize(start + count);
+    m_right.resize(start + count);
+    for (size_t i = 0; i < count; i++) {
+        m_left[start + i] = frames[2 * i];
+        m_right[start + i] = frames[2 * i + 1];
+    }
+}
+
+void Resampler::Finish() {
+    m_end = m_left.size();
+    m_left.resize(m_end + m_half, 0.0f);
+    m_right.resize(m_end + m_half, 0.0f);
+}
+
+size_t Resampler::Pull(float* out, size_t frames) {
+    const size_t taps = 2 * m_half;
+    size_t done = 0;
+
+    while (done < frames && m_pos < m_end && m_pos + m_half < m_left.size()) {
+        const float* h = &m_bank->taps[m_phase * taps];
+        const float* l = &m_left[m_pos + 1 - m_half];
+        const float* r = &m_right[m_pos + 1 - m_half];
+
+        f32x4 accL = Splat4(0.0f);
+        f32x4 accR = Splat4(0.0f);
+        for (size_t j = 0; j < taps; j += 4) {
+            const f32x4 c = Load4(h + j);
+            accL += c * Load4(l + j);
+            accR += c * Load4(r + j);
+        }
+        out[2 * done] = Sum4(accL);
+        out[2 * done + 1] = Sum4(accR);
+        done++;
+
+        m_phase += m_down;
+        m_pos += m_phase / m_up;
+        m_phase %= m_up;
+    }
+
+    Compact();
+    return done;
+}
+
+// Drops input nothing is going to look at again
+void Resampler::Compact() {
+    const size_t keepFrom = std::min(m_pos, m_left.size()) + 1 - m_half;
+    if (keepFrom < 4096)
+        return;
+
+    m_left.erase(m_left.begin(), m_left.begin() + keepFrom);
+    m_right.erase(m_right.begin(), m_right.begin() + keepFrom);
+    m_pos -= keepFrom;
+    if (m_end != SIZE_MAX)
+        m_end -= keepFrom;
+}
+
+void Resampler::Locate(uint64_t frame, uint64_t& inputFrame, uint32_t& phase) const {
+    const uint64_t t = frame * m_down;
+    inputFrame = t / m_up;
+    phase = static_cast<uint32_t>(t % m_up);
+}
+
+uint64_t Resampler::OutputFrames(uint64_t inputFrames) const {
+    return (inputFrames * m_up + m_down - 1) / m_down;
+}
+
+size_t Resampler::History() const {
+    return m_half - 1;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Polyphase windowed-sinc resampling, interleaved stereo in and out.
+//
+// With the rates reduced to in:out = M:L, output frame k lands on input
+// time k*M/L. The fractional part of that picks one of L filter phases,
+// and the output is that phase's taps dotted with the input around it.
+// The filters are Kaiser windowed sincs cutting off just under the lower
+// of the two Nyquist frequencies, about 85 dB down by the time they get
+// there. Each bank is built once per rate pair and shared by every
+// resampler using it.
+
+struct FilterBank;
+
+class Resampler {
+ public:
+    Resampler(unsigned int inRate, unsigned int outRate);
+
+    // Starts over. The first output frame lands `lead` frames plus
+    // phase/L after the first frame pushed. Whatever came before the
+    // first frame pushed counts as silence.
+    void Reset(uint64_t lead = 0, uint32_t phase = 0);
+    void Push(const float* frames, size_t count);
+    // No more input is coming, the output stops where the input did.
+    void Finish();
+    // Returns how many frames were written, fewer than `frames`
+    // once it needs more input (or after Finish, when it's done).
+    size_t Pull(float* out, size_t frames);
+
+    // Where output frame `frame` lands in the input, for seeking.
+    void Locate(uint64_t frame, uint64_t& inputFrame, uint32_t& phase) const;
+    uint64_t OutputFrames(uint64_t inputFrames) const;
+    // How many frames before the one it's centred on a filter looks at.
+    // Seek that far back and pass it as `lead` for a seamless start.
+    size_t History() const;
+
+ private:
+    void Compact();
+
+    std::shared_ptr<const FilterBank> m_bank;
+    uint32_t m_up;     // L
+    uint32_t m_down;   // M
+    size_t m_half;     // taps on each side
+
+    std::vector<float> m_left;   // input, one channel each
+    std::vector<float> m_right;
+    size_t m_pos = 0;            // input frame at or just before the next output
+    uint32_t m_phase = 0;
+    size_t m_end = SIZE_MAX;     // where the input stopped, after Finish
+};
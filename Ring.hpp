@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+// Single-producer single-consumer ring buffer.
+// Exactly one thread may push and exactly one (other) thread may pop.
+// Neither side ever blocks or allocates, a full ring just refuses the push.
+template <typename T, size_t Capacity>
+struct SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two.");
+
+    T items[Capacity];
+    // free-running counters, wrapped on access
+    // (on separate cache lines so the two threads don't fight over them)
+    alignas(64) std::atomic<size_t> head{0};  // written by the producer
+    alignas(64) std::atomic<size_t> tail{0};  // written by the consumer
+
+    bool TryPush(const T& item) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        items[h & (Capacity - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& out) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return false;
+
+        out = items[t & (Capacity - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Bulk versions for sample data. These move as much as fits/is there
+    // and return how many items that was.
+    size_t PushSome(const T* src, size_t count) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        count = std::min(count, Capacity - (h - tail.load(std::memory_order_acquire)));
+
+        const size_t start = h & (Capacity - 1);
+        const size_t first = std::min(count, Capacity - start);
+        std::copy(src, src + first, items + start);
+        std::copy(src + first, src + count, items);
+
+        head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    // Passing nullptr just throws the items away.
+    size_t PopSome(T* dst, size_t count) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        count = std::min(count, head.load(std::memory_order_acquire) - t);
+
+        if (dst) {
+            const size_t start = t & (Capacity - 1);
+            const size_t first = std::min(count, Capacity - start);
+            std::copy(items + start, items + start + first, dst);
+            std::copy(items, items + (count - first), dst + first);
+        }
+
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+    // Approximate unless called from one of the two owning threads.
+    size_t Size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+};
@@ -0,0 +1,128 @@
+#include "SeekIndex.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "Library.hpp"
+#include "MappedFile.hpp"
+
+static_assert(sizeof(SeekPoint) == 24, "Seek points are stored as raw structs.");
+
+struct SeekIndexState {
+    std::mutex mutex;  // guards everything below
+    sqlite3* db = nullptr;
+    sqlite3_stmt* select = nullptr;
+    sqlite3_stmt* insert = nullptr;
+};
+
+SeekIndexState g_seekIndexes;
+
+bool OpenSeekIndexes(const char* dbPath) {
+    SeekIndexState& s = g_seekIndexes;
+    std::lock_guard lock(s.mutex);
+
+    int err = sqlite3_open_v2(dbPath, &s.db, SQLITE_OPEN_READWRITE, nullptr);
+    if (err == SQLITE_OK) {
+        sqlite3_busy_timeout(s.db, 1000);
+        err = PrepareQuery(s.db, &s.select, "SELECT totalFrames, points FROM seek_indexes "
+                                                      "WHERE songId = ? AND sourceSize = ? AND sourceMtimeNs = ?;");
+    }
+    if (err == SQLITE_OK)
+        err = PrepareQuery(s.db, &s.insert,
+            "INSERT OR REPLACE INTO seek_indexes(songId, sourceSize, sourceMtimeNs, totalFrames, points) "
+            "VALUES (?, ?, ?, ?, ?);");
+
+    if (err != SQLITE_OK) {
+        std::printf("[SEEK INDEX] %s\n", sqlite3_errmsg(s.db));
+        sqlite3_finalize(s.select);
+        sqlite3_finalize(s.insert);
+        sqlite3_close(s.db);
+        s.db = nullptr;
+        s.select = nullptr;
+        s.insert = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void CloseSeekIndexes() {
+    SeekIndexState& s = g_seekIndexes;
+    std::lock_guard lock(s.mutex);
+    sqlite3_finalize(s.select);
+    sqlite3_finalize(s.insert);
+    sqlite3_close(s.db);
+    s.db = nullptr;
+    s.select = nullptr;
+    s.insert = nullptr;
+}
+
+// Only finds an index built from a file of this size and mtime
+static bool LoadSeekIndex(EntityId song, uint64_t size, int64_t mtimeNs,
+                          std::vector<SeekPoint>& points, uint64_t& totalFrames) {
+    SeekIndexState& s = g_seekIndexes;
+    std::lock_guard lock(s.mutex);
+    if (!s.db)
+        return false;
+
+    bool found = false;
+    sqlite3_bind_int64(s.select, 1, song);
+    sqlite3_bind_int64(s.select, 2, size);
+    sqlite3_bind_int64(s.select, 3, mtimeNs);
+    if (sqlite3_step(s.select) == SQLITE_ROW) {
+        const auto* blob = static_cast<const SeekPoint*>(sqlite3_column_blob(s.select, 1));
+        const int bytes = sqlite3_column_bytes(s.select, 1);
+        totalFrames = sqlite3_column_int64(s.select, 0);
+        if (bytes % sizeof(SeekPoint) == 0) {
+            points.assign(blob, blob + bytes / sizeof(SeekPoint));
+            found = true;
+        }
+    }
+    sqlite3_reset(s.select);
+    return found;
+}
+
+static void StoreSeekIndex(EntityId song, uint64_t size, int64_t mtimeNs,
+                           const std::vector<SeekPoint>& points, uint64_t totalFrames) {
+    SeekIndexState& s = g_seekIndexes;
+    std::lock_guard lock(s.mutex);
+    if (!s.db)
+        return;
+
+    sqlite3_bind_int64(s.insert, 1, song);
+    sqlite3_bind_int64(s.insert, 2, size);
+    sqlite3_bind_int64(s.insert, 3, mtimeNs);
+    sqlite3_bind_int64(s.insert, 4, totalFrames);
+    sqlite3_bind_blob(s.insert, 5, points.data(), points.size() * sizeof(SeekPoint), SQLITE_STATIC);
+    if (sqlite3_step(s.insert) != SQLITE_DONE)
+        std::printf("[SEEK INDEX] %s\n", sqlite3_errmsg(s.db));
+    sqlite3_reset(s.insert);
+}
+
+void PrepareSeeking(Decoder& dec, const SongEntry& song) {
+    if (dec.kind != DecoderKind::MP3)
+        return;
+
+    // can't tell whether a stored index is still right, dr_mp3 it is
+    uint64_t size;
+    int64_t mtimeNs;
+    if (!StatFile(song.filename.c_str(), size, mtimeNs))
+        return;
+
+    std::vector<SeekPoint> points;
+    uint64_t totalFrames = 0;
+    if (!LoadSeekIndex(song.id, size, mtimeNs, points, totalFrames)) {
+        const auto start = std::chrono::steady_clock::now();
+        if (!BuildSeekIndex(dec, SEEK_INTERVAL, points, totalFrames))
+            return;
+
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::printf("[SEEK INDEX] Built %zu points in %.1f ms\n", points.size(), elapsed.count());
+        StoreSeekIndex(song.id, size, mtimeNs, points, totalFrames);
+    }
+
+    UseSeekIndex(dec, std::move(points), totalFrames);
+}
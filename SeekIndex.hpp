@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Data.hpp"
+#include "Decoder.hpp"
+
+// Seek indexes, so seeking and knowing the length don't mean decoding.
+//
+// A VBR MP3 has no way to tell where sample N lives without decoding every
+// frame before it, which is what dr_mp3 does on every seek (and what
+// TotalFrames does just to get the duration). The first time a song is
+// opened we walk it once, keep a restart point every SEEK_INTERVAL seconds
+// and the exact length, and store them in `seek_indexes` along with the
+// file's size and mtime. After that a seek is a binary search plus decoding
+// at most SEEK_INTERVAL of audio, until the file changes and it's rebuilt.
+//
+// Ogg doesn't need one: stb_vorbis already bisects pages by granule
+// position, which is about as good as an index gets.
+
+constexpr float SEEK_INTERVAL = 1.0f;
+
+bool OpenSeekIndexes(const char* dbPath);
+void CloseSeekIndexes();
+
+// Binds the stored index for `song` to `dec`, building and storing it
+// if there isn't one yet. Safe to call from any thread.
+void PrepareSeeking(Decoder& dec, const SongEntry& song);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstring>
+
+// GCC/Clang vector extensions.
+// These lower to SSE on x86 and NEON on ARM without us writing intrinsics
+// for either, and to scalar code on anything else.
+using f32x4 = float __attribute__((vector_size(16)));
+
+inline f32x4 Load4(const float* p) {
+    f32x4 v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void Store4(float* p, f32x4 v) {
+    std::memcpy(p, &v, sizeof(v));
+}
+
+inline f32x4 Splat4(float x) {
+    return f32x4{ x, x, x, x };
+}
+
+inline float Sum4(f32x4 v) {
+    return v[0] + v[1] + v[2] + v[3];
+}
+
+inline f32x4 Min4(f32x4 a, f32x4 b) {
+    return a < b ? a : b;
+}
+
+inline f32x4 Max4(f32x4 a, f32x4 b) {
+    return a > b ? a : b;
+}
+
+// Two doubles, for recursive filters where float isn't precise enough.
+// Used to run a stereo pair through the same filter at once.
+using f64x2 = double __attribute__((vector_size(16)));
+
+inline f64x2 Splat2(double x) {
+    return f64x2{ x, x };
+}
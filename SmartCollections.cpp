@@ -0,0 +1,305 @@
+#include "SmartCollections.hpp"
+
+#include <charconv>
+#include <cstdio>
+#include <ctime>
+#include <format>
+
+#include "Library.hpp"
+#include "Trace.hpp"
+
+constexpr long int SECONDS_PER_DAY = 24 * 60 * 60;
+constexpr long int SWEEP_INTERVAL = 60;
+constexpr const char* SQL_NOW = "CAST(strftime('%s', 'now') AS INTEGER)";
+
+static const char* ColumnOf(SmartField field) {
+    switch (field) {
+    case SmartField::NAME: return "name";
+    case SmartField::ARTIST: return "byArtist";
+    case SmartField::ADDED_DAYS_AGO: return "addedAt";
+    case SmartField::PLAY_COUNT: return "playCount";
+    }
+    return "rowid";
+}
+
+static bool IsTextField(SmartField field) {
+    return field == SmartField::NAME || field == SmartField::ARTIST;
+}
+
+static long int ParseNumber(const std::string& str) {
+    long int value = 0;
+    std::from_chars(str.data(), str.data() + str.size(), value);
+    return value;
+}
+
+// Turns a rule into an SQL expression over `row` (either NEW inside a trigger,
+// or songs in a plain query). `now` is an SQL expression for the current time.
+// Values are always quoted by sqlite, they never get pasted in raw.
+static std::string CompileRule(const SmartRule& rule, std::string_view row, std::string_view now) {
+    const char* column = ColumnOf(rule.field);
+
+    if (IsTextField(rule.field)) {
+        char* quoted = sqlite3_mprintf("%Q", rule.value.c_str());
+        std::string ret;
+        switch (rule.op) {
+        case SmartOp::EQUALS:   ret = std::format("{}.{} = {}", row, column, quoted); break;
+        case SmartOp::CONTAINS: ret = std::format("instr({}.{}, {}) > 0", row, column, quoted); break;
+        case SmartOp::LESS:     ret = std::format("{}.{} < {}", row, column, quoted); break;
+        case SmartOp::GREATER:  ret = std::format("{}.{} > {}", row, column, quoted); break;
+        }
+        sqlite3_free(quoted);
+        return ret;
+    }
+
+    const long int value = ParseNumber(rule.value);
+
+    if (rule.field == SmartField::ADDED_DAYS_AGO) {
+        // "added less than N days ago" means addedAt is *after* the cutoff
+        const long int seconds = value * SECONDS_PER_DAY;
+        switch (rule.op) {
+        case SmartOp::LESS:
+            return std::format("{}.addedAt > {} - {}", row, now, seconds);
+        case SmartOp::GREATER:
+            return std::format("{}.addedAt <= {} - {}", row, now, seconds);
+        case SmartOp::EQUALS:
+        case SmartOp::CONTAINS:
+            return std::format("({}.addedAt <= {} - {} AND {}.addedAt > {} - {})",
+                               row, now, seconds, row, now, seconds + SECONDS_PER_DAY);
+        }
+    }
+
+    switch (rule.op) {
+    case SmartOp::LESS:    return std::format("{}.{} < {}", row, column, value);
+    case SmartOp::GREATER: return std::format("{}.{} > {}", row, column, value);
+    case SmartOp::EQUALS:
+    case SmartOp::CONTAINS:
+        return std::format("{}.{} = {}", row, column, value);
+    }
+    return "0";
+}
+
+static std::string CompileRules(std::span<const SmartRule> rules, std::string_view row,
+                                std::string_view now) {
+    if (rules.empty())
+        return "1";
+
+    std::string ret;
+    for (const SmartRule& rule : rules) {
+        if (!ret.empty())
+            ret += " AND ";
+        ret += "(" + CompileRule(rule, row, now) + ")";
+    }
+    return ret;
+}
+
+// Only the columns a collection actually looks at should wake its update
+// trigger. Otherwise every play count bump would run every smart collection.
+static std::string WatchedColumns(std::span<const SmartRule> rules) {
+    std::string ret;
+    for (SmartField field : { SmartField::NAME, SmartField::ARTIST,
+                              SmartField::ADDED_DAYS_AGO, SmartField::PLAY_COUNT }) {
+        for (const SmartRule& rule : rules) {
+            if (rule.field != field)
+                continue;
+            if (!ret.empty())
+                ret += ", ";
+            ret += ColumnOf(field);
+            break;
+        }
+    }
+    return ret.empty() ? "rowid" : ret;
+}
+
+static int ExecString(sqlite3* db, const std::string& sql) {
+    TRACE_ZONE("ExecString");
+    return sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr);
+}
+
+int CreateSmartCollection(sqlite3* db, std::string_view name,
+                          std::span<const SmartRule> rules, EntityId* newCollection) {
+    int err = ExecString(db, "BEGIN;");
+    if (err != SQLITE_OK) return err;
+
+    const auto Fail = [db](int code) {
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return code;
+    };
+
+    sqlite3_stmt* stmt;
+    err = PrepareQuery(db, &stmt, "INSERT INTO collections(name, smart, sweptAt) VALUES (?, 1, ?);");
+    if (err != SQLITE_OK) return Fail(err);
+    sqlite3_bind_text(stmt, 1, name.data(), name.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, std::time(nullptr));
+    err = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (err != SQLITE_DONE) return Fail(err);
+
+    const EntityId id = sqlite3_last_insert_rowid(db);
+
+    err = PrepareQuery(db, &stmt, "INSERT INTO smart_rules(collectionId, field, op, value) VALUES (?, ?, ?, ?);");
+    if (err != SQLITE_OK) return Fail(err);
+    for (const SmartRule& rule : rules) {
+        sqlite3_bind_int64(stmt, 1, id);
+        sqlite3_bind_int(stmt, 2, static_cast<int>(rule.field));
+        sqlite3_bind_int(stmt, 3, static_cast<int>(rule.op));
+        sqlite3_bind_text(stmt, 4, rule.value.data(), rule.value.size(), SQLITE_TRANSIENT);
+        err = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (err != SQLITE_DONE) {
+            sqlite3_finalize(stmt);
+            return Fail(err);
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    // The one and only full evaluation, everything after this is incremental.
+    err = ExecString(db, std::format(
+        "INSERT INTO collections_contents(collectionId, songId, position) "
+        "SELECT {0}, rowid, ROW_NUMBER() OVER (ORDER BY rowid) * {1} FROM songs WHERE {2};",
+        id, POSITION_GAP, CompileRules(rules, "songs", SQL_NOW)));
+    if (err != SQLITE_OK) return Fail(err);
+
+    const std::string matches = CompileRules(rules, "NEW", SQL_NOW);
+    const std::string append = std::format(
+        "(SELECT IFNULL(MAX(position), 0) + {} FROM collections_contents WHERE collectionId = {})",
+        POSITION_GAP, id);
+
+    err = ExecString(db, std::format(
+        "CREATE TRIGGER smart_{0}_insert AFTER INSERT ON songs WHEN {1} BEGIN "
+        "    INSERT INTO collections_contents(collectionId, songId, position) VALUES ({0}, NEW.rowid, {2}); "
+        "END;"
+        "CREATE TRIGGER smart_{0}_update AFTER UPDATE OF {3} ON songs BEGIN "
+        "    DELETE FROM collections_contents "
+        "    WHERE collectionId = {0} AND songId = NEW.rowid AND NOT ({1}); "
+        "    INSERT INTO collections_contents(collectionId, songId, position) "
+        "    SELECT {0}, NEW.rowid, {2} "
+        "    WHERE ({1}) AND NOT EXISTS "
+        "        (SELECT 1 FROM collections_contents WHERE collectionId = {0} AND songId = NEW.rowid); "
+        "END;"
+        "CREATE TRIGGER smart_{0}_delete AFTER DELETE ON songs BEGIN "
+        "    DELETE FROM collections_contents WHERE collectionId = {0} AND songId = OLD.rowid; "
+        "END;",
+        id, matches, append, WatchedColumns(rules)));
+    if (err != SQLITE_OK) return Fail(err);
+
+    err = ExecString(db, "COMMIT;");
+    if (err != SQLITE_OK) return Fail(err);
+
+    if (newCollection)
+        *newCollection = id;
+    return SQLITE_OK;
+}
+
+int DeleteSmartCollection(sqlite3* db, EntityId collectionId) {
+    int err = ExecString(db, "BEGIN;");
+    if (err != SQLITE_OK) return err;
+
+    const auto Fail = [db](int code) {
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return code;
+    };
+
+    err = ExecString(db, std::format(
+        "DROP TRIGGER IF EXISTS smart_{0}_insert;"
+        "DROP TRIGGER IF EXISTS smart_{0}_update;"
+        "DROP TRIGGER IF EXISTS smart_{0}_delete;"
+        "DELETE FROM smart_rules WHERE collectionId = {0};"
+        "DELETE FROM collections_contents WHERE collectionId = {0};"
+        "DELETE FROM collections WHERE rowid = {0};",
+        collectionId));
+    if (err != SQLITE_OK) return Fail(err);
+
+    err = ExecString(db, "COMMIT;");
+    if (err != SQLITE_OK) return Fail(err);
+    return SQLITE_OK;
+}
+
+int LoadSmartRules(sqlite3* db, EntityId collectionId, std::vector<SmartRule>& out) {
+    TRACE_ZONE("LoadSmartRules");
+    sqlite3_stmt* stmt;
+    int err = PrepareQuery(db, &stmt, "SELECT field, op, value FROM smart_rules WHERE collectionId = ?;");
+    if (err != SQLITE_OK) return err;
+
+    sqlite3_bind_int64(stmt, 1, collectionId);
+    while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+        out.push_back({
+            .field = static_cast<SmartField>(sqlite3_column_int(stmt, 0)),
+            .op = static_cast<SmartOp>(sqlite3_column_int(stmt, 1)),
+            .value = ColumnString(stmt, 2)
+        });
+    }
+
+    sqlite3_finalize(stmt);
+    return err == SQLITE_DONE ? SQLITE_OK : err;
+}
+
+int RefreshSmartCollection(sqlite3* db, EntityId collectionId) {
+    TRACE_ZONE("RefreshSmartCollection");
+    std::vector<SmartRule> rules;
+    int err = LoadSmartRules(db, collectionId, rules);
+    if (err != SQLITE_OK) return err;
+
+    bool timeBased = false;
+    for (const SmartRule& rule : rules)
+        timeBased = timeBased || rule.field == SmartField::ADDED_DAYS_AGO;
+    if (!timeBased)
+        return SQLITE_OK;  // the triggers already did all the work
+
+    sqlite3_stmt* stmt;
+    err = PrepareQuery(db, &stmt, "SELECT sweptAt FROM collections WHERE rowid = ?;");
+    if (err != SQLITE_OK) return err;
+    sqlite3_bind_int64(stmt, 1, collectionId);
+    const long int sweptAt = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+
+    // the rules are day-granular, no need to sweep on every single open
+    const long int now = std::time(nullptr);
+    if (now - sweptAt < SWEEP_INTERVAL)
+        return SQLITE_OK;
+
+    // one fixed "now" so the sweep and the recorded sweptAt agree
+    const std::string matches = CompileRules(rules, "songs", std::to_string(now));
+
+    err = ExecString(db, "BEGIN;");
+    if (err != SQLITE_OK) return err;
+
+    // Songs that aged out. This only walks the current members.
+    err = ExecString(db, std::format(
+        "DELETE FROM collections_contents WHERE collectionId = {0} AND NOT EXISTS "
+        "    (SELECT 1 FROM songs WHERE songs.rowid = collections_contents.songId AND {1});",
+        collectionId, matches));
+
+    // Songs that aged in. For "added more than N days ago" and for "added
+    // N days ago" (a one day window, see CompileRule) the cutoff moved from
+    // sweptAt - N days to now - N days, and only the slice of addedAt it
+    // crossed can be new. The window's far edge only ever drops songs, the
+    // DELETE above has those. "Less than N days ago" never gains songs by
+    // waiting, the insert trigger has it covered.
+    for (const SmartRule& rule : rules) {
+        if (err != SQLITE_OK) break;
+        if (rule.field != SmartField::ADDED_DAYS_AGO || rule.op == SmartOp::LESS)
+            continue;
+
+        const long int seconds = ParseNumber(rule.value) * SECONDS_PER_DAY;
+        err = ExecString(db, std::format(
+            "INSERT INTO collections_contents(collectionId, songId, position) "
+            "SELECT {0}, songs.rowid, "
+            "    (SELECT IFNULL(MAX(position), 0) FROM collections_contents WHERE collectionId = {0}) "
+            "    + ROW_NUMBER() OVER (ORDER BY songs.addedAt) * {1} "
+            "FROM songs "
+            "WHERE songs.addedAt > {2} AND songs.addedAt <= {3} AND {4} AND NOT EXISTS "
+            "    (SELECT 1 FROM collections_contents WHERE collectionId = {0} AND songId = songs.rowid);",
+            collectionId, POSITION_GAP, sweptAt - seconds, now - seconds, matches));
+    }
+
+    if (err == SQLITE_OK)
+        err = ExecString(db, std::format("UPDATE collections SET sweptAt = {} WHERE rowid = {};",
+                                         now, collectionId));
+
+    if (err != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        std::printf("[SMART] Failed to refresh collection %ld\n", collectionId);
+        return err;
+    }
+    return ExecString(db, "COMMIT;");
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "Data.hpp"
+
+// Smart collections are collections whose contents come from a set of rules,
+// e.g. "byArtist = X and added in the last 30 days" or "play count > 10".
+//
+// Membership is materialized into collections_contents like any other
+// collection, so opening one costs exactly the same as opening a playlist.
+// Each smart collection owns a few triggers on `songs` that add/remove
+// the one row that changed, which keeps things incremental.
+//
+// Rules that depend on the current time ("added in the last N days") can't
+// be kept up to date by triggers alone, since nothing in the table changes
+// when a song ages out. RefreshSmartCollection catches up on those, and only
+// ever looks at the current members plus an addedAt index range.
+
+enum class SmartField {
+    NAME,
+    ARTIST,
+    ADDED_DAYS_AGO,
+    PLAY_COUNT
+};
+
+enum class SmartOp {
+    EQUALS,
+    CONTAINS,  // only meaningful for text fields
+    LESS,
+    GREATER
+};
+
+// All rules of a collection must match (AND).
+struct SmartRule {
+    SmartField field;
+    SmartOp op;
+    std::string value;
+};
+
+int CreateSmartCollection(sqlite3* db, std::string_view name,
+                          std::span<const SmartRule> rules, EntityId* newCollection = nullptr);
+int DeleteSmartCollection(sqlite3* db, EntityId collectionId);
+
+int LoadSmartRules(sqlite3* db, EntityId collectionId, std::vector<SmartRule>& out);
+
+// Applies time-based membership changes. Cheap if nothing happened,
+// call it before reading the contents of a smart collection.
+int RefreshSmartCollection(sqlite3* db, EntityId collectionId);
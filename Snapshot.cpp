@@ -0,0 +1,349 @@
+#include "Snapshot.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Defer.hpp"
+#include "Library.hpp"
+#include "Trace.hpp"
+
+constexpr char SNAPSHOT_MAGIC[4] = { 'R', 'M', 'S', 'S' };
+
+// Bytes 24..27 of the database header, big-endian.
+// This only works because we use the default rollback journal.
+// In WAL mode the counter is not updated, so this needs revisiting
+// if we ever switch (PRAGMA data_version is per-connection, sadly).
+static bool ReadChangeCounter(const char* dbPath, uint32_t& out) {
+    const int fd = open(dbPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    uint8_t bytes[4];
+    const ssize_t n = pread(fd, bytes, sizeof(bytes), 24);
+    close(fd);
+    if (n != sizeof(bytes)) return false;
+
+    out = (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+          (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reading
+////////////////////////////////////////////////////////////////////////////////
+
+const SnapshotSong* Snapshot::FindSong(EntityId id) const {
+    auto it = std::lower_bound(songs.begin(), songs.end(), id,
+        [](const SnapshotSong& song, EntityId value) { return song.id < value; });
+    if (it == songs.end() || it->id != id)
+        return nullptr;
+    return &*it;
+}
+
+static bool InStrings(SnapshotString str, uint64_t stringsSize) {
+    return uint64_t(str.offset) + str.length <= stringsSize;
+}
+
+// Everything the readers index with, so they don't have to check again
+static bool CheckContents(const Snapshot& snapshot, uint64_t stringsSize) {
+    for (size_t i = 0; i < snapshot.songs.size(); i++) {
+        const SnapshotSong& song = snapshot.songs[i];
+        if (!InStrings(song.filename, stringsSize) ||
+                !InStrings(song.name, stringsSize) ||
+                !InStrings(song.byArtist, stringsSize) ||
+                song.fileFormat > static_cast<uint32_t>(AudioFormat::WAV))
+            return false;
+        // FindSong bisects
+        if (i > 0 && snapshot.songs[i - 1].id >= song.id)
+            return false;
+    }
+
+    for (const SnapshotCollection& coll : snapshot.collections) {
+        if (!InStrings(coll.name, stringsSize) ||
+                uint64_t(coll.firstMember) + coll.memberCount > snapshot.members.size())
+            return false;
+    }
+
+    for (const SnapshotMember& member : snapshot.members) {
+        if (member.song >= snapshot.songs.size())
+            return false;
+    }
+    return true;
+}
+
+bool MapSnapshot(const char* path, const char* dbPath, Snapshot& out) {
+    uint32_t counter;
+    if (!ReadChangeCounter(dbPath, counter))
+        return false;
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    const auto fdReleaser = Defer([fd](){ close(fd); });
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader))
+        return false;
+
+    const size_t size = st.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    const auto* base = static_cast<const uint8_t*>(mapping);
+    const auto& header = *reinterpret_cast<const SnapshotHeader*>(base);
+
+    // Counts are checked against the size before they get multiplied, a
+    // garbage one could otherwise wrap the offsets back into range
+    const bool countsFit =
+        header.songCount <= size / sizeof(SnapshotSong) &&
+        header.collectionCount <= size / sizeof(SnapshotCollection) &&
+        header.memberCount <= size / sizeof(SnapshotMember) &&
+        header.stringsSize <= size;
+    if (!countsFit) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    const uint64_t songsOffset = sizeof(SnapshotHeader);
+    const uint64_t collectionsOffset = songsOffset + header.songCount * sizeof(SnapshotSong);
+    const uint64_t membersOffset = collectionsOffset + header.collectionCount * sizeof(SnapshotCollection);
+    const uint64_t stringsOffset = membersOffset + header.memberCount * sizeof(SnapshotMember);
+
+    const bool valid =
+        std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+        header.version == SNAPSHOT_VERSION &&
+        header.dbChangeCounter == counter &&
+        header.fileSize == size &&
+        stringsOffset + header.stringsSize == size;
+
+    if (!valid) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    // the checks below read all of it anyway
+    madvise(mapping, size, MADV_WILLNEED);
+
+    Snapshot snapshot;
+    snapshot.mapping = base;
+    snapshot.size = size;
+    snapshot.dbPath = dbPath;
+    snapshot.dbChangeCounter = counter;
+    snapshot.songs = { reinterpret_cast<const SnapshotSong*>(base + songsOffset), header.songCount };
+    snapshot.collections = { reinterpret_cast<const SnapshotCollection*>(base + collectionsOffset), header.collectionCount };
+    snapshot.members = { reinterpret_cast<const SnapshotMember*>(base + membersOffset), header.memberCount };
+    snapshot.strings = reinterpret_cast<const char*>(base + stringsOffset);
+
+    if (!CheckContents(snapshot, header.stringsSize)) {
+        std::printf("[SNAPSHOT] %s is corrupt, ignoring it.\n", path);
+        munmap(mapping, size);
+        return false;
+    }
+
+    out = snapshot;
+    return true;
+}
+
+void UnmapSnapshot(Snapshot& snapshot) {
+    if (snapshot.mapping)
+        munmap(const_cast<uint8_t*>(snapshot.mapping), snapshot.size);
+    snapshot = Snapshot{};
+}
+
+bool IsSnapshotCurrent(const Snapshot& snapshot) {
+    return snapshot.mapping && !snapshot.stale;
+}
+
+void MarkSnapshotStale(Snapshot& snapshot) {
+    snapshot.stale = true;
+}
+
+void LoadCollections(const Snapshot& snapshot, Arena<CollectionEntry>& out) {
+    for (const SnapshotCollection& coll : snapshot.collections) {
+        int i = out.Allocate();
+        out.arr[i].id = coll.id;
+        out.arr[i].name = snapshot.String(coll.name);
+        out.arr[i].smart = coll.smart != 0;
+    }
+}
+
+bool LoadCollectionSongs(const Snapshot& snapshot, EntityId collectionId, Arena<SongEntry>& out) {
+    auto it = std::find_if(snapshot.collections.begin(), snapshot.collections.end(),
+        [collectionId](const SnapshotCollection& coll) { return coll.id == collectionId; });
+    if (it == snapshot.collections.end())
+        return false;
+
+    for (const SnapshotMember& member : snapshot.members.subspan(it->firstMember, it->memberCount)) {
+        const SnapshotSong& song = snapshot.songs[member.song];
+        int i = out.Allocate();
+        out.arr[i].id = song.id;
+        out.arr[i].filename = snapshot.String(song.filename);
+        out.arr[i].fileFormat = static_cast<AudioFormat>(song.fileFormat);
+        out.arr[i].name = snapshot.String(song.name);
+        out.arr[i].byArtist = snapshot.String(song.byArtist);
+        out.arr[i].entryId = member.entryId;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Writing
+////////////////////////////////////////////////////////////////////////////////
+
+// Artist names repeat a lot, so identical strings share one pool entry.
+struct StringPool {
+    std::string data;
+    std::unordered_map<std::string, SnapshotString> seen;
+
+    SnapshotString Add(sqlite3_stmt* stmt, int col) {
+        const auto* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, col));
+        std::string str = text ? text : "";
+
+        auto it = seen.find(str);
+        if (it != seen.end())
+            return it->second;
+
+        const SnapshotString ret{
+            .offset = static_cast<uint32_t>(data.size()),
+            .length = static_cast<uint32_t>(str.size())
+        };
+        data += str;
+        seen.emplace(std::move(str), ret);
+        return ret;
+    }
+};
+
+int RestampSnapshot(const char* dbPath, const char* path) {
+    uint32_t counter;
+    if (!ReadChangeCounter(dbPath, counter))
+        return SQLITE_CANTOPEN;
+
+    const int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return SQLITE_CANTOPEN;
+    const auto fdReleaser = Defer([fd](){ close(fd); });
+
+    // a torn write just makes it look stale, which is what it'd be without this
+    const off_t offset = offsetof(SnapshotHeader, dbChangeCounter);
+    if (pwrite(fd, &counter, sizeof(counter), offset) != sizeof(counter)) {
+        std::printf("[SNAPSHOT] Failed to restamp %s\n", path);
+        return SQLITE_IOERR;
+    }
+    return SQLITE_OK;
+}
+
+int WriteSnapshot(sqlite3* db, const char* dbPath, const char* path) {
+    TRACE_ZONE("WriteSnapshot");
+    StringPool pool;
+    std::vector<SnapshotSong> songs;
+    std::vector<SnapshotCollection> collections;
+    std::vector<SnapshotMember> members;
+
+    // read everything in one transaction so the counter matches what we saw
+    int err = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+    if (err != SQLITE_OK) return err;
+    const auto txnReleaser = Defer([db](){ sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr); });
+
+    sqlite3_stmt* stmt;
+    err = PrepareQuery(db, &stmt, "SELECT rowid, filename, name, byArtist, fileFormat FROM songs ORDER BY rowid;");
+    if (err != SQLITE_OK) return err;
+
+    while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+        songs.push_back({
+            .id = sqlite3_column_int64(stmt, 0),
+            .filename = pool.Add(stmt, 1),
+            .name = pool.Add(stmt, 2),
+            .byArtist = pool.Add(stmt, 3),
+            .fileFormat = static_cast<uint32_t>(ColumnFormat(stmt, 4, 1)),
+            .padding = 0
+        });
+    }
+    sqlite3_finalize(stmt);
+    if (err != SQLITE_DONE) return err;
+
+    err = PrepareQuery(db, &stmt, "SELECT rowid, name, smart FROM collections;");
+    if (err != SQLITE_OK) return err;
+
+    while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+        collections.push_back({
+            .id = sqlite3_column_int64(stmt, 0),
+            .name = pool.Add(stmt, 1),
+            .firstMember = 0,
+            .memberCount = 0,
+            .smart = static_cast<uint32_t>(sqlite3_column_int(stmt, 2)),
+            .padding = 0
+        });
+    }
+    sqlite3_finalize(stmt);
+    if (err != SQLITE_DONE) return err;
+
+    err = PrepareQuery(db, &stmt,
+        "SELECT rowid, songId FROM collections_contents "
+        "WHERE collectionId = ? ORDER BY position;");
+    if (err != SQLITE_OK) return err;
+
+    for (SnapshotCollection& coll : collections) {
+        coll.firstMember = members.size();
+        sqlite3_bind_int64(stmt, 1, coll.id);
+
+        while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+            const EntityId songId = sqlite3_column_int64(stmt, 1);
+            auto it = std::lower_bound(songs.begin(), songs.end(), songId,
+                [](const SnapshotSong& song, EntityId value) { return song.id < value; });
+            if (it == songs.end() || it->id != songId)
+                continue;  // dangling entry, the join in LoadCollectionSongs drops these too
+
+            members.push_back({
+                .entryId = sqlite3_column_int64(stmt, 0),
+                .song = static_cast<uint32_t>(it - songs.begin()),
+                .padding = 0
+            });
+        }
+
+        sqlite3_reset(stmt);
+        coll.memberCount = members.size() - coll.firstMember;
+    }
+    sqlite3_finalize(stmt);
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    if (!ReadChangeCounter(dbPath, header.dbChangeCounter))
+        return SQLITE_CANTOPEN;
+    header.songCount = songs.size();
+    header.collectionCount = collections.size();
+    header.memberCount = members.size();
+    header.stringsSize = pool.data.size();
+    header.fileSize = sizeof(header) +
+                      songs.size() * sizeof(SnapshotSong) +
+                      collections.size() * sizeof(SnapshotCollection) +
+                      members.size() * sizeof(SnapshotMember) +
+                      pool.data.size();
+
+    const std::string tmpPath = std::string(path) + ".tmp";
+    std::FILE* file = std::fopen(tmpPath.c_str(), "wb");
+    if (!file) return SQLITE_CANTOPEN;
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && std::fwrite(songs.data(), sizeof(SnapshotSong), songs.size(), file) == songs.size();
+    ok = ok && std::fwrite(collections.data(), sizeof(SnapshotCollection), collections.size(), file) == collections.size();
+    ok = ok && std::fwrite(members.data(), sizeof(SnapshotMember), members.size(), file) == members.size();
+    ok = ok && std::fwrite(pool.data.data(), 1, pool.data.size(), file) == pool.data.size();
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (!ok || std::rename(tmpPath.c_str(), path) != 0) {
+        std::remove(tmpPath.c_str());
+        std::printf("[SNAPSHOT] Failed to write %s\n", path);
+        return SQLITE_IOERR;
+    }
+
+    return SQLITE_OK;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include <sqlite3.h>
+
+#include "Allocators.hpp"
+#include "Data.hpp"
+
+// A flat copy of the library that gets mmap'd on startup and read in place.
+// Everything is native-endian and naturally aligned, so "loading" it is
+// just pointing spans at the mapping once every index and string in it
+// has been bounds checked.
+//
+// File layout:
+//   SnapshotHeader
+//   SnapshotSong       songs[songCount]              (sorted by id)
+//   SnapshotCollection collections[collectionCount]
+//   SnapshotMember     members[memberCount]          (grouped by collection, in playlist order)
+//   char               strings[stringsSize]          (not null-terminated)
+//
+// The snapshot remembers the file change counter of riff-man.db at the time
+// it was written. Any committed write to the database bumps that counter,
+// which is how MapSnapshot knows the snapshot went stale.
+//
+// That check only happens once, on startup, before the background jobs
+// get going. They write all the time (play counts, fingerprints, loudness,
+// waveforms...) but never anything the snapshot holds, so after that the
+// UI marks the snapshot stale itself when it changes a playlist. Smart
+// collections are the exception: their contents follow play counts, so
+// they always come from the database.
+//
+// Those background writes still bump the counter, so on exit a snapshot
+// that's still current gets the new counter stamped into its header.
+// Otherwise every session with a play in it would cost the next launch
+// its snapshot.
+
+constexpr uint32_t SNAPSHOT_VERSION = 3;
+
+struct SnapshotString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapshotSong {
+    int64_t id;
+    SnapshotString filename;
+    SnapshotString name;
+    SnapshotString byArtist;
+    uint32_t fileFormat;  // AudioFormat
+    uint32_t padding;
+};
+
+struct SnapshotCollection {
+    int64_t id;
+    SnapshotString name;
+    uint32_t firstMember;
+    uint32_t memberCount;
+    uint32_t smart;
+    uint32_t padding;
+};
+
+struct SnapshotMember {
+    int64_t entryId;  // rowid in collections_contents
+    uint32_t song;    // index into songs
+    uint32_t padding;
+};
+
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t dbChangeCounter;
+    uint32_t padding;
+    uint64_t fileSize;
+    uint64_t songCount;
+    uint64_t collectionCount;
+    uint64_t memberCount;
+    uint64_t stringsSize;
+};
+
+struct Snapshot {
+    const uint8_t* mapping = nullptr;
+    size_t size = 0;
+    const char* dbPath = nullptr;
+    uint32_t dbChangeCounter = 0;
+    bool stale = false;  // see MarkSnapshotStale
+
+    std::span<const SnapshotSong> songs;
+    std::span<const SnapshotCollection> collections;
+    std::span<const SnapshotMember> members;
+    const char* strings = nullptr;
+
+    std::string_view String(SnapshotString str) const {
+        return { strings + str.offset, str.length };
+    }
+
+    // binary search, since songs are sorted by id
+    const SnapshotSong* FindSong(EntityId id) const;
+};
+
+// Returns false (and leaves `out` unmapped) if the snapshot is missing,
+// malformed, from another version, or older than the database.
+// Malformed includes any song index, member range or string that points
+// outside the file, so a corrupt snapshot is never read out of bounds.
+bool MapSnapshot(const char* path, const char* dbPath, Snapshot& out);
+void UnmapSnapshot(Snapshot& snapshot);
+
+// Mapped and not marked stale since
+bool IsSnapshotCurrent(const Snapshot& snapshot);
+// For writes that change what the snapshot holds. It gets rewritten on exit.
+void MarkSnapshotStale(Snapshot& snapshot);
+
+// For a snapshot that is still current once everything else has stopped
+// writing: brings its counter up to the database's, in place.
+int RestampSnapshot(const char* dbPath, const char* path);
+
+// Dumps the database into a new snapshot file. The file is written next to
+// `path` and renamed over it, so a crash never leaves a torn snapshot behind.
+int WriteSnapshot(sqlite3* db, const char* dbPath, const char* path);
+
+void LoadCollections(const Snapshot& snapshot, Arena<CollectionEntry>& out);
+bool LoadCollectionSongs(const Snapshot& snapshot, EntityId collectionId, Arena<SongEntry>& out);
@@ -0,0 +1,151 @@
+#include "Spectrum.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "Ring.hpp"
+
+constexpr float LOWEST_HZ = 40.0f;
+constexpr float HIGHEST_HZ = 16000.0f;
+constexpr float FLOOR_DB = -72.0f;      // bars are empty at this and below
+constexpr float FALL_PER_SECOND = 1.5f; // in bar heights
+// A few ticks worth of stereo at 48k, anything past that gets dropped
+constexpr size_t TAP_RING_SIZE = 1 << 14;
+
+SpectrumAnalyzer MakeSpectrumAnalyzer(unsigned int sampleRate) {
+    SpectrumAnalyzer a;
+    a.plan = MakeFFTPlan(SPECTRUM_FFT_SIZE);
+    a.window = MakeHannWindow(SPECTRUM_FFT_SIZE);
+    a.scratch.resize(2 * SPECTRUM_FFT_SIZE);
+    a.power.resize(SPECTRUM_FFT_SIZE / 2 + 1);
+    a.bars.assign(SPECTRUM_BARS, 0.0f);
+
+    // Log spaced, but at least one bin each. The bottom bars are narrower
+    // than a bin, so they get pushed up a little.
+    const float binHz = static_cast<float>(sampleRate) / SPECTRUM_FFT_SIZE;
+    const float top = std::min(HIGHEST_HZ, 0.5f * sampleRate);
+    const int lastBin = SPECTRUM_FFT_SIZE / 2;
+    a.edges.resize(SPECTRUM_BARS + 1);
+    for (int b = 0; b <= SPECTRUM_BARS; b++) {
+        const float hz = LOWEST_HZ * std::pow(top / LOWEST_HZ, static_cast<float>(b) / SPECTRUM_BARS);
+        int bin = static_cast<int>(std::lround(hz / binHz));
+        if (b > 0)
+            bin = std::max(bin, a.edges[b - 1] + 1);
+        a.edges[b] = std::min(bin, lastBin);
+    }
+    return a;
+}
+
+void AnalyzeSpectrum(SpectrumAnalyzer& a, const float* mono, float dt) {
+    PowerSpectrum(a.plan, mono, a.window.data(), a.power.data(), a.scratch.data());
+
+    // a full scale sine comes out of a Hann window at N/4, call that 0 dB
+    const float norm = 16.0f / (static_cast<float>(SPECTRUM_FFT_SIZE) * SPECTRUM_FFT_SIZE);
+    const float fall = FALL_PER_SECOND * dt;
+
+    for (int b = 0; b < SPECTRUM_BARS; b++) {
+        float peak = 0.0f;
+        for (int k = a.edges[b]; k < std::max(a.edges[b + 1], a.edges[b] + 1); k++)
+            peak = std::max(peak, a.power[k]);
+
+        const float db = 10.0f * std::log10(peak * norm + 1e-12f);
+        const float level = std::clamp((db - FLOOR_DB) / -FLOOR_DB, 0.0f, 1.0f);
+        a.bars[b] = std::max(level, a.bars[b] - fall);
+    }
+}
+
+struct SpectrumState {
+    SpscRing<float, TAP_RING_SIZE> tap;  // interleaved stereo
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop = false;                              // guarded by mutex
+    std::array<float, SPECTRUM_BARS> published{};   // guarded by mutex
+
+    // Main thread only
+    std::array<float, SPECTRUM_BARS> shown{};
+};
+
+SpectrumState g_spectrum;
+
+// Runs on raylib's audio thread. No locks, no allocation, no IO.
+void TapSpectrum(const float* frames, size_t count) {
+    g_spectrum.tap.PushSome(frames, count * 2);
+}
+
+static void SpectrumMain(unsigned int sampleRate) {
+    SpectrumState& s = g_spectrum;
+    SpectrumAnalyzer analyzer = MakeSpectrumAnalyzer(sampleRate);
+
+    std::vector<float> history(SPECTRUM_FFT_SIZE, 0.0f);  // mono, oldest first
+    std::vector<float> incoming(TAP_RING_SIZE);
+
+    using Clock = std::chrono::steady_clock;
+    const auto tick = std::chrono::microseconds(1000000 / SPECTRUM_HZ);
+    auto next = Clock::now();
+    auto last = next;
+
+    std::unique_lock lock(s.mutex);
+    while (true) {
+        next += tick;
+        if (s.wake.wait_until(lock, next, [&s]() { return s.stop; }))
+            break;
+        lock.unlock();
+
+        // falling way behind (e.g. the machine was asleep) shouldn't mean catching up
+        const auto now = Clock::now();
+        if (now - next > 4 * tick)
+            next = now;
+
+        const size_t frames = s.tap.PopSome(incoming.data(), incoming.size()) / 2;
+        const size_t keep = SPECTRUM_FFT_SIZE - std::min<size_t>(frames, SPECTRUM_FFT_SIZE);
+        const size_t skip = frames - (SPECTRUM_FFT_SIZE - keep);
+        std::copy(history.end() - keep, history.end(), history.begin());
+        for (size_t i = skip; i < frames; i++)
+            history[keep + i - skip] = 0.5f * (incoming[2 * i] + incoming[2 * i + 1]);
+
+        AnalyzeSpectrum(analyzer, history.data(), std::chrono::duration<float>(now - last).count());
+        last = now;
+
+        lock.lock();
+        std::copy(analyzer.bars.begin(), analyzer.bars.end(), s.published.begin());
+    }
+}
+
+void StartSpectrum(unsigned int sampleRate) {
+    SpectrumState& s = g_spectrum;
+    if (s.thread.joinable())
+        return;
+
+    s.stop = false;
+    s.thread = std::thread(SpectrumMain, sampleRate);
+}
+
+void StopSpectrum() {
+    SpectrumState& s = g_spectrum;
+    if (!s.thread.joinable())
+        return;
+
+    {
+        std::lock_guard lock(s.mutex);
+        s.stop = true;
+    }
+    s.wake.notify_one();
+    s.thread.join();
+}
+
+std::span<const float> GetSpectrum() {
+    SpectrumState& s = g_spectrum;
+    if (!s.thread.joinable())
+        return {};
+
+    std::lock_guard lock(s.mutex);
+    s.shown = s.published;
+    return s.shown;
+}
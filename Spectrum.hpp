@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "FFT.hpp"
+
+// Live spectrum for the now playing panel.
+//
+// The audio callback hands everything it plays to TapSpectrum (see
+// SetPlaybackTap), which only copies it into a ring. A thread of our own
+// drains that ring SPECTRUM_HZ times a second, keeps the last
+// SPECTRUM_FFT_SIZE frames, and squashes their Hann windowed spectrum into
+// SPECTRUM_BARS log-spaced bars. If that thread falls behind, the ring fills
+// up and the tap drops samples, the callback never waits on it.
+
+constexpr int SPECTRUM_BARS = 48;
+constexpr int SPECTRUM_FFT_SIZE = 2048;  // ~43 ms at 48k
+constexpr int SPECTRUM_HZ = 60;
+
+struct SpectrumAnalyzer {
+    FFTPlan plan;
+    std::vector<float> window;
+    std::vector<float> scratch;
+    std::vector<float> power;
+    std::vector<int> edges;   // bins [edges[b], edges[b + 1]) make up bar b
+    std::vector<float> bars;  // 0 to 1
+};
+
+SpectrumAnalyzer MakeSpectrumAnalyzer(unsigned int sampleRate);
+// `mono` is the last SPECTRUM_FFT_SIZE frames. Bars jump straight up and
+// fall back slowly, `dt` is the seconds since the last call.
+void AnalyzeSpectrum(SpectrumAnalyzer& analyzer, const float* mono, float dt);
+
+// Audio thread, a PlaybackTapFn.
+void TapSpectrum(const float* frames, size_t count);
+
+void StartSpectrum(unsigned int sampleRate);
+void StopSpectrum();
+
+// Main thread. The latest bars, empty if it isn't running.
+// Valid until the next call.
+std::span<const float> GetSpectrum();
@@ -59,6 +59,8 @@
 #include <cstring>
 #include <limits>
 
+#include "Trace.hpp"
+
 void FTPrintError(FT_Error error) {
 #undef FTERRORS_H_
 #define FT_ERRORDEF(err, errInt, str) case err: printf("FreeType: %s\n", str); break;
@@ -95,6 +97,7 @@ int TGAImage::OffsetOf(int x, int y) const {
 
 TGAImage RenderText(std::string_view str, const TextRenderContext& textCtx,
                    const char* langHint) {
+    TRACE_ZONE("RenderText");
     // TODO: we could add some introspection here to detect text language
     //       i think harfbuzz can do that directly
     if (!langHint)
@@ -66,3 +66,11 @@ struct TextRenderContext {
     raqm_t* rq;
 };
 
+// What clay's measure function needs. Layout runs on its own thread,
+// so this gets its own face and raqm_t rather than the renderer's.
+struct TextMeasureContext {
+    FT_Face face;
+    raqm_t* rq;
+    int lineHeight;  // the atlas's max glyph height, in pixels
+};
+
@@ -0,0 +1,156 @@
+#include "Trace.hpp"
+
+#include <csignal>
+#include <cstdio>
+
+#include <signal.h>
+
+volatile std::sig_atomic_t g_traceRequested = 0;
+
+static void OnTraceSignal(int) {
+    g_traceRequested = 1;
+}
+
+void InstallTraceSignal() {
+    struct sigaction action = {};
+    action.sa_handler = OnTraceSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+}
+
+bool TakeTraceRequest() {
+    if (!g_traceRequested)
+        return false;
+    g_traceRequested = 0;
+    return true;
+}
+
+#ifndef RIFF_MAN_TRACING
+
+bool DumpTrace(const char*) {
+    std::printf("[TRACE] Built without RIFF_MAN_TRACING, nothing to dump\n");
+    return false;
+}
+
+#else
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+// One writer (its thread), any number of readers. The writer never waits, so
+// a reader checks afterwards whether it got lapped while copying.
+struct TraceRing {
+    std::array<TraceEvent, TRACE_RING_EVENTS> events;
+    std::atomic<uint64_t> written{0};
+    std::atomic<const char*> name{nullptr};
+    int tid;
+};
+
+// Rings outlive their threads so a dump still has what they did.
+// Our threads are few and long lived, so they never get freed.
+struct TraceState {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceRing>> rings;
+    // to turn ticks into time at dump
+    uint64_t originTicks = TraceNow();
+    std::chrono::steady_clock::time_point originTime = std::chrono::steady_clock::now();
+};
+
+TraceState g_trace;
+thread_local TraceRing* t_traceRing = nullptr;
+
+static TraceRing& ThreadRing() {
+    if (t_traceRing)
+        return *t_traceRing;
+
+    auto ring = std::make_unique<TraceRing>();
+    std::lock_guard lock(g_trace.mutex);
+    ring->tid = static_cast<int>(g_trace.rings.size()) + 1;
+    t_traceRing = ring.get();
+    g_trace.rings.push_back(std::move(ring));
+    return *t_traceRing;
+}
+
+void TraceEmit(const char* name, uint64_t begin, uint64_t end) {
+    TraceRing& ring = ThreadRing();
+    const uint64_t n = ring.written.load(std::memory_order_relaxed);
+    ring.events[n % TRACE_RING_EVENTS] = { name, begin, end };
+    ring.written.store(n + 1, std::memory_order_release);
+}
+
+void TraceThreadName(const char* name) {
+    ThreadRing().name.store(name, std::memory_order_relaxed);
+}
+
+// Oldest first, without anything the writer overwrote while we copied
+static std::vector<TraceEvent> CopyRing(const TraceRing& ring) {
+    const uint64_t end = ring.written.load(std::memory_order_acquire);
+    const uint64_t begin = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+
+    std::vector<TraceEvent> events;
+    events.reserve(end - begin);
+    for (uint64_t i = begin; i < end; i++)
+        events.push_back(ring.events[i % TRACE_RING_EVENTS]);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t after = ring.written.load(std::memory_order_relaxed);
+    // the owner may already be halfway through event `after`, on top of after - N
+    const uint64_t valid = after + 1 > TRACE_RING_EVENTS ? after + 1 - TRACE_RING_EVENTS : 0;
+    if (valid > begin)
+        events.erase(events.begin(), events.begin() + std::min(valid, end) - begin);
+    return events;
+}
+
+bool DumpTrace(const char* path) {
+    // Measured over the whole run, which is plenty for an invariant TSC
+    const uint64_t nowTicks = TraceNow();
+    const auto nowTime = std::chrono::steady_clock::now();
+    const double elapsedUs = std::chrono::duration<double, std::micro>(nowTime - g_trace.originTime).count();
+    const double ticksPerUs = elapsedUs > 0.0 ? (nowTicks - g_trace.originTicks) / elapsedUs : 1.0;
+    const auto toUs = [&](uint64_t ticks) {
+        return (static_cast<double>(ticks) - static_cast<double>(g_trace.originTicks)) / ticksPerUs;
+    };
+
+    std::FILE* file = std::fopen(path, "w");
+    if (!file)
+        return false;
+
+    std::lock_guard lock(g_trace.mutex);
+    size_t total = 0;
+    std::fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    for (const auto& ring : g_trace.rings) {
+        const char* name = ring->name.load(std::memory_order_relaxed);
+        std::fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                           "\"args\": {\"name\": \"%s\"}}",
+                     first ? "" : ",\n", ring->tid, name ? name : "thread");
+        first = false;
+
+        for (const TraceEvent& event : CopyRing(*ring)) {
+            std::fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                               "\"ts\": %.3f, \"dur\": %.3f}",
+                         event.name, ring->tid, toUs(event.begin), (event.end - event.begin) / ticksPerUs);
+            total++;
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+
+    if (std::fclose(file) != 0)
+        return false;
+    std::printf("[TRACE] Wrote %zu zones from %zu threads to %s\n", total, g_trace.rings.size(), path);
+    return true;
+}
+
+#endif
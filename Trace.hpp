@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Scoped trace zones, for working out what a hitch was after it happened.
+//
+//     void Expensive() {
+//         TRACE_ZONE("Expensive");
+//         ...
+//     }
+//
+// Every thread that hits a zone gets its own ring of the last
+// TRACE_RING_EVENTS zones it closed. Recording is two TSC reads and a store
+// into that ring, no locks or syscalls. DumpTrace writes every ring out as
+// Chrome trace JSON (chrome://tracing or ui.perfetto.dev), main.cpp does that
+// on T or when the process gets SIGUSR1.
+//
+// Zones only exist when built with RIFF_MAN_TRACING (a CMake option, on by
+// default). Without it the macros are empty and DumpTrace just fails.
+
+#ifdef RIFF_MAN_TRACING
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+constexpr size_t TRACE_RING_EVENTS = 1 << 15;
+
+// In TSC ticks, or steady_clock ns where there is no TSC
+inline uint64_t TraceNow() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// `name` has to be a string literal, only the pointer is kept
+void TraceEmit(const char* name, uint64_t begin, uint64_t end);
+// Shows up as the thread's name in the dump, a string literal as well
+void TraceThreadName(const char* name);
+
+class TraceZone {
+ public:
+    explicit TraceZone(const char* name) : m_name(name), m_begin(TraceNow()) {}
+    ~TraceZone() { TraceEmit(m_name, m_begin, TraceNow()); }
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+
+ private:
+    const char* m_name;
+    uint64_t m_begin;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __COUNTER__)(name)
+#define TRACE_THREAD(name) TraceThreadName(name)
+
+#else
+
+#define TRACE_ZONE(name)
+#define TRACE_THREAD(name)
+
+#endif
+
+// Writes everything still in the rings. Fine to call while other threads
+// keep tracing, zones they overwrite mid-dump are left out.
+bool DumpTrace(const char* path);
+
+// SIGUSR1 only sets a flag (nothing else is safe in a handler),
+// the main loop polls it and does the dump itself.
+void InstallTraceSignal();
+bool TakeTraceRequest();
@@ -0,0 +1,283 @@
+#include "Waveform.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <sqlite3.h>
+
+#include "Decoder.hpp"
+#include "Library.hpp"
+#include "WorkerPool.hpp"
+
+static_assert(sizeof(WaveformBucket) == 3, "Waveforms are stored as raw buckets.");
+
+bool ComputeWaveform(const char* filename, std::vector<WaveformBucket>& out) {
+    Decoder dec;
+    if (!OpenDecoder(dec, filename))
+        return false;
+
+    const uint64_t total = TotalFrames(dec);
+    if (total == 0) {
+        CloseDecoder(dec);
+        return false;
+    }
+
+    struct Accumulator {
+        float min = 0.0f;
+        float max = 0.0f;
+        double sumSquares = 0.0;
+        uint64_t count = 0;
+    };
+    std::vector<Accumulator> buckets(WAVEFORM_BUCKETS);
+
+    constexpr size_t chunkFrames = 4096;
+    std::vector<float> chunk(chunkFrames * dec.channels);
+    const float scale = 1.0f / dec.channels;
+    uint64_t frame = 0;
+
+    while (true) {
+        const size_t got = ReadFrames(dec, chunk.data(), chunkFrames);
+        if (got == 0)
+            break;
+
+        for (size_t i = 0; i < got; i++, frame++) {
+            float sample = 0.0f;
+            for (unsigned int c = 0; c < dec.channels; c++)
+                sample += chunk[i * dec.channels + c];
+            sample *= scale;
+
+            // TotalFrames can be a little off for MP3, anything past it goes in the last bucket
+            const size_t b = std::min<uint64_t>(frame * WAVEFORM_BUCKETS / total, WAVEFORM_BUCKETS - 1);
+            Accumulator& acc = buckets[b];
+            acc.min = std::min(acc.min, sample);
+            acc.max = std::max(acc.max, sample);
+            acc.sumSquares += sample * sample;
+            acc.count++;
+        }
+    }
+    CloseDecoder(dec);
+
+    out.resize(WAVEFORM_BUCKETS);
+    for (int i = 0; i < WAVEFORM_BUCKETS; i++) {
+        const Accumulator& acc = buckets[i];
+        const float rms = acc.count > 0 ? std::sqrt(acc.sumSquares / acc.count) : 0.0f;
+        out[i] = {
+            .min = static_cast<int8_t>(std::clamp(std::lround(acc.min * 127.0f), -127l, 127l)),
+            .max = static_cast<int8_t>(std::clamp(std::lround(acc.max * 127.0f), -127l, 127l)),
+            .rms = static_cast<uint8_t>(std::clamp(std::lround(rms * 255.0f), 0l, 255l))
+        };
+    }
+    return frame > 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Loader thread
+////////////////////////////////////////////////////////////////////////////////
+
+struct WaveformRequest {
+    EntityId song;
+    std::string filename;
+};
+
+struct WaveformResult {
+    EntityId song;
+    std::vector<WaveformBucket> buckets;  // empty if it couldn't be made
+};
+
+struct CachedWaveform {
+    std::vector<WaveformBucket> buckets;
+    std::list<EntityId>::iterator lru;
+};
+
+struct WaveformState {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop = false;                      // guarded by mutex
+    std::deque<WaveformRequest> requests;   // guarded by mutex
+    std::vector<WaveformResult> results;    // guarded by mutex
+
+    // Main thread only
+    std::unordered_set<EntityId> inFlight;
+    std::unordered_map<EntityId, CachedWaveform> cache;
+    std::list<EntityId> lru;  // most recently used at the front
+};
+
+WaveformState g_waveforms;
+
+// Everything asked for since the last round. Stored ones are read right here,
+// missing ones get computed in parallel and written back.
+static void ServeRequests(sqlite3* db, sqlite3_stmt* select, sqlite3_stmt* insert,
+                          std::deque<WaveformRequest>& requests) {
+    WaveformState& w = g_waveforms;
+    std::vector<WaveformResult> results;
+    std::vector<const WaveformRequest*> missing;
+
+    for (const WaveformRequest& request : requests) {
+        sqlite3_bind_int64(select, 1, request.song);
+        if (sqlite3_step(select) == SQLITE_ROW) {
+            // NULL means we tried before and couldn't decode it
+            WaveformResult& result = results.emplace_back(WaveformResult{ request.song, {} });
+            const auto* blob = static_cast<const WaveformBucket*>(sqlite3_column_blob(select, 0));
+            const int bytes = sqlite3_column_bytes(select, 0);
+            if (blob && bytes == WAVEFORM_BUCKETS * static_cast<int>(sizeof(WaveformBucket)))
+                result.buckets.assign(blob, blob + WAVEFORM_BUCKETS);
+        } else {
+            missing.push_back(&request);
+        }
+        sqlite3_reset(select);
+    }
+
+    if (!missing.empty()) {
+        const size_t first = results.size();
+        results.resize(first + missing.size());
+
+        const auto start = std::chrono::steady_clock::now();
+        SharedWorkers().ParallelFor(missing.size(), [&](size_t i) {
+            results[first + i].song = missing[i]->song;
+            if (!ComputeWaveform(missing[i]->filename.c_str(), results[first + i].buckets))
+                results[first + i].buckets.clear();
+        });
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::printf("[WAVEFORM] Generated %zu in %.1f ms\n", missing.size(), elapsed.count());
+
+        sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+        for (size_t i = first; i < results.size(); i++) {
+            const auto& buckets = results[i].buckets;
+            sqlite3_bind_int64(insert, 1, results[i].song);
+            if (buckets.empty())
+                sqlite3_bind_null(insert, 2);
+            else
+                sqlite3_bind_blob(insert, 2, buckets.data(), buckets.size() * sizeof(WaveformBucket), SQLITE_STATIC);
+            sqlite3_step(insert);
+            sqlite3_reset(insert);
+        }
+        sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    }
+
+    std::lock_guard lock(w.mutex);
+    for (WaveformResult& result : results)
+        w.results.push_back(std::move(result));
+}
+
+static void WaveformMain(sqlite3* db) {
+    WaveformState& w = g_waveforms;
+
+    sqlite3_stmt* select = nullptr;
+    sqlite3_stmt* insert = nullptr;
+    int err = PrepareQuery(db, &select, "SELECT buckets FROM waveforms WHERE songId = ?;");
+    if (err == SQLITE_OK)
+        err = PrepareQuery(db, &insert, "INSERT OR REPLACE INTO waveforms(songId, buckets) VALUES (?, ?);");
+
+    std::unique_lock lock(w.mutex);
+    while (err == SQLITE_OK) {
+        w.wake.wait(lock, [&w]() { return w.stop || !w.requests.empty(); });
+        if (w.stop)
+            break;
+
+        std::deque<WaveformRequest> requests;
+        requests.swap(w.requests);
+        lock.unlock();
+        ServeRequests(db, select, insert, requests);
+        lock.lock();
+    }
+    lock.unlock();
+
+    if (err != SQLITE_OK)
+        std::printf("[WAVEFORM] %s\n", sqlite3_errmsg(db));
+    sqlite3_finalize(select);
+    sqlite3_finalize(insert);
+    sqlite3_close(db);
+}
+
+bool StartWaveforms(const char* dbPath) {
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(dbPath, &db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_busy_timeout(db, 1000);
+
+    g_waveforms.stop = false;
+    g_waveforms.thread = std::thread(WaveformMain, db);
+    return true;
+}
+
+void StopWaveforms() {
+    WaveformState& w = g_waveforms;
+    if (!w.thread.joinable())
+        return;
+
+    {
+        std::lock_guard lock(w.mutex);
+        w.stop = true;
+    }
+    w.wake.notify_one();
+    w.thread.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Main thread
+////////////////////////////////////////////////////////////////////////////////
+
+static void Request(const SongEntry& song) {
+    WaveformState& w = g_waveforms;
+    if (!w.thread.joinable() || w.cache.contains(song.id) || w.inFlight.contains(song.id))
+        return;
+
+    w.inFlight.insert(song.id);
+    {
+        std::lock_guard lock(w.mutex);
+        w.requests.push_back({ song.id, song.filename });
+    }
+    w.wake.notify_one();
+}
+
+std::span<const WaveformBucket> GetWaveform(const SongEntry& song) {
+    WaveformState& w = g_waveforms;
+    auto it = w.cache.find(song.id);
+    if (it == w.cache.end()) {
+        Request(song);
+        return {};
+    }
+
+    w.lru.splice(w.lru.begin(), w.lru, it->second.lru);
+    return it->second.buckets;
+}
+
+void PrefetchWaveform(const SongEntry& song) {
+    Request(song);
+}
+
+void UpdateWaveforms() {
+    WaveformState& w = g_waveforms;
+    std::vector<WaveformResult> results;
+    {
+        std::lock_guard lock(w.mutex);
+        results.swap(w.results);
+    }
+
+    for (WaveformResult& result : results) {
+        w.inFlight.erase(result.song);
+        if (w.cache.contains(result.song))
+            continue;
+
+        w.lru.push_front(result.song);
+        w.cache[result.song] = { std::move(result.buckets), w.lru.begin() };
+
+        if (w.cache.size() > WAVEFORM_CACHE_SIZE) {
+            w.cache.erase(w.lru.back());
+            w.lru.pop_back();
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Data.hpp"
+
+// Waveform overviews for the progress bar.
+//
+// Each song is squashed into WAVEFORM_BUCKETS buckets of min/max/RMS,
+// 3 bytes each, so a whole song is 6 KiB in the `waveforms` table.
+// It's computed the first time a song is shown, on the worker pool,
+// and read back from the database every time after that.
+// The last WAVEFORM_CACHE_SIZE songs stay in memory.
+
+constexpr int WAVEFORM_BUCKETS = 2048;
+constexpr size_t WAVEFORM_CACHE_SIZE = 64;
+
+struct WaveformBucket {
+    int8_t min;
+    int8_t max;
+    uint8_t rms;
+};
+
+bool ComputeWaveform(const char* filename, std::vector<WaveformBucket>& out);
+
+// Loading and generating happen on a thread with its own connection.
+bool StartWaveforms(const char* dbPath);
+void StopWaveforms();
+
+// Main thread only from here on.
+
+// Empty until the waveform is ready (or if the song can't be decoded),
+// asks for it if it hasn't been already. Valid until the next UpdateWaveforms.
+std::span<const WaveformBucket> GetWaveform(const SongEntry& song);
+// Same as GetWaveform, without bumping it in the cache.
+void PrefetchWaveform(const SongEntry& song);
+// Picks up finished waveforms. Call once per frame.
+void UpdateWaveforms();
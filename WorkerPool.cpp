@@ -0,0 +1,81 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <latch>
+#include <memory>
+
+WorkerPool::WorkerPool(unsigned int threads)
+    : m_stop(false) {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+
+    for (unsigned int i = 0; i < threads; i++)
+        m_threads.emplace_back(&WorkerPool::WorkerMain, this);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& thread : m_threads)
+        thread.join();
+}
+
+void WorkerPool::Submit(std::function<void()> task) {
+    {
+        std::lock_guard lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_wake.notify_one();
+}
+
+void WorkerPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn) {
+    if (count == 0)
+        return;
+
+    // One task per thread that keep pulling indices, rather than one task
+    // per index, so the queue lock isn't hit for every song.
+    const size_t nTasks = std::min<size_t>(count, m_threads.size());
+    auto next = std::make_shared<std::atomic<size_t>>(0);
+    std::latch done(nTasks);
+
+    for (size_t t = 0; t < nTasks; t++) {
+        Submit([next, count, &fn, &done]() {
+            for (size_t i = (*next)++; i < count; i = (*next)++)
+                fn(i);
+            done.count_down();
+        });
+    }
+
+    done.wait();
+}
+
+unsigned int WorkerPool::Size() const {
+    return m_threads.size();
+}
+
+void WorkerPool::WorkerMain() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            if (m_stop && m_tasks.empty())
+                return;
+
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+WorkerPool& SharedWorkers() {
+    static WorkerPool pool;
+    return pool;
+}
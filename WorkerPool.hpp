@@ -0,0 +1,40 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A plain fixed-size thread pool shared by all the background jobs,
+// so running several of them at once doesn't oversubscribe the machine.
+class WorkerPool {
+ public:
+    // 0 threads means one per hardware thread
+    explicit WorkerPool(unsigned int threads = 0);
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool();
+
+    void Submit(std::function<void()> task);
+
+    // Runs fn(0) .. fn(count - 1) across the pool and blocks until all are done.
+    // Must not be called from inside a pool task.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+    unsigned int Size() const;
+
+ private:
+    void WorkerMain();
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stop;
+};
+
+// Created on first use.
+WorkerPool& SharedWorkers();
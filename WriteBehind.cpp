@@ -0,0 +1,354 @@
+#include "WriteBehind.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include <sqlite3.h>
+
+#include "Library.hpp"
+#include "Ring.hpp"
+#include "Trace.hpp"
+
+constexpr size_t RING_SIZE = 4096;
+constexpr size_t BATCH_SIZE = 256;
+constexpr auto FLUSH_INTERVAL = std::chrono::seconds(2);
+// On shutdown the last batch gets this many goes at a busy database
+constexpr int FINAL_FLUSH_ATTEMPTS = 5;
+
+struct WriteBehindState {
+    SpscRing<DbEvent, RING_SIZE> ring;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop = false;   // guarded by mutex
+    size_t dropped = 0;  // only touched by the producer
+
+    // everything below belongs to the writer thread
+    // Popped off the ring but not committed yet. Events stay here until a
+    // COMMIT goes through, so a busy database only delays them.
+    std::vector<DbEvent> batch;
+    sqlite3* db = nullptr;
+    sqlite3_stmt* insertEvent = nullptr;
+    sqlite3_stmt* markStarted = nullptr;
+    sqlite3_stmt* markCompleted = nullptr;
+    sqlite3_stmt* markSkipped = nullptr;
+    sqlite3_stmt* queueInsert = nullptr;
+    sqlite3_stmt* queueRemove = nullptr;
+    sqlite3_stmt* queueTruncate = nullptr;
+    sqlite3_stmt* queueRespace = nullptr;
+    sqlite3_stmt* queueState = nullptr;
+};
+
+WriteBehindState g_writeBehind;
+
+static int64_t NowMs() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+static int Step(sqlite3_stmt* stmt) {
+    const int err = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return err == SQLITE_DONE ? SQLITE_OK : err;
+}
+
+static int InsertPlayEvent(WriteBehindState& wb, const DbEvent& event) {
+    sqlite3_bind_int64(wb.insertEvent, 1, event.song);
+    sqlite3_bind_int(wb.insertEvent, 2, static_cast<int>(event.type));
+    sqlite3_bind_int64(wb.insertEvent, 3, event.time);
+    sqlite3_bind_int64(wb.insertEvent, 4, event.positionMs);
+    return Step(wb.insertEvent);
+}
+
+// Applies a single event. The per-song counters are bumped right here,
+// so nothing ever has to aggregate over play_events.
+static int Apply(WriteBehindState& wb, const DbEvent& event) {
+    int err = SQLITE_OK;
+
+    switch (event.type) {
+    case DbEventType::PLAY_START: {
+        err = InsertPlayEvent(wb, event);
+        if (err != SQLITE_OK) return err;
+        sqlite3_bind_int64(wb.markStarted, 1, event.song);
+        sqlite3_bind_int64(wb.markStarted, 2, event.time / 1000);
+        return Step(wb.markStarted);
+    }
+    case DbEventType::PLAY_COMPLETE: {
+        err = InsertPlayEvent(wb, event);
+        if (err != SQLITE_OK) return err;
+        sqlite3_bind_int64(wb.markCompleted, 1, event.song);
+        return Step(wb.markCompleted);
+    }
+    case DbEventType::PLAY_SKIP: {
+        err = InsertPlayEvent(wb, event);
+        if (err != SQLITE_OK) return err;
+        sqlite3_bind_int64(wb.markSkipped, 1, event.song);
+        return Step(wb.markSkipped);
+    }
+
+    case DbEventType::QUEUE_INSERT: {
+        sqlite3_bind_int64(wb.queueInsert, 1, event.key);
+        sqlite3_bind_int64(wb.queueInsert, 2, event.song);
+        return Step(wb.queueInsert);
+    }
+    case DbEventType::QUEUE_APPEND: {
+        for (size_t i = 0; err == SQLITE_OK && i < event.songs->size(); i++) {
+            sqlite3_bind_int64(wb.queueInsert, 1, event.key + static_cast<int64_t>(i) * event.value);
+            sqlite3_bind_int64(wb.queueInsert, 2, (*event.songs)[i]);
+            err = Step(wb.queueInsert);
+        }
+        return err;
+    }
+    case DbEventType::QUEUE_REMOVE: {
+        sqlite3_bind_int64(wb.queueRemove, 1, event.key);
+        return Step(wb.queueRemove);
+    }
+    case DbEventType::QUEUE_TRUNCATE: {
+        sqlite3_bind_int64(wb.queueTruncate, 1, event.key);
+        return Step(wb.queueTruncate);
+    }
+    case DbEventType::QUEUE_RESPACE: {
+        sqlite3_bind_int64(wb.queueRespace, 1, event.value);
+        return Step(wb.queueRespace);
+    }
+    case DbEventType::QUEUE_STATE: {
+        sqlite3_bind_int64(wb.queueState, 1, event.key);
+        sqlite3_bind_int64(wb.queueState, 2, event.value);
+        return Step(wb.queueState);
+    }
+
+    case DbEventType::COLLECTION_REBALANCE:
+        return RebalanceCollection(wb.db, event.key);
+    }
+    return SQLITE_OK;
+}
+
+static bool IsBusy(int err) {
+    return (err & 0xff) == SQLITE_BUSY || (err & 0xff) == SQLITE_LOCKED;
+}
+
+static void FreeBatch(WriteBehindState& wb) {
+    for (DbEvent& event : wb.batch)
+        delete event.songs;
+    wb.batch.clear();
+}
+
+// Returns false if the batch is still waiting for the database
+static bool Flush(WriteBehindState& wb) {
+    TRACE_ZONE("Flush");
+    DbEvent event;
+    while (wb.ring.TryPop(event))
+        wb.batch.push_back(event);
+    if (wb.batch.empty())
+        return true;
+
+    int err = sqlite3_exec(wb.db, "BEGIN;", nullptr, nullptr, nullptr);
+    if (err != SQLITE_OK) {
+        // the batch stays, we'll try again next round
+        std::printf("[WRITE BEHIND] Could not begin a transaction: %s\n", sqlite3_errstr(err));
+        return false;
+    }
+
+    for (const DbEvent& pending : wb.batch) {
+        err = Apply(wb, pending);
+        if (err != SQLITE_OK)
+            break;
+    }
+
+    if (err == SQLITE_OK)
+        err = sqlite3_exec(wb.db, "COMMIT;", nullptr, nullptr, nullptr);
+    if (err == SQLITE_OK) {
+        FreeBatch(wb);
+        return true;
+    }
+
+    sqlite3_exec(wb.db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    // Another connection held the lock past the busy timeout. Nothing is
+    // wrong with the events, and the queue ones have to go in in order.
+    if (IsBusy(err)) {
+        std::printf("[WRITE BEHIND] Database is busy, holding %zu events for the next round.\n",
+                    wb.batch.size());
+        return false;
+    }
+
+    std::printf("[WRITE BEHIND] Lost a batch of %zu events: %s\n", wb.batch.size(), sqlite3_errstr(err));
+    FreeBatch(wb);
+    return true;
+}
+
+static void WriterMain() {
+    TRACE_THREAD("write-behind");
+    WriteBehindState& wb = g_writeBehind;
+
+    std::unique_lock lock(wb.mutex);
+    while (!wb.stop) {
+        wb.wake.wait_for(lock, FLUSH_INTERVAL, [&wb]() {
+            return wb.stop || wb.ring.Size() >= BATCH_SIZE;
+        });
+
+        lock.unlock();
+        Flush(wb);
+        lock.lock();
+    }
+    lock.unlock();
+
+    for (int attempt = 1; !Flush(wb); attempt++) {
+        if (attempt == FINAL_FLUSH_ATTEMPTS) {
+            std::printf("[WRITE BEHIND] Gave up on the last %zu events.\n", wb.batch.size());
+            FreeBatch(wb);
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+static void FinalizeStatements(WriteBehindState& wb) {
+    sqlite3_finalize(wb.insertEvent);
+    sqlite3_finalize(wb.markStarted);
+    sqlite3_finalize(wb.markCompleted);
+    sqlite3_finalize(wb.markSkipped);
+    sqlite3_finalize(wb.queueInsert);
+    sqlite3_finalize(wb.queueRemove);
+    sqlite3_finalize(wb.queueTruncate);
+    sqlite3_finalize(wb.queueRespace);
+    sqlite3_finalize(wb.queueState);
+}
+
+bool StartWriteBehind(const char* dbPath) {
+    WriteBehindState& wb = g_writeBehind;
+
+    int err = sqlite3_open_v2(dbPath, &wb.db, SQLITE_OPEN_READWRITE, nullptr);
+    if (err != SQLITE_OK) {
+        sqlite3_close(wb.db);
+        wb.db = nullptr;
+        return false;
+    }
+
+    // the UI connection may hold a read lock for a moment
+    sqlite3_busy_timeout(wb.db, 1000);
+
+    err = PrepareQuery(wb.db, &wb.insertEvent,
+        "INSERT INTO play_events(songId, type, timeMs, positionMs) VALUES (?, ?, ?, ?);");
+    if (err == SQLITE_OK)
+        err = PrepareQuery(wb.db, &wb.markStarted, "UPDATE songs SET lastPlayed = ?2 WHERE rowid = ?1;");
+    if (err == SQLITE_OK)
+        err = PrepareQuery(wb.db, &wb.markCompleted, "UPDATE songs SET playCount = playCount + 1 WHERE rowid = ?;");
+    if (err == SQLITE_OK)
+        err = PrepareQuery(wb.db, &wb.markSkipped, "UPDATE songs SET skipCount = skipCount + 1 WHERE rowid = ?;");
+    if (err == SQLITE_OK)
+        err = PrepareQuery(wb.db, &wb.queueInsert, "INSERT INTO queue_items(position, songId) VALUES (?, ?);");
+    if (err == SQLITE_OK)
+        err = PrepareQuery(wb.db, &wb.queueRemove, "DELETE FROM queue_items WHERE position = ?;");
+    if (err == SQLITE_OK)
+        err = PrepareQuery(wb.db, &wb.queueTruncate, "DELETE FROM queue_items WHERE position >= ?;");
+    if (err == SQLITE_OK)
+        err = PrepareQuery(wb.db, &wb.queueRespace,
+            "UPDATE queue_items SET position = ranked.n * ?1 "
+            "FROM (SELECT rowid AS id, ROW_NUMBER() OVER (ORDER BY position) AS n FROM queue_items) AS ranked "
+            "WHERE queue_items.rowid = ranked.id;");
+    if (err == SQLITE_OK)
+        err = PrepareQuery(wb.db, &wb.queueState, "UPDATE queue_state SET current = ?, repeat = ?;");
+
+    if (err != SQLITE_OK) {
+        std::printf("[WRITE BEHIND] %s\n", sqlite3_errmsg(wb.db));
+        FinalizeStatements(wb);
+        sqlite3_close(wb.db);
+        wb.db = nullptr;
+        return false;
+    }
+
+    wb.stop = false;
+    wb.thread = std::thread(WriterMain);
+    return true;
+}
+
+void StopWriteBehind() {
+    WriteBehindState& wb = g_writeBehind;
+    if (!wb.thread.joinable())
+        return;
+
+    {
+        std::lock_guard lock(wb.mutex);
+        wb.stop = true;
+    }
+    wb.wake.notify_one();
+    wb.thread.join();
+
+    FinalizeStatements(wb);
+    sqlite3_close(wb.db);
+    wb.db = nullptr;
+
+    if (wb.dropped > 0)
+        std::printf("[WRITE BEHIND] %zu events were dropped.\n", wb.dropped);
+}
+
+static void Push(const DbEvent& event) {
+    WriteBehindState& wb = g_writeBehind;
+    if (!wb.thread.joinable()) {
+        delete event.songs;
+        return;
+    }
+
+    if (!wb.ring.TryPush(event)) {
+        delete event.songs;
+        wb.dropped++;
+        return;
+    }
+
+    if (wb.ring.Size() >= BATCH_SIZE)
+        wb.wake.notify_one();
+}
+
+void RecordPlayStart(EntityId song) {
+    Push({
+        .type = DbEventType::PLAY_START,
+        .song = song,
+        .time = NowMs(),
+        .positionMs = 0
+    });
+}
+
+void RecordPlayEnd(EntityId song, float position, bool completed) {
+    Push({
+        .type = completed ? DbEventType::PLAY_COMPLETE : DbEventType::PLAY_SKIP,
+        .song = song,
+        .time = NowMs(),
+        .positionMs = static_cast<int64_t>(position * 1000.0f)
+    });
+}
+
+void RecordQueueInsert(int64_t key, EntityId song) {
+    Push({ .type = DbEventType::QUEUE_INSERT, .song = song, .key = key });
+}
+
+void RecordQueueAppend(int64_t firstKey, int64_t step, std::vector<EntityId>&& songs) {
+    Push({
+        .type = DbEventType::QUEUE_APPEND,
+        .key = firstKey,
+        .value = step,
+        .songs = new std::vector<EntityId>(std::move(songs))
+    });
+}
+
+void RecordQueueRemove(int64_t key) {
+    Push({ .type = DbEventType::QUEUE_REMOVE, .key = key });
+}
+
+void RecordQueueTruncate(int64_t key) {
+    Push({ .type = DbEventType::QUEUE_TRUNCATE, .key = key });
+}
+
+void RecordQueueRespace(int64_t step) {
+    Push({ .type = DbEventType::QUEUE_RESPACE, .value = step });
+}
+
+void RecordQueueState(int64_t currentKey, int repeat) {
+    Push({ .type = DbEventType::QUEUE_STATE, .key = currentKey, .value = repeat });
+}
+
+void RecordRebalance(EntityId collectionId) {
+    Push({ .type = DbEventType::COLLECTION_REBALANCE, .key = collectionId });
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Data.hpp"
+
+// Database writes that the UI thread should never wait on.
+//
+// Events go into a lock-free ring and a background thread with its own
+// sqlite connection drains it, one transaction per batch. A batch is
+// written once enough events pile up or FLUSH_INTERVAL passes, so a burst
+// of track changes costs one fsync, not one per event. A batch that runs
+// into a busy database is kept and tried again, not thrown away.
+//
+// If the ring is ever full the event is dropped rather than stalling
+// the caller. With a ring this size that means the disk is badly stuck.
+
+enum class DbEventType : uint8_t {
+    PLAY_START,
+    PLAY_COMPLETE,
+    PLAY_SKIP,
+
+    // play queue, see Queue.hpp
+    QUEUE_INSERT,
+    QUEUE_APPEND,
+    QUEUE_REMOVE,
+    QUEUE_TRUNCATE,
+    QUEUE_RESPACE,
+    QUEUE_STATE,
+
+    // playlist positions, see Library.hpp
+    COLLECTION_REBALANCE
+};
+
+struct DbEvent {
+    DbEventType type;
+    EntityId song = 0;
+    int64_t time = 0;        // unix time in milliseconds
+    int64_t positionMs = 0;  // how far into the song, if it applies
+    int64_t key = 0;         // queue position, or the collection to rebalance
+    int64_t value = 0;       // QUEUE_STATE: the repeat mode, otherwise the key step
+    // QUEUE_APPEND: owned by the event, freed by the writer thread
+    std::vector<EntityId>* songs = nullptr;
+};
+
+bool StartWriteBehind(const char* dbPath);
+// Writes out everything still queued, then joins the thread.
+void StopWriteBehind();
+
+// These are only to be called from the main thread.
+void RecordPlayStart(EntityId song);
+void RecordPlayEnd(EntityId song, float position, bool completed);
+
+void RecordQueueInsert(int64_t key, EntityId song);
+// songs[i] goes in at firstKey + i * step
+void RecordQueueAppend(int64_t firstKey, int64_t step, std::vector<EntityId>&& songs);
+void RecordQueueRemove(int64_t key);
+// everything at or after `key`
+void RecordQueueTruncate(int64_t key);
+// renumbers every item to (index + 1) * step
+void RecordQueueRespace(int64_t step);
+void RecordQueueState(int64_t currentKey, int repeat);
+
+// Renumbers a collection that's running out of gaps between positions
+void RecordRebalance(EntityId collectionId);
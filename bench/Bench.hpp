@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+// Bits shared by the benchmarks in this directory. Each one is its own
+// executable. They print one line per number, or one JSON object per line
+// with --json so runs can be collected and compared by a script.
+
+inline bool g_benchJson = false;
+
+inline void InitBench(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--json") == 0)
+            g_benchJson = true;
+    }
+}
+
+inline void Report(const char* name, double value, const char* unit) {
+    if (g_benchJson)
+        std::printf("{\"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}\n", name, value, unit);
+    else
+        std::printf("[BENCH] %-44s %12.3f %s\n", name, value, unit);
+}
+
+// Keeps the compiler from deciding a result is unused.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+// Runs `fn` once to warm up, then `runs` times.
+// Returns the fastest run in nanoseconds, which is the least noisy number.
+template <typename Fn>
+double BestOfNs(int runs, Fn&& fn) {
+    using Clock = std::chrono::steady_clock;
+    fn();
+
+    double best = 1e300;
+    for (int i = 0; i < runs; i++) {
+        const auto start = Clock::now();
+        fn();
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (ns < best)
+            best = ns;
+    }
+    return best;
+}
@@ -0,0 +1,84 @@
+// How much the mixing stage costs per second of audio.
+// Playback mixes at most two streams (during a crossfade),
+// the wider ones are here to see how it scales.
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../Mixer.hpp"
+#include "Bench.hpp"
+
+constexpr size_t RATE = 48000;
+constexpr size_t BLOCK_FRAMES = 1024;  // same as the player's chunks
+constexpr int RUNS = 20;
+
+// Plain loop with the same ramp, to see what the vector kernel buys us.
+static void MixScalar(float* out, size_t frames, const MixInput* inputs, size_t count) {
+    for (size_t s = 0; s < count; s++) {
+        const float step = (inputs[s].gainTo - inputs[s].gainFrom) / frames;
+        for (size_t i = 0; i < frames; i++) {
+            const float g = inputs[s].gainFrom + step * i;
+            for (size_t c = 0; c < 2; c++) {
+                const float v = inputs[s].samples[2 * i + c] * g;
+                out[2 * i + c] = s == 0 ? v : out[2 * i + c] + v;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    InitBench(argc, argv);
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    constexpr size_t MAX_STREAMS = 8;
+    std::vector<std::vector<float>> streams(MAX_STREAMS, std::vector<float>(RATE * 2));
+    for (auto& stream : streams) {
+        for (float& x : stream)
+            x = dist(rng);
+    }
+    std::vector<float> out(RATE * 2);
+
+    for (size_t count : { 1, 2, 4, 8 }) {
+        auto mixSecond = [&](bool scalar) {
+            for (size_t frame = 0; frame < RATE; frame += BLOCK_FRAMES) {
+                const size_t n = std::min(BLOCK_FRAMES, RATE - frame);
+                MixInput inputs[MAX_STREAMS];
+                for (size_t s = 0; s < count; s++)
+                    inputs[s] = { streams[s].data() + frame * 2, 0.5f, 0.75f };
+
+                if (scalar)
+                    MixScalar(out.data() + frame * 2, n, inputs, count);
+                else
+                    MixStreams(out.data() + frame * 2, n, std::span(inputs, count));
+            }
+            DoNotOptimize(out[0]);
+        };
+
+        const double simdNs = BestOfNs(RUNS, [&]() { mixSecond(false); });
+        const double scalarNs = BestOfNs(RUNS, [&]() { mixSecond(true); });
+
+        const std::string name = "mix " + std::to_string(count) + " streams";
+        Report((name + ", per second of audio").c_str(), simdNs / 1000.0, "us");
+        Report((name + ", share of one core").c_str(), simdNs / 1e9 * 100.0, "%");
+        Report((name + ", scalar loop").c_str(), scalarNs / 1000.0, "us");
+    }
+
+    // A whole second of crossfade, curves included
+    std::vector<float> incoming(RATE * 2);
+    const double fadeNs = BestOfNs(RUNS, [&]() {
+        incoming = streams[0];
+        for (size_t frame = 0; frame < RATE; frame += BLOCK_FRAMES) {
+            const size_t n = std::min(BLOCK_FRAMES, RATE - frame);
+            CrossfadeFrames(incoming.data() + frame * 2, streams[1].data() + frame * 2, n,
+                            static_cast<float>(frame) / RATE, static_cast<float>(frame + n) / RATE);
+        }
+        DoNotOptimize(incoming[0]);
+    });
+    Report("crossfade, per second of audio", fadeNs / 1000.0, "us");
+
+    return 0;
+}
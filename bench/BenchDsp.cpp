@@ -0,0 +1,124 @@
+// What the DSP chain costs per band, and a sanity check that it does what
+// it says: a band's gain at its centre, and nothing out of the limiter
+// over its ceiling. Exits with 1 if either is off.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <numbers>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../Dsp.hpp"
+#include "Bench.hpp"
+
+constexpr unsigned int RATE = 48000;
+constexpr size_t BLOCK_FRAMES = 1024;  // about what the callback asks for
+constexpr int RUNS = 20;
+
+static void Run(DspChain& chain, std::vector<float>& samples) {
+    for (size_t frame = 0; frame < samples.size() / 2; frame += BLOCK_FRAMES)
+        chain.Process(&samples[2 * frame], std::min(BLOCK_FRAMES, samples.size() / 2 - frame));
+}
+
+static DspSettings WithBands(int bands, float gainDb) {
+    DspSettings settings = DefaultDspSettings();
+    settings.limiter = false;
+    for (int b = 0; b < bands; b++)
+        settings.bands[b].gainDb = gainDb;
+    return settings;
+}
+
+int main(int argc, char** argv) {
+    InitBench(argc, argv);
+    bool ok = true;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-0.25f, 0.25f);
+    std::vector<float> noise(RATE * 2);
+    for (float& x : noise)
+        x = dist(rng);
+
+    double noBandsNs = 0.0;
+    for (int bands : { 0, 1, 5, EQ_BANDS }) {
+        DspChain chain;
+        chain.Set(MakeDspCoefficients(WithBands(bands, 3.0f), RATE));
+        std::vector<float> samples = noise;
+        const double ns = BestOfNs(RUNS, [&]() {
+            samples = noise;
+            Run(chain, samples);
+            DoNotOptimize(samples[0]);
+        });
+
+        const std::string name = std::to_string(bands) + " bands";
+        Report((name + ", per second of audio").c_str(), ns / 1000.0, "us");
+        if (bands == 0)
+            noBandsNs = ns;
+        else
+            Report((name + ", per sample per band").c_str(), (ns - noBandsNs) / (noise.size() * bands), "ns");
+    }
+
+    // Changing the coefficients every block, i.e. always crossfading
+    {
+        DspChain chain;
+        const DspCoefficients a = MakeDspCoefficients(WithBands(EQ_BANDS, 3.0f), RATE);
+        const DspCoefficients b = MakeDspCoefficients(WithBands(EQ_BANDS, -3.0f), RATE);
+        std::vector<float> samples = noise;
+        const double ns = BestOfNs(RUNS, [&]() {
+            samples = noise;
+            for (size_t frame = 0; frame < samples.size() / 2; frame += BLOCK_FRAMES) {
+                chain.Set((frame / BLOCK_FRAMES) % 2 ? a : b);
+                chain.Process(&samples[2 * frame], std::min(BLOCK_FRAMES, samples.size() / 2 - frame));
+            }
+            DoNotOptimize(samples[0]);
+        });
+        Report("10 bands, changed every block", ns / 1000.0, "us");
+    }
+
+    // +6 dB at 1 kHz should come out as +6 dB at 1 kHz
+    {
+        DspSettings settings = WithBands(0, 0.0f);
+        settings.bands[5] = { EqBandType::PEAK, 1000.0f, 6.0f, 1.41f };
+        DspChain chain;
+        chain.Set(MakeDspCoefficients(settings, RATE));
+
+        std::vector<float> sine(RATE * 2);
+        for (size_t i = 0; i < RATE; i++)
+            sine[2 * i] = sine[2 * i + 1] = 0.25f * static_cast<float>(std::sin(2.0 * std::numbers::pi * 1000.0 * i / RATE));
+        Run(chain, sine);
+
+        double energy = 0.0;
+        for (size_t i = RATE / 2; i < RATE; i++)
+            energy += sine[2 * i] * sine[2 * i];
+        const double rms = std::sqrt(energy / (RATE / 2));
+        const double gainDb = 20.0 * std::log10(rms / (0.25 / std::numbers::sqrt2));
+        Report("+6 dB band at its centre", gainDb, "dB");
+        ok = ok && std::fabs(gainDb - 6.0) < 0.1;
+    }
+
+    // Noise pushed 12 dB too hot, nothing may get past the ceiling
+    {
+        DspSettings settings = WithBands(0, 0.0f);
+        settings.preampDb = 12.0f;
+        settings.limiter = true;
+        DspChain chain;
+        const DspCoefficients c = MakeDspCoefficients(settings, RATE);
+        chain.Set(c);
+
+        std::vector<float> samples = noise;
+        for (float& x : samples)
+            x *= 4.0f;
+        Run(chain, samples);
+
+        float peak = 0.0f;
+        for (float x : samples)
+            peak = std::max(peak, std::fabs(x));
+        Report("limiter, loudest sample over the ceiling", 20.0 * std::log10(peak / c.ceiling), "dB");
+        ok = ok && peak <= c.ceiling;
+    }
+
+    if (!ok)
+        std::printf("[BENCH] The DSP chain isn't doing what it should\n");
+    return ok ? 0 : 1;
+}
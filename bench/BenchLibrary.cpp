@@ -0,0 +1,291 @@
+// The database side of riff-man against a made up library: what startup
+// costs (collections from sqlite and from the snapshot), opening the
+// largest, median and smallest collection (the songs join), searching by
+// name and artist, and importing the whole library.
+//
+//   bench-library [--json] [--db PATH] [--songs N] [--collections N] [--seed N]
+//
+// Without --db it generates a library of the given shape (see
+// SyntheticLibrary.hpp) in /tmp and deletes it afterwards. With --db it
+// uses that one; searching adds smart collections to it and deletes them
+// again, so don't point it at a library you care about. Import always
+// uses the --songs/--collections shape.
+//
+// There's no search box yet. The closest thing is a smart collection,
+// which does the one full scan a search would when it's created, so
+// that's what gets timed.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "../Library.hpp"
+#include "../SmartCollections.hpp"
+#include "../Snapshot.hpp"
+#include "Bench.hpp"
+#include "SyntheticLibrary.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int RUNS = 10;
+constexpr int IMPORT_RUNS = 3;  // each one into a fresh database
+
+static double MsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// An empty file in /tmp, sqlite takes that as an empty database
+static std::string TempPath(const char* name) {
+    std::string path = std::string("/tmp/") + name + "-XXXXXX";
+    const int fd = mkstemp(path.data());
+    if (fd < 0)
+        return {};
+    close(fd);
+    return path;
+}
+
+static void RemoveDatabase(const std::string& path) {
+    unlink(path.c_str());
+    unlink((path + "-journal").c_str());
+}
+
+static sqlite3* Open(const std::string& path) {
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+        std::printf("[BENCH] Could not open %s\n", path.c_str());
+        sqlite3_close(db);
+        return nullptr;
+    }
+    return db;
+}
+
+// Songs and playlists inserted into a fresh database, optionally with a
+// few smart collections whose triggers have to look at every song
+static bool BenchImport(const LibraryShape& shape, int smartCollections) {
+    const std::vector<SyntheticSong> songs = MakeSongs(shape);
+    const std::vector<SyntheticCollection> collections = MakeCollections(shape);
+    const SmartRule rules[] = {
+        { SmartField::NAME, SmartOp::CONTAINS, "Love" },
+        { SmartField::NAME, SmartOp::CONTAINS, "夜" },
+        { SmartField::ARTIST, SmartOp::CONTAINS, "Moon" },
+        { SmartField::PLAY_COUNT, SmartOp::GREATER, "10" },
+    };
+
+    double bestSongsMs = 1e300;
+    double bestCollectionsMs = 1e300;
+    for (int run = 0; run < IMPORT_RUNS; run++) {
+        const std::string path = TempPath("bench-import");
+        sqlite3* db = Open(path);
+        if (!db || MigrateSchema(db) != SQLITE_OK)
+            return false;
+        for (int i = 0; i < smartCollections; i++)
+            CreateSmartCollection(db, "smart", std::span(&rules[i % std::size(rules)], 1));
+
+        EntityId firstId;
+        auto start = Clock::now();
+        int err = InsertSongs(db, songs, firstId);
+        bestSongsMs = std::min(bestSongsMs, MsSince(start));
+
+        start = Clock::now();
+        if (err == SQLITE_OK)
+            err = InsertCollections(db, collections, firstId);
+        bestCollectionsMs = std::min(bestCollectionsMs, MsSince(start));
+
+        sqlite3_close(db);
+        RemoveDatabase(path);
+        if (err != SQLITE_OK) {
+            std::printf("[BENCH] Import failed: %s\n", sqlite3_errstr(err));
+            return false;
+        }
+    }
+
+    const std::string prefix = "import/" + std::to_string(smartCollections) + " smart collections/";
+    Report((prefix + "songs").c_str(), bestSongsMs, "ms");
+    Report((prefix + "songs, per song").c_str(), bestSongsMs * 1e3 / std::max(1, shape.songs), "us");
+    if (smartCollections == 0)
+        Report((prefix + "playlists").c_str(), bestCollectionsMs, "ms");
+    return true;
+}
+
+static void BenchStartup(sqlite3* db, const std::string& dbPath) {
+    int count = 0;
+    sqlite3_stmt* stmt;
+    if (PrepareQuery(db, &stmt, "SELECT COUNT(*) FROM collections;") == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+            count = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+
+    Arena<CollectionEntry> collections;
+    collections.Reserve(count + 1);
+    double ns = BestOfNs(RUNS, [&]() {
+        collections.Reset();
+        LoadCollections(db, collections);
+    });
+    Report("startup/LoadCollections, sqlite", ns / 1e6, "ms");
+
+    const std::string snapshotPath = dbPath + ".snapshot";
+    const auto start = Clock::now();
+    if (WriteSnapshot(db, dbPath.c_str(), snapshotPath.c_str()) != SQLITE_OK)
+        return;
+    Report("startup/WriteSnapshot", MsSince(start), "ms");
+
+    // what main does when the snapshot is current
+    ns = BestOfNs(RUNS, [&]() {
+        Snapshot snapshot;
+        if (!MapSnapshot(snapshotPath.c_str(), dbPath.c_str(), snapshot))
+            return;
+        collections.Reset();
+        LoadCollections(snapshot, collections);
+        UnmapSnapshot(snapshot);
+    });
+    Report("startup/LoadCollections, snapshot", ns / 1e6, "ms");
+    unlink(snapshotPath.c_str());
+}
+
+static void BenchOpen(sqlite3* db) {
+    std::vector<std::pair<EntityId, int>> sizes;  // biggest first
+    sqlite3_stmt* stmt;
+    if (PrepareQuery(db, &stmt,
+            "SELECT collectionId, COUNT(*) FROM collections_contents "
+            "GROUP BY collectionId ORDER BY 2 DESC;") != SQLITE_OK)
+        return;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        sizes.push_back({ sqlite3_column_int64(stmt, 0), sqlite3_column_int(stmt, 1) });
+    sqlite3_finalize(stmt);
+    if (sizes.empty())
+        return;
+
+    Arena<SongEntry> songs;
+    songs.Reserve(sizes.front().second + 1);
+
+    const std::pair<const char*, size_t> picks[] = {
+        { "largest", 0 },
+        { "median", sizes.size() / 2 },
+        { "smallest", sizes.size() - 1 }
+    };
+    for (const auto& [name, index] : picks) {
+        const auto [id, rows] = sizes[index];
+        const double ns = BestOfNs(RUNS, [&]() {
+            songs.Reset();
+            LoadCollectionSongs(db, id, songs);
+        });
+
+        const std::string prefix = std::string("open/") + name + " (" + std::to_string(rows) + " songs)/";
+        Report((prefix + "LoadCollectionSongs").c_str(), ns / 1e6, "ms");
+        Report((prefix + "LoadCollectionSongs, per song").c_str(), ns / rows, "ns");
+    }
+}
+
+// The most common artist makes for a search with lots of hits
+static std::string TopArtist(sqlite3* db) {
+    std::string artist;
+    sqlite3_stmt* stmt;
+    if (PrepareQuery(db, &stmt, "SELECT byArtist FROM songs GROUP BY byArtist ORDER BY COUNT(*) DESC LIMIT 1;") != SQLITE_OK)
+        return artist;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        artist = ColumnString(stmt, 0);
+    sqlite3_finalize(stmt);
+    return artist;
+}
+
+static int CountMembers(sqlite3* db, EntityId collectionId) {
+    int count = 0;
+    sqlite3_stmt* stmt;
+    if (PrepareQuery(db, &stmt, "SELECT COUNT(*) FROM collections_contents WHERE collectionId = ?;") != SQLITE_OK)
+        return 0;
+    sqlite3_bind_int64(stmt, 1, collectionId);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        count = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return count;
+}
+
+static void BenchSearch(sqlite3* db) {
+    const std::pair<const char*, SmartRule> searches[] = {
+        { "name contains Latin", { SmartField::NAME, SmartOp::CONTAINS, "Love" } },
+        { "name contains CJK", { SmartField::NAME, SmartOp::CONTAINS, "夜" } },
+        { "name contains Hangul", { SmartField::NAME, SmartOp::CONTAINS, "사랑" } },
+        { "artist equals the top artist", { SmartField::ARTIST, SmartOp::EQUALS, TopArtist(db) } },
+    };
+
+    for (const auto& [name, rule] : searches) {
+        double bestMs = 1e300;
+        int hits = 0;
+        for (int run = 0; run < RUNS; run++) {
+            EntityId id = NO_ENTITY;
+            const auto start = Clock::now();
+            const int err = CreateSmartCollection(db, "bench search", std::span(&rule, 1), &id);
+            bestMs = std::min(bestMs, MsSince(start));
+            if (err != SQLITE_OK) {
+                std::printf("[BENCH] Search failed: %s\n", sqlite3_errstr(err));
+                return;
+            }
+            hits = CountMembers(db, id);
+            DeleteSmartCollection(db, id);
+        }
+
+        const std::string prefix = std::string("search/") + name + " (" + std::to_string(hits) + " hits)";
+        Report(prefix.c_str(), bestMs, "ms");
+    }
+}
+
+int main(int argc, char** argv) {
+    InitBench(argc, argv);
+    LibraryShape shape;
+    std::string dbPath;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], "--db") == 0)
+            dbPath = argv[++i];
+        else if (std::strcmp(argv[i], "--songs") == 0)
+            shape.songs = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--collections") == 0)
+            shape.collections = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--seed") == 0)
+            shape.seed = std::strtoul(argv[++i], nullptr, 10);
+    }
+
+    const bool generated = dbPath.empty();
+    if (generated) {
+        dbPath = TempPath("bench-library");
+        sqlite3* db = Open(dbPath);
+        if (!db)
+            return 1;
+        const auto start = Clock::now();
+        const int err = GenerateLibrary(db, shape);
+        sqlite3_close(db);
+        if (err != SQLITE_OK) {
+            std::printf("[BENCH] Could not generate a library: %s\n", sqlite3_errstr(err));
+            RemoveDatabase(dbPath);
+            return 1;
+        }
+        Report("generate", MsSince(start), "ms");
+    }
+
+    sqlite3* db = Open(dbPath);
+    if (!db)
+        return 1;
+    // same as main
+    sqlite3_busy_timeout(db, 250);
+    MigrateSchema(db);
+
+    BenchStartup(db, dbPath);
+    BenchOpen(db);
+    BenchSearch(db);
+    sqlite3_close(db);
+
+    if (generated)
+        RemoveDatabase(dbPath);
+
+    bool ok = BenchImport(shape, 0);
+    ok = ok && BenchImport(shape, 4);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+// The whole playback chain without a sound card: a few 44.1k songs played
+// back to back through the player (decode, resample to 48k, EQ, limiter)
+// into a null sink that takes audio as fast as the player can make it.
+//
+//   bench-playback [--json] [--crossfade SECONDS] [--wav OUT.wav]
+//
+// --wav keeps the render, which comes out the same every run. Exits with 1
+// if the player underran, if any song wasn't heard for exactly as many
+// frames as it has (less the crossfade), or the render isn't as long as
+// the songs are.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numbers>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../Player.hpp"
+#include "Bench.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+constexpr unsigned int SONG_RATE = 44100;  // so everything goes through the resampler
+constexpr unsigned int PLAYER_RATE = 48000;
+constexpr int SONG_COUNT = 4;
+constexpr unsigned int SONG_SECONDS = 20;
+constexpr double TIMEOUT_SECONDS = 60.0;
+
+std::vector<SongEntry> g_songs;
+
+static const SongEntry* NextSong(const SongEntry* after) {
+    for (size_t i = 0; i + 1 < g_songs.size(); i++) {
+        if (&g_songs[i] == after)
+            return &g_songs[i + 1];
+    }
+    return nullptr;
+}
+
+// 16-bit stereo, a tone that moves around plus a little noise
+static bool WriteSong(const std::string& path, int index) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    const uint32_t frames = SONG_RATE * SONG_SECONDS;
+    const uint32_t dataSize = frames * 2 * sizeof(int16_t);
+    const uint32_t header[] = {
+        0x46464952, 36 + dataSize, 0x45564157,  // "RIFF" size "WAVE"
+        0x20746d66, 16, 0x00020001,             // "fmt " 16, PCM, 2 channels
+        SONG_RATE, SONG_RATE * 4, 0x00100004,   // rate, byte rate, align 4, 16 bits
+        0x61746164, dataSize                    // "data" size
+    };
+    bool ok = std::fwrite(header, sizeof(header), 1, file) == 1;
+
+    std::mt19937 rng(index);
+    std::uniform_real_distribution<float> noise(-0.02f, 0.02f);
+    std::vector<int16_t> samples(frames * 2);
+    const double freq = 220.0 * (index + 1);
+    for (uint32_t i = 0; i < frames; i++) {
+        const double t = static_cast<double>(i) / SONG_RATE;
+        const double tone = 0.4 * std::sin(2.0 * std::numbers::pi * freq * t * (1.0 + 0.01 * std::sin(t)));
+        samples[2 * i] = static_cast<int16_t>((tone + noise(rng)) * 32767.0);
+        samples[2 * i + 1] = static_cast<int16_t>((tone * 0.8 + noise(rng)) * 32767.0);
+    }
+    ok = ok && std::fwrite(samples.data(), sizeof(int16_t), samples.size(), file) == samples.size();
+    return (std::fclose(file) == 0) && ok;
+}
+
+int main(int argc, char** argv) {
+    InitBench(argc, argv);
+    float crossfade = 0.0f;
+    const char* wavPath = nullptr;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], "--crossfade") == 0)
+            crossfade = std::strtof(argv[++i], nullptr);
+        else if (std::strcmp(argv[i], "--wav") == 0)
+            wavPath = argv[++i];
+    }
+
+    char dir[] = "/tmp/riff-man-bench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        std::printf("[BENCH] Can't make a temporary directory\n");
+        return 1;
+    }
+
+    g_songs.resize(SONG_COUNT);
+    for (int i = 0; i < SONG_COUNT; i++) {
+        SongEntry& song = g_songs[i];
+        song.id = 1000 + i;
+        song.filename = std::string(dir) + "/" + std::to_string(i) + ".wav";
+        song.name = "Song " + std::to_string(i);
+        song.entryId = NO_ENTITY;
+        if (!WriteSong(song.filename, i)) {
+            std::printf("[BENCH] Can't write %s\n", song.filename.c_str());
+            return 1;
+        }
+    }
+
+    const OutputConfig output{
+        .kind = wavPath ? OutputKind::WAV : OutputKind::NULL_SINK,
+        .realtime = false,
+        .wavPath = wavPath
+    };
+    if (!InitPlayer(NextSong, output))
+        return 1;
+
+    DspSettings dsp = PlayerDsp();
+    for (int b = 0; b < EQ_BANDS; b++)
+        dsp.bands[b].gainDb = (b % 3) - 1.0f;
+    SetPlayerDsp(dsp);
+    SetCrossfade(crossfade);
+
+    // every song but the last hands over where the fade starts, same
+    // rounding and limits as the player
+    const uint64_t songFrames = static_cast<uint64_t>(SONG_SECONDS) * PLAYER_RATE;
+    const uint64_t fadeFrames = std::min<uint64_t>(static_cast<uint64_t>(std::min(crossfade, MAX_CROSSFADE_SECONDS) * PLAYER_RATE),
+                                                   songFrames / 2);
+
+    const auto start = Clock::now();
+    PlaySong(g_songs[0]);
+    bool finished = false;
+    double seconds = 0.0;
+    int transitions = 0;
+    int wrongLength = 0;
+    double worstHitchMs = 0.0;
+    double totalHitchMs = 0.0;
+    while (!finished && seconds < TIMEOUT_SECONDS) {
+        const PlayerEvent event = UpdatePlayer();
+        finished = event == PlayerEvent::FINISHED;
+        if (event == PlayerEvent::ADVANCED || finished) {
+            const PlayerTransition& transition = PlayerLastTransition();
+            const uint64_t expected = finished ? songFrames : songFrames - fadeFrames;
+            if (transition.frames != expected) {
+                std::printf("[BENCH] Song %d was heard for %llu frames, expected %llu\n", transitions,
+                            static_cast<unsigned long long>(transition.frames),
+                            static_cast<unsigned long long>(expected));
+                wrongLength++;
+            }
+            if (event == PlayerEvent::ADVANCED) {
+                worstHitchMs = std::max(worstHitchMs, transition.hitchMs);
+                totalHitchMs += transition.hitchMs;
+            }
+            transitions++;
+        }
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (!finished)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const uint64_t underruns = PlayerUnderruns();
+    const uint64_t rendered = OutputFrames();
+    ShutdownPlayer();
+
+    for (const SongEntry& song : g_songs)
+        unlink(song.filename.c_str());
+    rmdir(dir);
+
+    if (!finished) {
+        std::printf("[BENCH] Playback didn't finish within %.0f s\n", TIMEOUT_SECONDS);
+        return 1;
+    }
+
+    // each transition with a crossfade overlaps the songs by that much
+    const double audioSeconds = static_cast<double>(SONG_COUNT) * SONG_SECONDS -
+                                (SONG_COUNT - 1) * std::min<double>(crossfade, MAX_CROSSFADE_SECONDS);
+    const double renderedSeconds = static_cast<double>(rendered) / PLAYER_RATE;
+    Report("audio rendered", renderedSeconds, "s");
+    Report("wall time", seconds * 1000.0, "ms");
+    Report("per second of audio", seconds * 1000.0 / renderedSeconds, "ms");
+    Report("faster than real time", renderedSeconds / seconds, "x");
+    Report("underruns", static_cast<double>(underruns), "");
+    // on the main thread, for the UpdatePlayer call that reported it
+    if (transitions > 1) {
+        Report("transition hitch, worst", worstHitchMs, "ms");
+        Report("transition hitch, mean", totalHitchMs / (transitions - 1), "ms");
+    }
+
+    // the sink works in whole periods, and a crossfade can't be longer than what's left of a song
+    const bool ok = underruns == 0 && wrongLength == 0 && transitions == SONG_COUNT &&
+                    std::fabs(renderedSeconds - audioSeconds) < 0.05;
+    if (!ok)
+        std::printf("[BENCH] Expected %.3f s of audio in %d songs without underruns\n", audioSeconds, SONG_COUNT);
+    return ok ? 0 : 1;
+}
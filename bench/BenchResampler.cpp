@@ -0,0 +1,136 @@
+// What resampling to the device rate costs, and how clean it is.
+//
+// Quality is THD+N on pure sines: resample, fit the sine that should come
+// out, and compare what's left over against it. Exits with 1 if any of
+// them is worse than QUALITY_LIMIT, so this doubles as a check.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <numbers>
+#include <string>
+#include <vector>
+
+#include "../Resampler.hpp"
+#include "Bench.hpp"
+
+constexpr unsigned int OUT_RATE = 48000;
+constexpr size_t BLOCK_FRAMES = 1024;  // same as the player's scratch buffer
+constexpr int RUNS = 10;
+constexpr double QUALITY_LIMIT = -80.0;  // dB
+
+static std::vector<float> Sine(unsigned int rate, double freq, double seconds) {
+    const size_t frames = static_cast<size_t>(rate * seconds);
+    std::vector<float> out(frames * 2);
+    for (size_t i = 0; i < frames; i++) {
+        const float x = 0.5f * static_cast<float>(std::sin(2.0 * std::numbers::pi * freq * i / rate));
+        out[2 * i] = x;
+        out[2 * i + 1] = x;
+    }
+    return out;
+}
+
+// Pushes everything through in player-sized blocks
+static std::vector<float> Run(Resampler& resampler, const std::vector<float>& in) {
+    std::vector<float> out(resampler.OutputFrames(in.size() / 2) * 2 + 2 * BLOCK_FRAMES);
+    size_t produced = 0;
+    resampler.Reset();
+    for (size_t frame = 0; frame < in.size() / 2; frame += BLOCK_FRAMES) {
+        resampler.Push(&in[2 * frame], std::min(BLOCK_FRAMES, in.size() / 2 - frame));
+        produced += resampler.Pull(&out[2 * produced], out.size() / 2 - produced);
+    }
+    resampler.Finish();
+    produced += resampler.Pull(&out[2 * produced], out.size() / 2 - produced);
+    out.resize(2 * produced);
+    return out;
+}
+
+// Least squares fit of a sine at `freq` (plus DC) to the left channel,
+// ignoring the edges. Returns residual over fit, in dB.
+static double ThdPlusNoise(const std::vector<float>& out, double freq) {
+    const size_t frames = out.size() / 2;
+    const size_t from = frames / 8;
+    const size_t to = frames - frames / 8;
+
+    // normal equations for [sin, cos, 1]
+    double m[3][3] = {};
+    double v[3] = {};
+    for (size_t i = from; i < to; i++) {
+        const double phase = 2.0 * std::numbers::pi * freq * i / OUT_RATE;
+        const double basis[3] = { std::sin(phase), std::cos(phase), 1.0 };
+        for (int r = 0; r < 3; r++) {
+            v[r] += basis[r] * out[2 * i];
+            for (int c = 0; c < 3; c++)
+                m[r][c] += basis[r] * basis[c];
+        }
+    }
+    // Gauss-Jordan, it's 3x3
+    for (int p = 0; p < 3; p++) {
+        for (int r = 0; r < 3; r++) {
+            if (r == p)
+                continue;
+            const double f = m[r][p] / m[p][p];
+            for (int c = 0; c < 3; c++)
+                m[r][c] -= f * m[p][c];
+            v[r] -= f * v[p];
+        }
+    }
+    const double a = v[0] / m[0][0];
+    const double b = v[1] / m[1][1];
+    const double dc = v[2] / m[2][2];
+
+    double signal = 0.0;
+    double residual = 0.0;
+    for (size_t i = from; i < to; i++) {
+        const double phase = 2.0 * std::numbers::pi * freq * i / OUT_RATE;
+        const double fit = a * std::sin(phase) + b * std::cos(phase) + dc;
+        signal += fit * fit;
+        residual += (out[2 * i] - fit) * (out[2 * i] - fit);
+    }
+    return 10.0 * std::log10(residual / signal);
+}
+
+int main(int argc, char** argv) {
+    InitBench(argc, argv);
+    bool ok = true;
+
+    for (unsigned int inRate : { 44100u, 88200u, 96000u, 32000u }) {
+        Resampler resampler(inRate, OUT_RATE);
+        const std::string name = std::to_string(inRate) + " -> " + std::to_string(OUT_RATE);
+
+        const std::vector<float> second = Sine(inRate, 997.0, 1.0);
+        const double ns = BestOfNs(RUNS, [&]() {
+            const std::vector<float> out = Run(resampler, second);
+            DoNotOptimize(out[0]);
+        });
+        Report((name + ", per second of audio").c_str(), ns / 1000.0, "us");
+        Report((name + ", share of one core").c_str(), ns / 1e9 * 100.0, "%");
+
+        // low, and high up in the passband (10 kHz for CD audio). Not a
+        // quarter of either rate, that repeats every 4 samples and
+        // hides whatever the interpolation does between them.
+        const double high = 0.23 * std::min(inRate, OUT_RATE);
+        for (double freq : { 997.0, high }) {
+            const double thdn = ThdPlusNoise(Run(resampler, Sine(inRate, freq, 2.0)), freq);
+            Report((name + ", THD+N at " + std::to_string(static_cast<int>(freq)) + " Hz").c_str(), thdn, "dB");
+            ok = ok && thdn < QUALITY_LIMIT;
+        }
+
+        // Anything over the output's Nyquist has to go, not fold back down
+        if (inRate > OUT_RATE) {
+            const double freq = 0.25 * (inRate + OUT_RATE);
+            const std::vector<float> out = Run(resampler, Sine(inRate, freq, 2.0));
+            double energy = 0.0;
+            for (size_t i = out.size() / 8; i < out.size() - out.size() / 8; i++)
+                energy += out[i] * out[i];
+            const double rms = std::sqrt(energy / (out.size() - out.size() / 4));
+            const double rejection = 20.0 * std::log10(rms / (0.5 / std::numbers::sqrt2));
+            Report((name + ", left of " + std::to_string(static_cast<int>(freq)) + " Hz").c_str(), rejection, "dB");
+            ok = ok && rejection < QUALITY_LIMIT;
+        }
+    }
+
+    if (!ok)
+        std::printf("[BENCH] Resampler quality is worse than %.0f dB\n", QUALITY_LIMIT);
+    return ok ? 0 : 1;
+}
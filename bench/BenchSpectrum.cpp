@@ -0,0 +1,38 @@
+// What the spectrum panel costs. It analyzes SPECTRUM_HZ times a second
+// no matter what, so this is its whole budget. Exits with 1 if that's
+// more than BUDGET of a core.
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "../Spectrum.hpp"
+#include "Bench.hpp"
+
+constexpr unsigned int RATE = 48000;
+constexpr int RUNS = 200;
+constexpr double BUDGET = 1.0;  // % of one core
+
+int main(int argc, char** argv) {
+    InitBench(argc, argv);
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+    std::vector<float> mono(SPECTRUM_FFT_SIZE);
+    for (float& x : mono)
+        x = dist(rng);
+
+    SpectrumAnalyzer analyzer = MakeSpectrumAnalyzer(RATE);
+    const double ns = BestOfNs(RUNS, [&]() {
+        AnalyzeSpectrum(analyzer, mono.data(), 1.0f / SPECTRUM_HZ);
+        DoNotOptimize(analyzer.bars[0]);
+    });
+
+    const double share = ns * SPECTRUM_HZ / 1e9 * 100.0;
+    Report("analysis, per frame", ns / 1000.0, "us");
+    Report("analysis, share of one core", share, "%");
+
+    if (share > BUDGET)
+        std::printf("[BENCH] The spectrum is over its budget of %.1f%% of a core\n", BUDGET);
+    return share > BUDGET ? 1 : 0;
+}
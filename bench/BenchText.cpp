@@ -0,0 +1,219 @@
+// The text and layout hot paths: measuring, shaping and rasterizing,
+// building the ASCII atlas, blitting UTF-8 text into the canvas, the ASCII
+// check RenderFrame does per string, and MakeLayout over 10, 1k and 100k
+// song rows. Text comes out of three fixed corpora (Latin, CJK and mixed)
+// so runs on different commits see the same input.
+//
+//   bench-text [--json] [--font PATH]
+//
+// Needs a display, raylib only hands out textures with a (hidden) window.
+
+#include <raylib.h>
+#define CLAY_IMPLEMENTATION
+#include <clay.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../Layout.hpp"
+#include "../Renderer.hpp"
+#include "../TextUtils.hpp"
+#include "Bench.hpp"
+
+// Same as main.cpp
+constexpr const char* DEFAULT_FONT_PATH = "/usr/share/fonts/noto-cjk/NotoSansCJK-Regular.ttc";
+constexpr int FONT_PIXELS = 20;
+constexpr int WINDOW_WIDTH = 960;
+constexpr int WINDOW_HEIGHT = 540;
+constexpr int RUNS = 10;
+constexpr int TEXT_REPS = 20;  // times through a corpus per run
+
+struct Corpus {
+    const char* name;
+    std::vector<std::string> strings;
+};
+
+static const std::vector<Corpus> g_corpora = {
+    { "latin", {
+        "Midnight Drive", "The Long Way Home (Extended Mix)", "Paper Lanterns", "Static",
+        "Ghosts of the Northern Line", "A", "Interlude No. 3", "Summer, Again",
+        "Everything Is Fine - Live at the Roundhouse", "Cold Open", "Velvet", "Counting Trains",
+        "Another Song About the Ocean", "Lights Out, Words Gone", "Oh!", "Hold On (Radio Edit)"
+    } },
+    { "cjk", {
+        "夜に駆ける", "群青", "春はゆく", "紅蓮華", "ただ声一つ", "怪物", "残響散歌", "水平線",
+        "光るなら", "月光", "打上花火", "猫", "千本桜", "小夜子", "花に亡霊", "海の幽霊"
+    } },
+    { "mixed", {
+        "夜に駆ける (Yoru ni Kakeru)", "Stellar Stellar - 星街すいせい", "Lemon", "KICK BACK",
+        "アイドル / YOASOBI", "Mr. Blue Sky", "ギターと孤独と蒼い惑星", "Unravel (TK from 凛として時雨)",
+        "Plastic Love - 竹内まりや", "Ado - 唱", "Bling-Bang-Bang-Born", "Cry Baby (Official髭男dism)",
+        "青と夏 - Mrs. GREEN APPLE", "Shinunoga E-Wa", "ドライフラワー (Dry Flower)", "Tokyo Flash"
+    } },
+};
+
+static Clay_StringSlice Slice(const std::string& str) {
+    return {
+        .length = static_cast<int32_t>(str.size()),
+        .chars = str.c_str(),
+        .baseChars = str.c_str()
+    };
+}
+
+// clay copies its limits out of the current context when it makes a new
+// one, so the old one has to stay around until then
+void* g_clayMemory = nullptr;
+
+static void ClayError(Clay_ErrorData errorData) {
+    std::printf("[CLAY ERROR] %s\n", errorData.errorText.chars);
+    std::exit(1);
+}
+
+static void BenchStrings(const Corpus& corpus, TextRenderContext& textCtx, TextMeasureContext& measureCtx) {
+    const double perString = static_cast<double>(TEXT_REPS) * corpus.strings.size();
+    const std::string prefix = std::string("text/") + corpus.name + "/";
+
+    double ns = BestOfNs(RUNS, [&]() {
+        for (int rep = 0; rep < TEXT_REPS; rep++) {
+            for (const std::string& str : corpus.strings)
+                DoNotOptimize(MeasureText(Slice(str), nullptr, &measureCtx));
+        }
+    });
+    Report((prefix + "MeasureText, per string").c_str(), ns / perString, "ns");
+
+    ns = BestOfNs(RUNS, [&]() {
+        for (int rep = 0; rep < TEXT_REPS; rep++) {
+            for (const std::string& str : corpus.strings)
+                DoNotOptimize(RenderText(str, textCtx));
+        }
+    });
+    Report((prefix + "RenderText, per string").c_str(), ns / perString, "ns");
+
+    // The warm-up run fills the renderer's text cache, so this is just the blit
+    ns = BestOfNs(RUNS, [&]() {
+        for (int rep = 0; rep < TEXT_REPS; rep++) {
+            int y = 0;
+            for (const std::string& str : corpus.strings) {
+                DrawTextUTF8(textCtx, Slice(str), 16, y);
+                y = (y + FONT_PIXELS) % (WINDOW_HEIGHT - FONT_PIXELS);
+            }
+        }
+    });
+    Report((prefix + "DrawTextUTF8 blit, per string").c_str(), ns / perString, "ns");
+
+    ns = BestOfNs(RUNS, [&]() {
+        for (int rep = 0; rep < TEXT_REPS; rep++) {
+            for (const std::string& str : corpus.strings)
+                DoNotOptimize(IsASCII(Slice(str)));
+        }
+    });
+    Report((prefix + "IsASCII, per string").c_str(), ns / perString, "ns");
+}
+
+// Rows are named from the mixed corpus, the way a real library looks
+static void BenchLayout(int rows, TextMeasureContext& measureCtx) {
+    std::vector<SongEntry> songs(rows);
+    const auto& names = g_corpora[2].strings;
+    for (int i = 0; i < rows; i++) {
+        songs[i].id = i + 1;
+        songs[i].name = names[i % names.size()];
+        songs[i].entryId = NO_ENTITY;
+    }
+    std::vector<CollectionEntry> collections(8);
+    for (size_t i = 0; i < collections.size(); i++)
+        collections[i] = { static_cast<EntityId>(i + 1), "Collection " + std::to_string(i + 1), false };
+
+    // a wrapper, a button and its text per row, plus the rest of the screen
+    Clay_SetMaxElementCount(4 * rows + 1024);
+    Clay_SetMaxMeasureTextCacheWordCount(8 * rows + 16384);
+    const uint64_t arenaSize = Clay_MinMemorySize();
+    void* memory = std::malloc(arenaSize);
+    Clay_Initialize(Clay_CreateArenaWithCapacityAndMemory(arenaSize, memory),
+                    { static_cast<float>(WINDOW_WIDTH), static_cast<float>(WINDOW_HEIGHT) },
+                    { .errorHandlerFunction = ClayError, .userData = nullptr });
+    Clay_SetMeasureTextFunction(MeasureText, &measureCtx);
+    std::free(g_clayMemory);
+    g_clayMemory = memory;
+
+    const LayoutRequest request{
+        .state = { .metadata = &songs[0], .duration = 215.0f, .currTime = 73.0f, .finished = false },
+        .songs = songs,
+        .collections = collections,
+        .waveform = {},
+        .spectrum = {},
+        .pointer = { -1.0f, -1.0f }
+    };
+
+    // clay measures every word once and caches it, so the first layout is
+    // what a freshly loaded collection costs and the rest is steady state
+    const std::string prefix = "layout/" + std::to_string(rows) + " rows/";
+    const auto start = std::chrono::steady_clock::now();
+    DoNotOptimize(MakeLayout(request));
+    const double firstNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    Report((prefix + "MakeLayout, first").c_str(), firstNs / 1e6, "ms");
+
+    const double ns = BestOfNs(RUNS, [&]() { DoNotOptimize(MakeLayout(request)); });
+    Report((prefix + "MakeLayout").c_str(), ns / 1e6, "ms");
+    Report((prefix + "MakeLayout, per row").c_str(), ns / rows, "ns");
+}
+
+int main(int argc, char** argv) {
+    InitBench(argc, argv);
+    const char* fontPath = DEFAULT_FONT_PATH;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], "--font") == 0)
+            fontPath = argv[i + 1];
+    }
+
+    SetTraceLogLevel(LOG_WARNING);
+    SetConfigFlags(FLAG_WINDOW_HIDDEN);
+    InitWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "bench-text");
+    InitRenderer(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    FT_Library ft;
+    if (FT_Init_FreeType(&ft))
+        return 1;
+
+    TextRenderContext textCtx;
+    TextMeasureContext measureCtx;
+    if (FT_New_Face(ft, fontPath, 0, &textCtx.face) || FT_New_Face(ft, fontPath, 0, &measureCtx.face)) {
+        std::printf("[BENCH] Could not open %s, pass one with --font\n", fontPath);
+        return 1;
+    }
+    FT_Set_Pixel_Sizes(textCtx.face, FONT_PIXELS, FONT_PIXELS);
+    FT_Set_Pixel_Sizes(measureCtx.face, FONT_PIXELS, FONT_PIXELS);
+    textCtx.rq = raqm_create();
+    measureCtx.rq = raqm_create();
+
+    // A fresh atlas every time, LoadGlyphs doesn't free the texture it replaces
+    const double atlasNs = BestOfNs(RUNS, [&]() {
+        ASCIIAtlas atlas;
+        DoNotOptimize(atlas.LoadGlyphs(textCtx.face));
+    });
+    Report("text/ASCIIAtlas::LoadGlyphs", atlasNs / 1e6, "ms");
+
+    textCtx.atlas.LoadGlyphs(textCtx.face);
+    measureCtx.lineHeight = textCtx.atlas.GetMaxHeight();
+
+    for (const Corpus& corpus : g_corpora)
+        BenchStrings(corpus, textCtx, measureCtx);
+
+    InitLayoutArenas(1024, 256);
+    for (int rows : { 10, 1000, 100000 })
+        BenchLayout(rows, measureCtx);
+    std::free(g_clayMemory);
+
+    raqm_destroy(measureCtx.rq);
+    raqm_destroy(textCtx.rq);
+    FT_Done_Face(measureCtx.face);
+    FT_Done_Face(textCtx.face);
+    FT_Done_FreeType(ft);
+    CloseWindow();
+    return 0;
+}
@@ -0,0 +1,71 @@
+// Writes a made up library (see SyntheticLibrary.hpp) to a new database,
+// for poking at the schema and queries at sizes nobody has on hand.
+//
+//   generate-library OUT.db [--songs N] [--collections N] [--artists N]
+//                           [--largest N] [--zipf S] [--seed N]
+//
+// OUT.db must not exist yet. Point riff-man at it by copying it over
+// riff-man.db in a scratch directory.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include <sqlite3.h>
+
+#include "SyntheticLibrary.hpp"
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argv[1][0] == '-') {
+        std::printf("usage: %s OUT.db [--songs N] [--collections N] [--artists N] "
+                    "[--largest N] [--zipf S] [--seed N]\n", argv[0]);
+        return 1;
+    }
+    const char* path = argv[1];
+
+    LibraryShape shape;
+    for (int i = 2; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], "--songs") == 0)
+            shape.songs = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--collections") == 0)
+            shape.collections = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--artists") == 0)
+            shape.artists = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--largest") == 0)
+            shape.largestCollection = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--zipf") == 0)
+            shape.zipf = std::strtod(argv[++i], nullptr);
+        else if (std::strcmp(argv[i], "--seed") == 0)
+            shape.seed = std::strtoul(argv[++i], nullptr, 10);
+    }
+
+    // Nobody's real library is getting overwritten by this
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        std::printf("[GENERATE] %s already exists\n", path);
+        return 1;
+    }
+
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+        std::printf("[GENERATE] Could not create %s\n", path);
+        sqlite3_close(db);
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const int err = GenerateLibrary(db, shape);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    sqlite3_close(db);
+
+    if (err != SQLITE_OK) {
+        std::printf("[GENERATE] Failed: %s\n", sqlite3_errstr(err));
+        return 1;
+    }
+    std::printf("[GENERATE] %d songs and %d collections (seed %u) in %s, %.0f ms\n",
+                shape.songs, shape.collections, shape.seed, path, ms);
+    return 0;
+}
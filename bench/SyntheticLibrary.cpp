@@ -0,0 +1,228 @@
+#include "SyntheticLibrary.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <string_view>
+
+#include "../Library.hpp"
+
+enum class Script {
+    LATIN,
+    JAPANESE,
+    KOREAN,
+    CYRILLIC,
+    MIXED  // Japanese with a romanized/translated part in brackets
+};
+
+constexpr std::string_view LATIN_WORDS[] = {
+    "Midnight", "Drive", "Paper", "Lanterns", "Static", "Ghosts", "Northern", "Line", "Summer",
+    "Again", "Velvet", "Trains", "Ocean", "Lights", "Out", "Hold", "On", "Cold", "Open", "Blue",
+    "Sky", "Love", "Plastic", "Echo", "River", "Glass", "Heart", "Fire", "Golden", "Hour", "Neon",
+    "Rain", "City", "Dreams", "Wild", "Silver", "Sun", "Moon", "Shadow", "Home", "Broken", "Radio"
+};
+constexpr std::string_view JAPANESE_WORDS[] = {
+    "夜", "に", "駆ける", "群青", "春", "はゆく", "紅蓮華", "声", "怪物", "残響", "散歌", "水平線",
+    "光る", "なら", "月光", "打上花火", "猫", "千本桜", "小夜子", "花", "亡霊", "海", "の", "幽霊",
+    "ギター", "と", "孤独", "蒼い", "惑星", "アイドル", "ドライフラワー", "青", "夏", "東京"
+};
+constexpr std::string_view KOREAN_WORDS[] = {
+    "사랑", "밤", "하늘", "별", "바다", "너의", "이름", "봄날", "꿈", "소리", "우리", "노래", "다시", "비", "눈"
+};
+constexpr std::string_view CYRILLIC_WORDS[] = {
+    "Звезда", "Ночь", "Город", "Песня", "Море", "Ветер", "Любовь", "Зима", "Белый", "Дорога",
+    "Небо", "Солнце", "Тишина", "Река", "Огни"
+};
+constexpr std::string_view SUFFIXES[] = { " (Remix)", " - Live", " (Acoustic)", " (Radio Edit)", " (Demo)" };
+
+// Roughly what a library from the west with a taste for J-pop looks like
+constexpr double SCRIPT_WEIGHTS[] = { 60.0, 22.0, 5.0, 5.0, 8.0 };
+
+// Empty means NULL, an older import that goes by the extension
+constexpr std::string_view FORMATS[] = { "mp3", "opus", "ogg", "wav", "" };
+constexpr std::string_view EXTENSIONS[] = { "mp3", "opus", "ogg", "wav", "mp3" };
+constexpr double FORMAT_WEIGHTS[] = { 50.0, 20.0, 10.0, 5.0, 15.0 };
+
+template <size_t N>
+static std::string_view Pick(const std::string_view (&words)[N], std::mt19937& rng) {
+    return words[std::uniform_int_distribution<size_t>(0, N - 1)(rng)];
+}
+
+template <size_t N>
+static std::string Words(const std::string_view (&words)[N], int count, std::string_view separator,
+                         std::mt19937& rng) {
+    std::string out;
+    for (int i = 0; i < count; i++) {
+        if (i > 0)
+            out += separator;
+        out += Pick(words, rng);
+    }
+    return out;
+}
+
+static std::string MakeTitle(Script script, int minWords, int maxWords, std::mt19937& rng) {
+    const int count = std::uniform_int_distribution<int>(minWords, maxWords)(rng);
+    switch (script) {
+    case Script::LATIN:    return Words(LATIN_WORDS, count, " ", rng);
+    case Script::JAPANESE: return Words(JAPANESE_WORDS, count, "", rng);
+    case Script::KOREAN:   return Words(KOREAN_WORDS, count, " ", rng);
+    case Script::CYRILLIC: return Words(CYRILLIC_WORDS, count, " ", rng);
+    case Script::MIXED:
+        return Words(JAPANESE_WORDS, count, "", rng) + " (" + Words(LATIN_WORDS, count, " ", rng) + ")";
+    }
+    return {};
+}
+
+static Script PickScript(std::mt19937& rng) {
+    std::discrete_distribution<int> dist(std::begin(SCRIPT_WEIGHTS), std::end(SCRIPT_WEIGHTS));
+    return static_cast<Script>(dist(rng));
+}
+
+// Weights 1/rank^s, for picking ranks 0..count-1
+static std::discrete_distribution<int> Zipf(int count, double s) {
+    std::vector<double> weights(count);
+    for (int r = 0; r < count; r++)
+        weights[r] = 1.0 / std::pow(r + 1, s);
+    return std::discrete_distribution<int>(weights.begin(), weights.end());
+}
+
+static int ArtistCount(const LibraryShape& shape) {
+    return std::max(1, shape.artists > 0 ? shape.artists : shape.songs / 10);
+}
+
+std::vector<SyntheticSong> MakeSongs(const LibraryShape& shape) {
+    std::mt19937 rng(shape.seed);
+
+    std::vector<std::string> artists(ArtistCount(shape));
+    for (std::string& artist : artists)
+        artist = MakeTitle(PickScript(rng), 1, 2, rng);
+
+    std::discrete_distribution<int> artistDist = Zipf(static_cast<int>(artists.size()), shape.zipf);
+    std::discrete_distribution<int> formatDist(std::begin(FORMAT_WEIGHTS), std::end(FORMAT_WEIGHTS));
+    std::bernoulli_distribution suffixDist(0.05);
+
+    std::vector<SyntheticSong> songs(std::max(0, shape.songs));
+    for (SyntheticSong& song : songs) {
+        song.byArtist = artists[artistDist(rng)];
+        song.name = MakeTitle(PickScript(rng), 1, 4, rng);
+        if (suffixDist(rng))
+            song.name += Pick(SUFFIXES, rng);
+
+        const int format = formatDist(rng);
+        song.fileFormat = FORMATS[format];
+        song.filename = "/music/" + song.byArtist + "/" + song.name + "." + std::string(EXTENSIONS[format]);
+    }
+    return songs;
+}
+
+std::vector<SyntheticCollection> MakeCollections(const LibraryShape& shape) {
+    std::mt19937 rng(shape.seed + 1);
+    const int largest = std::clamp(shape.largestCollection > 0 ? shape.largestCollection : shape.songs / 4,
+                                   1, std::max(1, shape.songs));
+
+    // Size by rank, then shuffled so rowid says nothing about size
+    std::vector<int> sizes(std::max(0, shape.collections));
+    for (size_t k = 0; k < sizes.size(); k++)
+        sizes[k] = std::max(1, static_cast<int>(std::lround(largest / std::pow(k + 1, shape.zipf))));
+    std::shuffle(sizes.begin(), sizes.end(), rng);
+
+    std::vector<int> everything(std::max(0, shape.songs));
+    std::iota(everything.begin(), everything.end(), 0);
+
+    std::vector<SyntheticCollection> collections(sizes.size());
+    for (size_t i = 0; i < collections.size(); i++) {
+        SyntheticCollection& coll = collections[i];
+        coll.name = MakeTitle(PickScript(rng), 1, 3, rng);
+        coll.songs.reserve(sizes[i]);
+        std::sample(everything.begin(), everything.end(), std::back_inserter(coll.songs), sizes[i], rng);
+        std::shuffle(coll.songs.begin(), coll.songs.end(), rng);
+    }
+    return collections;
+}
+
+static int Rollback(sqlite3* db, sqlite3_stmt* stmt, int err) {
+    sqlite3_finalize(stmt);
+    sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    return err;
+}
+
+int InsertSongs(sqlite3* db, std::span<const SyntheticSong> songs, EntityId& firstId) {
+    int err = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+    if (err != SQLITE_OK) return err;
+
+    sqlite3_stmt* stmt;
+    err = PrepareQuery(db, &stmt, "INSERT INTO songs(filename, fileFormat, name, byArtist) VALUES (?, ?, ?, ?);");
+    if (err != SQLITE_OK) return Rollback(db, nullptr, err);
+
+    firstId = NO_ENTITY;
+    for (const SyntheticSong& song : songs) {
+        sqlite3_bind_text(stmt, 1, song.filename.data(), song.filename.size(), SQLITE_STATIC);
+        if (song.fileFormat.empty())
+            sqlite3_bind_null(stmt, 2);
+        else
+            sqlite3_bind_text(stmt, 2, song.fileFormat.data(), song.fileFormat.size(), SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, song.name.data(), song.name.size(), SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, song.byArtist.data(), song.byArtist.size(), SQLITE_STATIC);
+
+        err = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (err != SQLITE_DONE) return Rollback(db, stmt, err);
+        if (firstId == NO_ENTITY)
+            firstId = sqlite3_last_insert_rowid(db);
+    }
+
+    sqlite3_finalize(stmt);
+    return sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+}
+
+int InsertCollections(sqlite3* db, std::span<const SyntheticCollection> collections, EntityId firstSongId) {
+    int err = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+    if (err != SQLITE_OK) return err;
+
+    sqlite3_stmt* collStmt;
+    err = PrepareQuery(db, &collStmt, "INSERT INTO collections(name) VALUES (?);");
+    if (err != SQLITE_OK) return Rollback(db, nullptr, err);
+
+    sqlite3_stmt* memberStmt;
+    err = PrepareQuery(db, &memberStmt,
+        "INSERT INTO collections_contents(collectionId, songId, position) VALUES (?, ?, ?);");
+    if (err != SQLITE_OK) return Rollback(db, collStmt, err);
+
+    for (const SyntheticCollection& coll : collections) {
+        sqlite3_bind_text(collStmt, 1, coll.name.data(), coll.name.size(), SQLITE_STATIC);
+        err = sqlite3_step(collStmt);
+        sqlite3_reset(collStmt);
+        if (err != SQLITE_DONE) {
+            sqlite3_finalize(memberStmt);
+            return Rollback(db, collStmt, err);
+        }
+        const EntityId collectionId = sqlite3_last_insert_rowid(db);
+
+        for (size_t i = 0; i < coll.songs.size(); i++) {
+            sqlite3_bind_int64(memberStmt, 1, collectionId);
+            sqlite3_bind_int64(memberStmt, 2, firstSongId + coll.songs[i]);
+            sqlite3_bind_int64(memberStmt, 3, static_cast<long int>(i + 1) * POSITION_GAP);
+            err = sqlite3_step(memberStmt);
+            sqlite3_reset(memberStmt);
+            if (err != SQLITE_DONE) {
+                sqlite3_finalize(collStmt);
+                return Rollback(db, memberStmt, err);
+            }
+        }
+    }
+
+    sqlite3_finalize(memberStmt);
+    sqlite3_finalize(collStmt);
+    return sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+}
+
+int GenerateLibrary(sqlite3* db, const LibraryShape& shape) {
+    int err = MigrateSchema(db);
+    if (err != SQLITE_OK) return err;
+
+    EntityId firstId = NO_ENTITY;
+    err = InsertSongs(db, MakeSongs(shape), firstId);
+    if (err != SQLITE_OK) return err;
+    return InsertCollections(db, MakeCollections(shape), firstId);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "../Data.hpp"
+
+// Made up libraries for bench-library and generate-library, since nobody is
+// handing over their real one. Same shape and seed, same library.
+//
+// The data is meant to look like a real library:
+// * Titles and artists are mostly Latin, with a good share of Japanese and
+//   some Korean, Cyrillic and mixed-script titles.
+// * Artists release many songs each, and a few artists own most of the
+//   library. Popularity is Zipfian.
+// * Playlist sizes are Zipfian too: a couple of huge ones and a long tail
+//   of small ones. Songs land in playlists at random.
+
+struct LibraryShape {
+    int songs = 10000;
+    int collections = 200;
+    int artists = 0;             // 0 means songs / 10
+    int largestCollection = 0;   // 0 means songs / 4
+    double zipf = 1.1;           // exponent for artist popularity and playlist sizes
+    uint32_t seed = 1;
+};
+
+struct SyntheticSong {
+    std::string filename;
+    std::string fileFormat;
+    std::string name;
+    std::string byArtist;
+};
+
+struct SyntheticCollection {
+    std::string name;
+    std::vector<int> songs;  // indices into the song list, in playlist order
+};
+
+std::vector<SyntheticSong> MakeSongs(const LibraryShape& shape);
+std::vector<SyntheticCollection> MakeCollections(const LibraryShape& shape);
+
+// What an import does: every song in one transaction. `firstId` gets the
+// rowid of the first one, the rest follow on from it.
+int InsertSongs(sqlite3* db, std::span<const SyntheticSong> songs, EntityId& firstId);
+// Playlists go in POSITION_GAP apart, like InsertIntoCollection would
+// leave them, just without going through it one row at a time.
+int InsertCollections(sqlite3* db, std::span<const SyntheticCollection> collections, EntityId firstSongId);
+
+// Migrates an empty database and fills it
+int GenerateLibrary(sqlite3* db, const LibraryShape& shape);
@@ -5,6 +5,8 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <cmath>
@@ -12,29 +14,31 @@
 #include <string_view>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "Allocators.hpp"
 #include "Casts.hpp"
 #include "Data.hpp"
 #include "Defer.hpp"
+#include "Fingerprint.hpp"
+#include "HeadCache.hpp"
+#include "Latency.hpp"
 #include "Layout.hpp"
+#include "Library.hpp"
+#include "Loudness.hpp"
+#include "Player.hpp"
+#include "Profiler.hpp"
+#include "Queue.hpp"
+#include "SeekIndex.hpp"
 #include "Renderer.hpp"
+#include "SmartCollections.hpp"
+#include "Snapshot.hpp"
+#include "Spectrum.hpp"
 #include "TextUtils.hpp"
-
-void LoadSong(PlaybackState& state, const SongEntry& song) {
-    if (IsMusicValid(state.audioBuffer)) {
-        StopMusicStream(state.audioBuffer);
-        UnloadMusicStream(state.audioBuffer);
-    }
-
-    state.audioBuffer = LoadMusicStream(song.filename.c_str());
-    state.metadata = &song;
-    state.duration = GetMusicTimeLength(state.audioBuffer);
-    state.currTime = 0.0f;
-
-    PlayMusicStream(state.audioBuffer);
-}
+#include "Trace.hpp"
+#include "Waveform.hpp"
+#include "WriteBehind.hpp"
 
 Clay_Dimensions GetScreenDimensions() {
     return {
@@ -47,28 +51,48 @@ void ClayError(Clay_ErrorData errorData) {
     std::printf("[CLAY ERROR] %s\n", errorData.errorText.chars);
 }
 
-void LogSQLiteCallback(void*, int errCode, const char* msg) {
-    std::printf("[SQLITE] %s: %s\n", sqlite3_errstr(errCode), msg);
-}
-
-std::string ColumnString(sqlite3_stmt* stmt, int col) {
-    return std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, col)));
-}
-
-int PrepareQuery(sqlite3* db, sqlite3_stmt** stmt, std::string_view query) {
-    return sqlite3_prepare_v2(db, query.data(), query.size() + 1, stmt, nullptr);
-}; 
-
 #define EXIT_ON_FT_ERR(err) if (err) { FTPrintError(err); return 1; }
 
+constexpr const char* DB_PATH = "riff-man.db";
+constexpr const char* SNAPSHOT_PATH = "riff-man.snapshot";
+constexpr const char* HEAD_CACHE_DIR = "riff-man.heads";
+// ~170 songs' worth at 2 s each
+constexpr uint64_t HEAD_CACHE_BYTES = 64ull << 20;
+// TODO: these should not be hardcoded
+constexpr const char* FONT_PATH = "/usr/share/fonts/noto-cjk/NotoSansCJK-Regular.ttc";
+constexpr int FONT_PIXELS = 20;
+// How often the frame timings get printed
+constexpr int FRAME_STATS_INTERVAL = 300;
+// Shift+L and quitting write the latency percentiles here
+constexpr const char* LATENCY_DUMP_PATH = "riff-man.latency.json";
+// T or SIGUSR1 write the trace zones here
+constexpr const char* TRACE_DUMP_PATH = "riff-man.trace.json";
+
+using FrameClock = std::chrono::steady_clock;
+using Ms = std::chrono::duration<double, std::milli>;
+
 Arena<CollectionEntry> collections;
 Arena<SongEntry> collectionSongs;
-Arena<SongEntry> queueSongs;
+
+// Starts whatever the queue now considers current.
+void PlayCurrentSong(PlaybackState& state) {
+    if (state.metadata && !state.finished && PlayerSong())
+        RecordPlayEnd(state.metadata->id, state.currTime, false);
+
+    state.metadata = QueueCurrentSong();
+    state.finished = false;
+    // the player goes quiet until the new song is open
+    if (state.metadata)
+        PlaySong(*state.metadata);
+}
 
 int main() {
+    const auto startupTime = std::chrono::steady_clock::now();
+    TRACE_THREAD("main");
+    InstallTraceSignal();
+
     collections.Reserve(1024);
     collectionSongs.Reserve(512);
-    queueSongs.Reserve(512);
     InitLayoutArenas(1024, 256);
     
     // Init Raylib
@@ -97,19 +121,69 @@ int main() {
  
     constexpr int dbFlags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
     sqlite3* db = nullptr;
-    int err = sqlite3_open_v2("riff-man.db", &db, dbFlags, nullptr);
+    int err = sqlite3_open_v2(DB_PATH, &db, dbFlags, nullptr);
     if (err != SQLITE_OK) return 1;
 
-    const auto sqliteReleaser([&db](){ sqlite3_close(db); });
+    const auto sqliteReleaser = Defer([&db](){ sqlite3_close(db); });
 
-    err = sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS songs(filename TEXT, fileFormat TEXT, name TEXT, byArtist TEXT);", nullptr, nullptr, nullptr);
-    if (err != SQLITE_OK) return 1;
+    // the write-behind thread has its own connection
+    sqlite3_busy_timeout(db, 250);
+    ProfileSqlite(db);
 
-    err = sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS collections(name TEXT);", nullptr, nullptr, nullptr);
+    err = MigrateSchema(db);
     if (err != SQLITE_OK) return 1;
 
-    err = sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS collections_contents(collectionId INTEGER, songId INTEGER);", nullptr, nullptr, nullptr);
+    // If the snapshot is still current we never have to step through sqlite
+    // to get the library into memory. Otherwise, it gets rebuilt on exit
+    // (and if it stays current, restamped then).
+    // This has to happen before the background jobs start writing, see
+    // Snapshot.hpp.
+    Snapshot snapshot;
+    if (!MapSnapshot(SNAPSHOT_PATH, DB_PATH, snapshot))
+        std::printf("[SNAPSHOT] Missing or stale, loading from the database.\n");
+
+    const auto snapshotReleaser = Defer([&db, &snapshot](){
+        const bool stale = !IsSnapshotCurrent(snapshot);
+        UnmapSnapshot(snapshot);
+        if (stale)
+            WriteSnapshot(db, DB_PATH, SNAPSHOT_PATH);
+        else
+            RestampSnapshot(DB_PATH, SNAPSHOT_PATH);
+    });
+
+    // Play history is not worth refusing to start over.
+    // (This releaser runs before the snapshot one, so the snapshot
+    // gets to see the last batch of history.)
+    if (!StartWriteBehind(DB_PATH))
+        std::printf("[WRITE BEHIND] Could not start, play history will not be recorded.\n");
+    const auto writeBehindReleaser = Defer([](){ StopWriteBehind(); });
+
+    // Duplicate detection chews through the library in the background.
+    // Stopping only waits for the batch in flight, the rest resumes next launch.
+    StartFingerprintJob(DB_PATH);
+    const auto fingerprintReleaser = Defer([](){ StopFingerprintJob(); });
+
+    // Same deal for loudness. Songs play at their measured gain
+    // as soon as they have one.
+    err = LoadLoudness(db);
     if (err != SQLITE_OK) return 1;
+    StartLoudnessJob(DB_PATH);
+    const auto loudnessReleaser = Defer([](){ StopLoudnessJob(); });
+
+    // Without this the progress bar just doesn't get a waveform
+    if (!StartWaveforms(DB_PATH))
+        std::printf("[WAVEFORM] Could not start.\n");
+    const auto waveformReleaser = Defer([](){ StopWaveforms(); });
+
+    // Without this every MP3 seek decodes from the start of the file
+    if (!OpenSeekIndexes(DB_PATH))
+        std::printf("[SEEK INDEX] Could not open, seeking will be slow.\n");
+    const auto seekIndexReleaser = Defer([](){ CloseSeekIndexes(); });
+
+    // Recently played songs start from here while their file is being opened
+    if (!OpenHeadCache(HEAD_CACHE_DIR, HEAD_CACHE_BYTES))
+        std::printf("[HEAD CACHE] Could not open %s, songs will start from their files.\n", HEAD_CACHE_DIR);
+    const auto headCacheReleaser = Defer([](){ CloseHeadCache(); });
 
     // Init FreeType
     FT_Library ft;
@@ -120,62 +194,147 @@ int main() {
 
     // Init text rendering utilities
     TextRenderContext textCtx;
-    err = FT_New_Face(ft, "/usr/share/fonts/noto-cjk/NotoSansCJK-Regular.ttc", 0, &textCtx.face);
+    err = FT_New_Face(ft, FONT_PATH, 0, &textCtx.face);
     EXIT_ON_FT_ERR(err);
 
     const auto faceReleaser = Defer([&textCtx](){ FT_Done_Face(textCtx.face); });
 
-    // TODO: this should not be hardcoded
-    err = FT_Set_Pixel_Sizes(textCtx.face, 20, 20);
+    err = FT_Set_Pixel_Sizes(textCtx.face, FONT_PIXELS, FONT_PIXELS);
     EXIT_ON_FT_ERR(err);
 
     textCtx.atlas.LoadGlyphs(textCtx.face);
     textCtx.rq = raqm_create();
     const auto raqmReleaser = Defer([&textCtx](){ raqm_destroy(textCtx.rq); });
 
-    Clay_SetMeasureTextFunction(MeasureText, &textCtx);
+    // Text gets measured on the layout thread while the renderer draws,
+    // a face and raqm_t can't be used from both at once.
+    TextMeasureContext measureCtx;
+    err = FT_New_Face(ft, FONT_PATH, 0, &measureCtx.face);
+    EXIT_ON_FT_ERR(err);
 
-    sqlite3_stmt* stmt;
-    err = PrepareQuery(db, &stmt, "SELECT rowid, * FROM collections;");
-    if (err != SQLITE_OK) return 1;
+    const auto measureFaceReleaser = Defer([&measureCtx](){ FT_Done_Face(measureCtx.face); });
+
+    err = FT_Set_Pixel_Sizes(measureCtx.face, FONT_PIXELS, FONT_PIXELS);
+    EXIT_ON_FT_ERR(err);
+
+    measureCtx.rq = raqm_create();
+    const auto measureRaqmReleaser = Defer([&measureCtx](){ raqm_destroy(measureCtx.rq); });
+    measureCtx.lineHeight = textCtx.atlas.GetMaxHeight();
 
-    while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
-        int i = collections.Allocate();
-        EntityId id = sqlite3_column_int64(stmt, 0);
+    Clay_SetMeasureTextFunction(MeasureText, &measureCtx);
 
-        collections.arr[i].id = id;
-        collections.arr[i].name = ColumnString(stmt, 1);
+    StartLayoutThread();
+    const auto layoutReleaser = Defer([](){ StopLayoutThread(); });
+
+    if (IsSnapshotCurrent(snapshot)) {
+        LoadCollections(snapshot, collections);
+    } else {
+        err = LoadCollections(db, collections);
+        if (err != SQLITE_OK) return 1;
     }
 
-    sqlite3_finalize(stmt);
+    err = LoadQueue(db);
+    if (err != SQLITE_OK) return 1;
+
+    // No sound card shouldn't mean no library, the songs just go nowhere
+    if (!InitPlayer(QueueNextSong))
+        InitPlayer(QueueNextSong, { .kind = OutputKind::NULL_SINK });
+    const auto playerReleaser = Defer([](){ ShutdownPlayer(); });
+
+    StartSpectrum(PlayerSampleRate());
+    SetPlaybackTap(TapSpectrum);
+    const auto spectrumReleaser = Defer([](){
+        SetPlaybackTap(nullptr);
+        StopSpectrum();
+    });
 
+    // whatever was current last time is shown, but not played
     PlaybackState state{
-        .audioBuffer = {},
-        .metadata = nullptr,
+        .metadata = QueueCurrentSong(),
         .duration = 0.0f,
-        .currTime = 0.0f
+        .currTime = 0.0f,
+        .finished = false
     };
 
     LayoutInput inputNm0{
         .songIndex = -1,
-        .collectionIndex = -1
+        .collectionIndex = -1,
+        .seekFraction = -1.0f
     };
     LayoutInput inputNm1{
         .songIndex = -1,
-        .collectionIndex = -1
+        .collectionIndex = -1,
+        .seekFraction = -1.0f
+    };
+
+    // Frame N is laid out into one of these while N-1 is drawn from the other
+    LayoutFrame frames[2];
+    int layoutSlot = 0;
+    bool haveFrame = false;
+
+    // When the input each of those frames was made from got polled (at the
+    // end of the previous EndDrawing), and whether it had a click in it
+    struct {
+        FrameClock::time_point inputAt;
+        bool clicked;
+    } frameInputs[2] = {};
+    FrameClock::time_point polledAt = FrameClock::now();
+    FrameClock::time_point inputAt = polledAt;
+    bool latencyOverlay = false;
+    bool profilerOverlay = false;
+
+    // Songs started by input get timed until they're audible
+    bool awaitingAudio = false;
+    double inputToPlayMs = 0.0;
+    const auto playFromInput = [&]() {
+        PlayCurrentSong(state);
+        awaitingAudio = state.metadata != nullptr;
+        inputToPlayMs = Ms(FrameClock::now() - inputAt).count();
     };
 
+    // Summed over FRAME_STATS_INTERVAL frames, in ms
+    struct {
+        int frames = 0;
+        double update = 0.0;
+        double layout = 0.0;
+        double render = 0.0;
+        double present = 0.0;
+        double wait = 0.0;
+    } frameStats;
+
+    int eqPreset = 0;
     int selectedCollectionIndex = -1;
     int selectedSongIndex = -1;
     bool clayDebugEnabled = false;
+    bool firstFrameDone = false;
 
     while (!WindowShouldClose()) {
+        TRACE_ZONE("Frame");
+        const auto frameStart = FrameClock::now();
+        inputAt = polledAt;
+
         // Phase 1: input state updates
         if (IsKeyPressed(KEY_D)) {
             clayDebugEnabled = !clayDebugEnabled;
             Clay_SetDebugModeEnabled(clayDebugEnabled);
         }
 
+        // L shows the latency overlay, Shift+L writes the numbers out
+        if (IsKeyPressed(KEY_L)) {
+            if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT)) {
+                if (DumpLatency(LATENCY_DUMP_PATH))
+                    std::printf("[LATENCY] Wrote %s\n", LATENCY_DUMP_PATH);
+            } else {
+                latencyOverlay = !latencyOverlay;
+            }
+        }
+
+        if (IsKeyPressed(KEY_P))
+            profilerOverlay = !profilerOverlay;
+
+        if (IsKeyPressed(KEY_T) || TakeTraceRequest())
+            DumpTrace(TRACE_DUMP_PATH);
+
         const auto mousePosition = casts::clay::Vector2(GetMousePosition());
         const auto mouseWheelDelta = casts::clay::Vector2(GetMouseWheelMoveV());
 
@@ -188,72 +347,289 @@ int main() {
         // When this is enabled, it will probably cause weird issues
         // where songs are selected by releasing the touch scroll.
         Clay_UpdateScrollContainers(false, mouseWheelDelta, GetFrameTime());
-        
+        const auto inputEnd = FrameClock::now();
+
         // Phase 2: application state updates
+        // A busy or broken database shouldn't close the window, whatever
+        // the user did just doesn't happen.
         if (IsMouseButtonReleased(0) &&
                 inputNm0.collectionIndex != -1 &&
                 inputNm0.collectionIndex != selectedCollectionIndex) {
             selectedCollectionIndex = inputNm0.collectionIndex;
             collectionSongs.Reset();
-            int collId = collections.arr[selectedCollectionIndex].id;
-
-            err = PrepareQuery(db, &stmt, "SELECT songs.rowid, songs.* FROM collections_contents INNER JOIN songs ON collections_contents.songId = songs.rowid WHERE collections_contents.collectionId = ?;");
-            if (err != SQLITE_OK) return 1;
+            EntityId collId = collections.arr[selectedCollectionIndex].id;
 
-            err = sqlite3_bind_int64(stmt, 1, collId);
-            if (err != SQLITE_OK) return 1;
+            if (collections.arr[selectedCollectionIndex].smart) {
+                err = RefreshSmartCollection(db, collId);
+                if (err != SQLITE_OK)
+                    std::printf("[LIBRARY] Could not refresh smart collection %ld: %s\n", collId, sqlite3_errstr(err));
+            }
 
-            while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
-                int i = collectionSongs.Allocate();
-                // note that SQLite tables are 1-indexed
-                EntityId id = sqlite3_column_int64(stmt, 0);
+            // smart collections follow play counts, the snapshot can't keep up
+            if (collections.arr[selectedCollectionIndex].smart ||
+                    !IsSnapshotCurrent(snapshot) ||
+                    !LoadCollectionSongs(snapshot, collId, collectionSongs)) {
+                err = LoadCollectionSongs(db, collId, collectionSongs);
+                if (err != SQLITE_OK) {
+                    std::printf("[LIBRARY] Could not load collection %ld: %s\n", collId, sqlite3_errstr(err));
+                    collectionSongs.Reset();
+                }
+            }
+        }
 
-                collectionSongs.arr[i].id = id;
-                collectionSongs.arr[i].filename = ColumnString(stmt, 1);
-                collectionSongs.arr[i].fileFormat = AudioFormat::MP3;           // TODO: bad
-                collectionSongs.arr[i].name = ColumnString(stmt, 3);
-                collectionSongs.arr[i].byArtist = ColumnString(stmt, 4);
+        // Ctrl+Up/Down nudges the hovered song within the open playlist.
+        // Only the moved row gets written, see MoveInCollection.
+        const bool ctrlDown = IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
+        const int hoveredSong = inputNm0.songIndex;
+        if (ctrlDown && hoveredSong != -1) {
+            int swapWith = -1;
+            EntityId before = NO_ENTITY;
+            if (IsKeyPressed(KEY_UP) && hoveredSong > 0) {
+                swapWith = hoveredSong - 1;
+                before = collectionSongs.arr[swapWith].entryId;
+            } else if (IsKeyPressed(KEY_DOWN) && hoveredSong + 1 < collectionSongs.top) {
+                swapWith = hoveredSong + 1;
+                if (swapWith + 1 < collectionSongs.top)
+                    before = collectionSongs.arr[swapWith + 1].entryId;
             }
 
-            sqlite3_finalize(stmt);
+            if (swapWith != -1) {
+                err = MoveInCollection(db, collectionSongs.arr[hoveredSong].entryId, before);
+                if (err != SQLITE_OK) {
+                    std::printf("[LIBRARY] Could not move the song: %s\n", sqlite3_errstr(err));
+                } else {
+                    MarkSnapshotStale(snapshot);
+                    std::swap(collectionSongs.arr[hoveredSong], collectionSongs.arr[swapWith]);
+                    if (selectedSongIndex == hoveredSong)
+                        selectedSongIndex = swapWith;
+                    else if (selectedSongIndex == swapWith)
+                        selectedSongIndex = hoveredSong;
+                }
+            }
         }
 
+        // A playlist running low on gaps gets renumbered in the background.
+        // If a gap runs out before then, MoveInCollection renumbers on the spot.
+        EntityId rebalance;
+        if (TakePendingRebalance(rebalance))
+            RecordRebalance(rebalance);
+
         if (IsMouseButtonReleased(0) &&
                 inputNm0.songIndex != -1 &&
                 inputNm0.songIndex != selectedSongIndex) {
             selectedSongIndex = inputNm0.songIndex;
-            // TODO: proper queue needed
-            queueSongs.Reset();
-            int i = queueSongs.Allocate();
 
-            // this copy is STRICTLY NECESSARY
-            queueSongs.arr[i] = collectionSongs.arr[selectedSongIndex];
+            // Clicking a song queues up the rest of the open collection from there.
+            // Whatever was already played stays behind it as history.
+            std::vector<EntityId> ids;
+            ids.reserve(collectionSongs.top - selectedSongIndex);
+            for (int i = selectedSongIndex; i < collectionSongs.top; i++)
+                ids.push_back(collectionSongs.arr[i].id);
+            QueueReplace(ids);
+            playFromInput();
+        }
+
+        // E queues the hovered song at the end, N right after the current one.
+        if (!ctrlDown && hoveredSong != -1) {
+            if (IsKeyPressed(KEY_E)) {
+                QueueEnqueue(collectionSongs.arr[hoveredSong].id);
+                RefreshNextSong();
+            } else if (IsKeyPressed(KEY_N)) {
+                QueuePlayNext(collectionSongs.arr[hoveredSong].id);
+                RefreshNextSong();
+            }
+        }
+
+        if (IsKeyPressed(KEY_R)) {
+            // OFF -> ALL -> ONE -> OFF
+            QueueSetRepeat(static_cast<RepeatMode>((static_cast<int>(QueueRepeat()) + 1) % 3));
+            RefreshNextSong();
+        }
 
-            LoadSong(state, queueSongs.arr[i]);
+        // G cycles loudness normalization: off, per track, per album.
+        // Takes effect from the next song that gets opened.
+        if (IsKeyPressed(KEY_G)) {
+            static constexpr const char* names[] = { "off", "track", "album" };
+            const int mode = (static_cast<int>(CurrentGainMode()) + 1) % 3;
+            SetGainMode(static_cast<GainMode>(mode));
+            std::printf("[PLAYER] Normalization %s\n", names[mode]);
         }
 
-        if (IsMusicValid(state.audioBuffer)) {
-            UpdateMusicStream(state.audioBuffer);
-            state.currTime = GetMusicTimePlayed(state.audioBuffer);
+        // Q cycles through a few EQ curves. The preamp comes down by the
+        // biggest boost so they don't just lean on the limiter.
+        if (IsKeyPressed(KEY_Q)) {
+            static constexpr const char* names[] = { "flat", "bass", "treble", "vocal" };
+            static constexpr float curves[][EQ_BANDS] = {
+                { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+                { 6, 5, 3, 1, 0, 0, 0, 0, 0, 0 },
+                { 0, 0, 0, 0, 0, 0, 1, 3, 5, 6 },
+                { -2, -2, -1, 0, 2, 3, 3, 1, 0, 0 }
+            };
+            eqPreset = (eqPreset + 1) % 4;
+
+            DspSettings dsp = PlayerDsp();
+            dsp.preampDb = 0.0f;
+            for (int b = 0; b < EQ_BANDS; b++) {
+                dsp.bands[b].gainDb = curves[eqPreset][b];
+                dsp.preampDb = std::min(dsp.preampDb, -curves[eqPreset][b]);
+            }
+            SetPlayerDsp(dsp);
+            std::printf("[PLAYER] EQ %s\n", names[eqPreset]);
+        }
+
+        // [ and ] set the crossfade, a second at a time
+        if (IsKeyPressed(KEY_LEFT_BRACKET) || IsKeyPressed(KEY_RIGHT_BRACKET)) {
+            SetCrossfade(PlayerCrossfade() + (IsKeyPressed(KEY_RIGHT_BRACKET) ? 1.0f : -1.0f));
+            std::printf("[PLAYER] Crossfade %.0f s\n", PlayerCrossfade());
+        }
+
+        if ((IsKeyPressed(KEY_PAGE_UP) && QueuePrevious()) ||
+                (IsKeyPressed(KEY_PAGE_DOWN) && QueueSkip()))
+            playFromInput();
+
+        // Space also (re)starts the current song when nothing is playing,
+        // e.g. right after startup.
+        if (!ctrlDown && IsKeyPressed(KEY_SPACE) && state.metadata) {
+            if (!PlayerSong() || state.finished)
+                playFromInput();
+            else if (PlayerPaused())
+                ResumePlayer();
+            else
+                PausePlayer();
+        }
+
+        if (state.metadata && !state.finished && !ctrlDown) {
+            if (IsKeyPressed(KEY_LEFT))
+                SeekPlayer(state.currTime - 5.0f);
+            if (IsKeyPressed(KEY_RIGHT))
+                SeekPlayer(state.currTime + 5.0f);
+
+            // Clicking the progress bar jumps straight there
+            if (IsMouseButtonReleased(0) && inputNm0.seekFraction >= 0.0f && PlayerSong())
+                SeekPlayer(inputNm0.seekFraction * state.duration);
         }
 
-        // Phase 3: layout
+        switch (UpdatePlayer()) {
+        case PlayerEvent::STARTED:
+            RecordPlayStart(state.metadata->id);
+            if (awaitingAudio) {
+                RecordLatency(LatencyStage::CLICK_TO_AUDIO, inputToPlayMs + PlayerStartLatencyMs());
+                awaitingAudio = false;
+            }
+            break;
+        case PlayerEvent::ADVANCED:
+            RecordPlayEnd(state.metadata->id, state.duration, true);
+            state.metadata = PlayerSong();
+            QueueFollow(state.metadata);
+            RecordPlayStart(state.metadata->id);
+            break;
+        case PlayerEvent::FINISHED:
+            state.finished = true;
+            RecordPlayEnd(state.metadata->id, state.duration, true);
+            break;
+        case PlayerEvent::NONE:
+            break;
+        }
+        state.currTime = PlayerTime();
+        state.duration = PlayerDuration();
+
+        UpdateWaveforms();
+        std::span<const WaveformBucket> waveform;
+        if (state.metadata)
+            waveform = GetWaveform(*state.metadata);
+
+        // Phase 3: layout, on the layout thread
         // MakeLayout will implicitly update input state.
         // We consider this to be part of next frame's phase 1.
+        const auto layoutStart = FrameClock::now();
         Clay_SetLayoutDimensions(GetScreenDimensions());
-        const LayoutResult layout = MakeLayout(state,
-                                               collectionSongs.Span(),
-                                               collections.Span());
+        LayoutFrame& layout = frames[layoutSlot];
+        StartLayout({
+            .state = state,
+            .songs = collectionSongs.Span(),
+            .collections = collections.Span(),
+            .waveform = waveform,
+            .spectrum = GetSpectrum(),
+            .pointer = mousePosition
+        }, layout);
+        frameInputs[layoutSlot] = { inputAt, IsMouseButtonPressed(0) || IsMouseButtonReleased(0) };
+
+        // Phase 4: render the previous frame's layout in the meantime.
+        // It owns its copy of everything, phase 2 can't have pulled anything
+        // out from under it.
+        auto renderEnd = layoutStart;
+        auto presentEnd = layoutStart;
+        if (haveFrame) {
+            BeginDrawing();
+            ClearBackground(BLACK);
+            RenderFrame(frames[layoutSlot ^ 1].RenderCommands(), textCtx);
+            if (latencyOverlay)
+                DrawLatencyOverlay(8, 8);
+            if (profilerOverlay)
+                DrawProfilerOverlay();
+            renderEnd = FrameClock::now();
+            EndDrawing();
+            presentEnd = FrameClock::now();
+            polledAt = presentEnd;
+
+            const auto& shown = frameInputs[layoutSlot ^ 1];
+            RecordLatency(LatencyStage::SUBMIT, Ms(renderEnd - shown.inputAt).count());
+            RecordLatency(LatencyStage::SWAP, Ms(presentEnd - shown.inputAt).count());
+            if (shown.clicked)
+                RecordLatency(LatencyStage::CLICK_TO_PHOTON, Ms(presentEnd - shown.inputAt).count());
+
+            if (!firstFrameDone) {
+                firstFrameDone = true;
+                const Ms elapsed = presentEnd - startupTime;
+                std::printf("[STARTUP] First frame after %.1f ms\n", elapsed.count());
+            }
+        }
 
+        FinishLayout();
+        const auto frameEnd = FrameClock::now();
+        RecordLatency(LatencyStage::UPDATE, Ms(layoutStart - inputAt).count());
+        RecordLatency(LatencyStage::LAYOUT, Ms(layout.doneAt - inputAt).count());
+
+        FrameProfile profile{
+            .frameMs = static_cast<float>(Ms(frameEnd - frameStart).count()),
+            .phaseMs = {
+                static_cast<float>(Ms(inputEnd - frameStart).count()),
+                static_cast<float>(Ms(layoutStart - inputEnd).count()),
+                layout.layoutMs,
+                static_cast<float>(Ms(renderEnd - layoutStart).count()),
+                static_cast<float>(Ms(presentEnd - renderEnd).count()),
+                static_cast<float>(Ms(frameEnd - presentEnd).count())
+            },
+            .sqliteMs = TakeSqliteMs(),
+            .render = {}
+        };
+        if (haveFrame)
+            profile.render = LastRenderStats();
+        RecordFrame(profile);
         inputNm1 = inputNm0;
         inputNm0 = layout.input;
-
-        // Phase 4: render
-        BeginDrawing();
-        ClearBackground(BLACK);
-        RenderFrame(layout.renderCommands, textCtx);
-        EndDrawing();
+        haveFrame = true;
+        layoutSlot ^= 1;
+
+        // Whatever of the layout didn't show up as waiting ran behind the render
+        frameStats.frames++;
+        frameStats.update += Ms(layoutStart - frameStart).count();
+        frameStats.layout += layout.layoutMs;
+        frameStats.render += Ms(renderEnd - layoutStart).count();
+        frameStats.present += Ms(presentEnd - renderEnd).count();
+        frameStats.wait += Ms(frameEnd - presentEnd).count();
+        if (frameStats.frames == FRAME_STATS_INTERVAL) {
+            const double n = frameStats.frames;
+            std::printf("[FRAME] update %.2f ms, layout %.2f ms (%.2f ms hidden behind the render), "
+                        "render %.2f ms, present %.2f ms, waited on layout %.2f ms\n",
+                        frameStats.update / n, frameStats.layout / n,
+                        std::max(0.0, frameStats.layout - frameStats.wait) / n,
+                        frameStats.render / n, frameStats.present / n, frameStats.wait / n);
+            frameStats = {};
+        }
     }
 
+    if (DumpLatency(LATENCY_DUMP_PATH))
+        std::printf("[LATENCY] Wrote %s\n", LATENCY_DUMP_PATH);
     return 0;
 }